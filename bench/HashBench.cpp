@@ -0,0 +1,121 @@
+// Measures how fast files without filters are fingerprinted, see
+// SHAFileUtil::SHA_Agnostic:
+//
+//   hash_bench [megabytes] [read_buffer_kb]
+//
+// Two files of the given size are written to the temporary directory, one
+// of random bytes and one of log lines, and hashed with SHA-256 from the
+// page cache in three ways:
+//   line    the way every file used to be hashed, std::getline and one
+//           digest update per line with its '\n' added back
+//   stream  the block path, read_buffer_kb reads fed straight to the digest
+//   mmap    the block path reading a mapping of the file
+// All three have to give the same digest. The best of a few runs is printed
+// in GB/s.
+#include <CryptoUtil.hpp>
+#include <FileReader.hpp>
+#include <HashingAlgorithm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+
+static constexpr int RUNS = 3;
+
+// Returns the best seconds of RUNS calls of run, digest gets what the last one returned
+template <typename Run>
+static double Best(Run &&run, std::string &digest)
+{
+    double best = 1e9;
+    for (int i = 0; i < RUNS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        digest = run();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+static std::string HashLines(const std::string &path, HashingAlgorithm::Context &ctx)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string line;
+    ctx.Init();
+    while (std::getline(file, line)) {
+        line.push_back('\n');
+        ctx.Update(line);
+    }
+    return ctx.Final();
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t size = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1024) * 1024 * 1024;
+    size_t bufferKB = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1024;
+    FileReader::SetBufferSize(bufferKB * 1024);
+
+    std::mt19937_64 random(1);
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::string binary = (directory / "hash_bench.bin").string();
+    std::string text = (directory / "hash_bench.log").string();
+    {
+        std::ofstream out(binary, std::ios::binary);
+        std::string block(1024 * 1024, '\0');
+        for (uint64_t written = 0; written < size; written += block.size()) {
+            for (size_t i = 0; i < block.size(); i += 8) {
+                uint64_t value = random();
+                std::copy_n(reinterpret_cast<const char*>(&value), 8, block.data() + i);
+            }
+            out.write(block.data(), std::min<uint64_t>(block.size(), size - written));
+        }
+    }
+    {
+        std::ofstream out(text, std::ios::binary);
+        char line[128];
+        for (uint64_t written = 0; written < size;) {
+            int length = std::snprintf(line, sizeof(line), "2024-01-01T12:%02d:%02d.%03dZ worker %d handled request %llu in %d ms\n",
+                    static_cast<int>(random() % 60), static_cast<int>(random() % 60), static_cast<int>(random() % 1000),
+                    static_cast<int>(random() % 64), static_cast<unsigned long long>(random() % 1000000000),
+                    static_cast<int>(random() % 5000));
+            out.write(line, length);
+            written += length;
+        }
+    }
+
+    HashingAlgorithmSHA256 algorithm;
+    std::unique_ptr<HashingAlgorithm::Context> ctx = algorithm.NewContext();
+    FilterMap filters;
+    std::printf("%llu MB files, %zu kB reads, %s\n", static_cast<unsigned long long>(size / (1024 * 1024)), bufferKB,
+            algorithm.Name().c_str());
+
+    int status = 0;
+    for (const std::string &path : {binary, text}) {
+        uint64_t bytes = std::filesystem::file_size(path);
+        std::string line;
+        std::string stream;
+        std::string mmap;
+        double lineSeconds = Best([&] { return HashLines(path, *ctx); }, line);
+        FileReader::SetMode(FileReader::Mode::STREAM);
+        double streamSeconds = Best([&] { return algorithm.Run(path, filters); }, stream);
+        FileReader::SetMode(FileReader::Mode::MMAP);
+        double mmapSeconds = Best([&] { return algorithm.Run(path, filters); }, mmap);
+
+        auto print = [&](const char *name, double seconds) {
+            std::printf("  %-8s %8.2f GB/s\n", name, bytes / seconds / 1e9);
+        };
+        std::printf("%s\n", path == binary ? "random bytes" : "log lines");
+        print("line", lineSeconds);
+        print("stream", streamSeconds);
+        print("mmap", mmapSeconds);
+        if (stream != line || mmap != line) {
+            std::fprintf(stderr, "Digests of %s differ\n", path.c_str());
+            status = 1;
+        }
+        std::filesystem::remove(path);
+    }
+    return status;
+}
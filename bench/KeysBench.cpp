@@ -0,0 +1,99 @@
+// Measures how fast a JSON document with keys filters is fingerprinted,
+// against the line filters that had to be used for it before, see
+// JsonDigest:
+//
+//   keys_bench [megabytes]
+//
+// A pretty printed JSON file of the given size, a list of objects with
+// metadata, annotations and a few strings to escape, is written to the
+// temporary directory and hashed with SHA-256 from the page cache:
+//   plain     no filters
+//   lines     a lines filter ignoring the third line
+//   patterns  a patterns filter with the markers of the generation values
+//   keys      a keys filter ignoring the same values by their key paths
+// The same file with a byte that is not valid JSON near its end is hashed
+// with the keys filter too, that one is read twice. The best of a few runs
+// is printed in MB/s.
+#include <CryptoUtil.hpp>
+#include <Filters.hpp>
+#include <HashingAlgorithm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+
+static constexpr int RUNS = 5;
+
+static double Best(const std::string &path, HashingAlgorithm &algorithm, const FilterMap &filters)
+{
+    double best = 1e9;
+    for (int i = 0; i < RUNS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        algorithm.Run(path, filters);
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return std::filesystem::file_size(path) / best / 1e6;
+}
+
+static FilterMap Filters(const std::string &path, std::unique_ptr<Filter> filter)
+{
+    std::vector<std::unique_ptr<Filter>> list;
+    list.push_back(std::move(filter));
+    FilterMap filters;
+    filters.emplace(path, FilterPlan(path, list));
+    return filters;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t size = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 64) * 1024 * 1024;
+
+    std::mt19937_64 random(1);
+    std::string text = "{\n  \"metadata\": {\n    \"generation\": 7,\n    \"name\": \"inventory\"\n  },\n  \"items\": [\n";
+    for (uint64_t item = 0; text.size() < size; item++) {
+        char buffer[512];
+        std::snprintf(buffer, sizeof(buffer),
+                "    {\n      \"id\": %llu,\n      \"generation\": %llu,\n      \"enabled\": %s,\n"
+                "      \"annotations\": {\"lastModified\": \"2024-01-01T12:%02d:%02dZ\", \"owner\": \"team \\\"%llu\\\"\"},\n"
+                "      \"path\": \"C:\\\\data\\\\%llu\\u00e9\",\n      \"weights\": [%.3f, %.3f, null]\n    },\n",
+                static_cast<unsigned long long>(item), static_cast<unsigned long long>(random() % 1000),
+                random() % 2 ? "true" : "false", static_cast<int>(random() % 60), static_cast<int>(random() % 60),
+                static_cast<unsigned long long>(random() % 100), static_cast<unsigned long long>(random()),
+                (random() % 100000) / 1000.0, (random() % 100000) / 1000.0);
+        text += buffer;
+    }
+    text += "    {}\n  ]\n}\n";
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path();
+    std::string path = (directory / "keys_bench.json").string();
+    std::string invalid = (directory / "keys_bench_invalid.json").string();
+    std::ofstream(path, std::ios::binary) << text;
+    text[text.size() - 4] = 'X';
+    std::ofstream(invalid, std::ios::binary) << text;
+
+    HashingAlgorithmSHA256 algorithm;
+    std::printf("%.1f MB JSON, %s\n", text.size() / 1e6, algorithm.Name().c_str());
+
+    auto print = [](const char *name, double rate) {
+        std::printf("  %-10s %10.1f MB/s\n", name, rate);
+    };
+    FilterMap none;
+    print("plain", Best(path, algorithm, none));
+    print("lines", Best(path, algorithm, Filters(path, std::make_unique<FilterLines>(path,
+            std::vector<FilterLines::Interval>{{3, 3}}))));
+    print("patterns", Best(path, algorithm, Filters(path, std::make_unique<FilterPatterns>(path,
+            std::vector<FilterPatterns::Markers>{{"\"generation\": ", ","}}, std::vector<std::string>{}))));
+    std::vector<std::string> keys{"metadata.generation", "items.*.generation"};
+    print("keys", Best(path, algorithm, Filters(path, std::make_unique<FilterKeys>(path, FilterKeys::Format::JSON, keys))));
+    print("invalid", Best(invalid, algorithm, Filters(invalid, std::make_unique<FilterKeys>(invalid,
+            FilterKeys::Format::JSON, keys))));
+
+    std::filesystem::remove(path);
+    std::filesystem::remove(invalid);
+    return 0;
+}
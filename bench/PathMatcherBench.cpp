@@ -0,0 +1,175 @@
+// Measures the compiled matcher of files: and exclude: globs, see
+// include/PathMatcher.hpp:
+//
+//   path_matcher_bench [globs] [paths]
+//
+// Half the globs are includes under absolute roots and half relative
+// excludes, the kinds a large config has. Paths are made up under the same
+// roots, a share of them matching. Three ways of matching them are timed:
+//   path       the whole path fed to the compiled matcher
+//   walk       the state of the directory kept and only the name fed, the
+//              way TreeWalker matches the entries of a directory
+//   per glob   every glob compiled on its own and tried one after another,
+//              what matching without merging the globs costs
+// The best of a few runs is printed as matches per second.
+#include <PathMatcher.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+static constexpr int RUNS = 5;
+
+struct Directory {
+    std::string path;
+    std::vector<std::string> names;
+};
+
+// Returns the best seconds of RUNS calls of run
+template <typename Run>
+static double Best(Run &&run)
+{
+    double best = 1e9;
+    for (int i = 0; i < RUNS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    size_t globCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    size_t pathCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+    size_t roots = std::max<size_t>(globCount / 2 / 3, 1);
+
+    std::vector<std::string> includes;
+    std::vector<std::string> excludes;
+    for (size_t i = 0; i < globCount; i++) {
+        size_t n = i / 2 % roots;
+        if (i % 2 == 0) {
+            switch (i / 2 % 3) {
+                case 0: includes.push_back("/srv/app" + std::to_string(n) + "/**/*.conf"); break;
+                case 1: includes.push_back("/etc/svc" + std::to_string(n) + "/*.y?ml"); break;
+                default: includes.push_back("/var/www/site" + std::to_string(n)); break;
+            }
+        } else {
+            switch (i / 2 % 3) {
+                case 0: excludes.push_back("*.log" + std::to_string(n)); break;
+                case 1: excludes.push_back("cache" + std::to_string(n)); break;
+                default: excludes.push_back("/var/www/site" + std::to_string(n) + "/tmp/**"); break;
+            }
+        }
+    }
+
+    std::mt19937 random(1);
+    auto pick = [&](size_t count) {return std::to_string(random() % count);};
+    std::vector<Directory> directories;
+    for (size_t count = 0; count < pathCount;) {
+        std::string path;
+        switch (random() % 3) {
+            case 0: path = "/srv/app" + pick(roots * 2) + "/lib/mod" + pick(10); break;
+            case 1: path = "/etc/svc" + pick(roots * 2); break;
+            default: path = "/var/www/site" + pick(roots * 2) + (random() % 4 ? "/static" : "/tmp"); break;
+        }
+        if (random() % 8 == 0)
+            path += "/cache" + pick(roots * 2);
+        Directory &directory = directories.emplace_back();
+        directory.path = path;
+        for (size_t i = 0; i < 20 && count < pathCount; i++, count++) {
+            static const char *extensions[] = {".conf", ".yaml", ".yml", ".html", ".log"};
+            std::string name = "file" + pick(1000) + extensions[random() % 5];
+            if (random() % 16 == 0)
+                name += pick(roots);
+            directory.names.push_back(name);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    PathMatcher matcher;
+    for (const std::string &glob : includes)
+        matcher.Include(glob);
+    for (const std::string &glob : excludes)
+        matcher.Exclude(glob);
+    matcher.Compile();
+    double compile = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // One matcher per glob, those of excludes match every path they do not exclude
+    std::vector<std::unique_ptr<PathMatcher>> includeMatchers;
+    std::vector<std::unique_ptr<PathMatcher>> excludeMatchers;
+    for (const std::string &glob : includes) {
+        includeMatchers.push_back(std::make_unique<PathMatcher>());
+        includeMatchers.back()->Include(glob);
+        includeMatchers.back()->Compile();
+    }
+    for (const std::string &glob : excludes) {
+        excludeMatchers.push_back(std::make_unique<PathMatcher>());
+        excludeMatchers.back()->Include("/");
+        excludeMatchers.back()->Exclude(glob);
+        excludeMatchers.back()->Compile();
+    }
+    auto perGlob = [&](const std::string &path) {
+        bool included = std::any_of(includeMatchers.begin(), includeMatchers.end(),
+                [&](const auto &include) {return include->MatchesPath(path);});
+        return included && std::all_of(excludeMatchers.begin(), excludeMatchers.end(),
+                [&](const auto &exclude) {return exclude->MatchesPath(path);});
+    };
+
+    std::vector<std::string> paths;
+    for (const Directory &directory : directories) {
+        for (const std::string &name : directory.names)
+            paths.push_back(directory.path + "/" + name);
+    }
+    size_t matching = 0;
+    for (const std::string &path : paths) {
+        bool matches = matcher.MatchesPath(path);
+        if (matches != perGlob(path)) {
+            std::fprintf(stderr, "Matchers disagree on %s\n", path.c_str());
+            return 1;
+        }
+        matching += matches;
+    }
+
+    std::printf("%zu includes, %zu excludes: %zu states, %zu byte classes, compiled in %.2f ms\n",
+            includes.size(), excludes.size(), matcher.States(), matcher.Classes(), compile * 1e3);
+    std::printf("%zu paths in %zu directories, %zu matching\n", paths.size(), directories.size(), matching);
+
+    volatile size_t sink = 0;
+    double path = Best([&] {
+        size_t count = 0;
+        for (const std::string &path : paths)
+            count += matcher.MatchesPath(path);
+        sink = count;
+    });
+    double walk = Best([&] {
+        size_t count = 0;
+        for (const Directory &directory : directories) {
+            PathMatcher::State state = matcher.RootState(directory.path);
+            if (state == PathMatcher::DEAD)
+                continue;
+            for (const std::string &name : directory.names)
+                count += matcher.Matches(matcher.Feed(state, name));
+        }
+        sink = count;
+    });
+    double naive = Best([&] {
+        size_t count = 0;
+        for (const std::string &path : paths)
+            count += perGlob(path);
+        sink = count;
+    });
+
+    auto print = [&](const char *name, double seconds) {
+        std::printf("%-10s %10.3f ms %14.0f matches/s\n", name, seconds * 1e3, paths.size() / seconds);
+    };
+    print("path", path);
+    print("walk", walk);
+    print("per glob", naive);
+    return 0;
+}
@@ -0,0 +1,106 @@
+// Measures how fast a file with many markers to ignore is filtered, see
+// FilterPatterns:
+//
+//   patterns_bench [lines]
+//
+// An HTML table of the given number of lines, each with a dozen attributes
+// data-f0 to data-f63, is hashed with SHA-256 in 1 MB chunks with the values
+// of the first n attributes ignored, for n of 1, 8, 32 and 64:
+//   segment   one segment filter with all set per marker pair and line, the
+//             way it had to be written before patterns filters existed
+//   patterns  one patterns filter with the n marker pairs
+// Both have to give the same digest. A regex filter over the same lines and
+// the file without filters are measured too. The best of a few runs is
+// printed in MB/s.
+#include <CryptoUtil.hpp>
+#include <Filters.hpp>
+#include <HashingAlgorithm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+static constexpr int RUNS = 5;
+static constexpr size_t CHUNK = 1024 * 1024;
+static const std::string FILE_NAME = "index.html";
+
+// Returns the best MB/s of RUNS digests of text, digest gets the last one
+static double Best(HashingAlgorithm &algorithm, const FilterMap &filters, const std::string &text, std::string &digest)
+{
+    double best = 1e9;
+    for (int i = 0; i < RUNS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        FileDigest file(algorithm.ThreadContext(), FILE_NAME, filters);
+        for (size_t offset = 0; offset < text.size(); offset += CHUNK)
+            file.Update(std::string_view(text).substr(offset, CHUNK));
+        digest = file.Final();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return text.size() / best / 1e6;
+}
+
+static double Run(HashingAlgorithm &algorithm, std::vector<std::unique_ptr<Filter>> &list, const std::string &text,
+        std::string &digest)
+{
+    FilterMap filters;
+    filters.emplace(FILE_NAME, FilterPlan(FILE_NAME, list));
+    return Best(algorithm, filters, text, digest);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t lines = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000;
+
+    std::mt19937 random(1);
+    std::string text;
+    for (uint64_t line = 0; line < lines; line++) {
+        for (int cell = 0; cell < 12; cell++) {
+            text += "<td class=\"c" + std::to_string(random() % 64) + "\"><span data-f" + std::to_string(random() % 64) +
+                    "=\"" + std::to_string(random()) + "\">v</span></td>";
+        }
+        text += '\n';
+    }
+
+    HashingAlgorithmSHA256 algorithm;
+    std::printf("%llu lines, %.1f MB, %s\n", static_cast<unsigned long long>(lines), text.size() / 1e6,
+            algorithm.Name().c_str());
+
+    std::string digest;
+    FilterMap none;
+    std::printf("  %-10s %10.1f MB/s\n", "plain", Best(algorithm, none, text, digest));
+
+    int status = 0;
+    for (int n : {1, 8, 32, 64}) {
+        std::vector<FilterPatterns::Markers> markers;
+        for (int i = 0; i < n; i++)
+            markers.emplace_back("data-f" + std::to_string(i) + "=\"", "\"");
+
+        std::vector<std::unique_ptr<Filter>> segments;
+        for (uint64_t line = 1; line <= lines; line++) {
+            for (const auto &[start, end] : markers)
+                segments.push_back(std::make_unique<FilterSegment>(FILE_NAME, start, end, true, line));
+        }
+        std::vector<std::unique_ptr<Filter>> patterns;
+        patterns.push_back(std::make_unique<FilterPatterns>(FILE_NAME, markers, std::vector<std::string>{}));
+
+        std::string segmentDigest;
+        std::string patternsDigest;
+        double segmentRate = Run(algorithm, segments, text, segmentDigest);
+        double patternsRate = Run(algorithm, patterns, text, patternsDigest);
+        std::printf("n=%d\n  %-10s %10.1f MB/s\n  %-10s %10.1f MB/s\n", n, "segment", segmentRate, "patterns",
+                patternsRate);
+        if (segmentDigest != patternsDigest) {
+            std::fprintf(stderr, "Digests with %d markers differ\n", n);
+            status = 1;
+        }
+    }
+
+    std::vector<std::unique_ptr<Filter>> regex;
+    regex.push_back(std::make_unique<FilterPatterns>(FILE_NAME, std::vector<FilterPatterns::Markers>{},
+            std::vector<std::string>{"data-f[0-9]+=\"[0-9]+\""}));
+    std::printf("  %-10s %10.1f MB/s\n", "regex", Run(algorithm, regex, text, digest));
+    return status;
+}
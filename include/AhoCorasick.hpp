@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Finds any of a set of strings in one pass over a text, however many
+// there are. The automaton is a full transition table, so every byte costs
+// a single lookup. Bytes that appear in none of the strings share one
+// column of it, which keeps the table small enough to stay in cache
+class AhoCorasick {
+    public:
+        using State = uint32_t;
+        static constexpr State ROOT = 0;
+        static constexpr int32_t NO_MATCH = -1;
+
+        // Throws std::invalid_argument for an empty string
+        explicit AhoCorasick(const std::vector<std::string> &strings);
+
+        // Feeds data to the automaton, starting in state. Stops after the
+        // first byte that completes one of the strings and returns the
+        // offset just past it, std::string_view::npos when data has none.
+        // state is left where the automaton stopped, so a text can be fed
+        // in parts. index is set to the string found, the first one
+        // configured when several end at the same byte
+        size_t Find(std::string_view data, State &state, int32_t &index) const;
+
+    private:
+        std::array<uint16_t, 256> m_Class{};
+        size_t m_Classes = 1;
+        // m_Classes transitions per state
+        std::vector<State> m_Next;
+        // String ending in each state, NO_MATCH when none does
+        std::vector<int32_t> m_Match;
+        // First byte of all the strings when they share it, -1 otherwise.
+        // In the root state, bytes up to the next one are skipped with memchr
+        int m_First = -1;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class ThreadPool;
+
+// BLAKE3 hasher (https://github.com/BLAKE3-team/BLAKE3-specs). Whole chunks
+// are hashed several at a time with the widest SIMD kernel the CPU supports,
+// picked at runtime. Big updates can also be spread over a thread pool.
+class Blake3Hasher {
+    public:
+        static constexpr size_t OUT_LEN = 32;
+        static constexpr size_t BLOCK_LEN = 64;
+        static constexpr size_t CHUNK_LEN = 1024;
+
+        Blake3Hasher() {Reset();}
+
+        // Starts a new hash
+        void Reset();
+        void Update(const void *data, size_t len);
+        // Writes outLen bytes of the hash of everything passed to Update.
+        // Does not change the state, more input may follow
+        void Finalize(uint8_t *out, size_t outLen = OUT_LEN) const;
+
+        // Updates with at least minBytes of input are split between the
+        // threads of the pool, nullptr disables it
+        void SetPool(ThreadPool *pool, size_t minBytes);
+
+        // Name of the SIMD kernel in use, for the logs
+        static const char *Implementation();
+
+    private:
+        struct ChunkState {
+            uint32_t cv[8];
+            uint64_t counter;
+            uint8_t buf[BLOCK_LEN];
+            uint8_t bufLen;
+            uint8_t blocksCompressed;
+
+            void Reset(const uint32_t key[8], uint64_t chunkCounter);
+            size_t Len() const {return BLOCK_LEN * blocksCompressed + bufLen;}
+            size_t Update(const uint8_t *input, size_t len);
+        };
+
+        // Hashes whole chunks, which are known not to be the last ones
+        void HashChunks(const uint8_t *input, size_t chunks);
+        void PushChunkCV(const uint32_t cv[8], uint64_t totalChunks);
+
+        uint32_t m_Key[8];
+        ChunkState m_Chunk;
+        // Chaining values of complete subtrees, at most one per level
+        uint32_t m_Stack[54][8];
+        uint8_t m_StackLen;
+
+        ThreadPool *m_Pool = nullptr;
+        size_t m_PoolMinBytes = 0;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+// Internals of Blake3Hasher shared with the SIMD kernels, see Blake3.hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace blake3 {
+
+enum Flags : uint8_t {
+    CHUNK_START = 1 << 0,
+    CHUNK_END   = 1 << 1,
+    PARENT      = 1 << 2,
+    ROOT        = 1 << 3,
+};
+
+constexpr size_t BLOCK_LEN = 64;
+constexpr size_t CHUNK_LEN = 1024;
+
+constexpr uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+// Message word order of each of the 7 rounds
+constexpr uint8_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+inline uint32_t Load32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+inline void Store32(uint8_t *p, uint32_t w)
+{
+    p[0] = static_cast<uint8_t>(w);
+    p[1] = static_cast<uint8_t>(w >> 8);
+    p[2] = static_cast<uint8_t>(w >> 16);
+    p[3] = static_cast<uint8_t>(w >> 24);
+}
+
+// Compresses one block into cv
+void CompressInPlace(uint32_t cv[8], const uint8_t block[BLOCK_LEN], uint8_t blockLen, uint64_t counter, uint8_t flags);
+// Compresses one block into 64 bytes of extended output
+void CompressXof(const uint32_t cv[8], const uint8_t block[BLOCK_LEN], uint8_t blockLen, uint64_t counter, uint8_t flags, uint8_t out[64]);
+
+// Hashes count whole chunks, which follow each other in input, and writes
+// their chaining values to out. The first chunk has the given counter.
+// Uses the widest kernel the CPU supports
+void HashChunks(const uint8_t *input, size_t count, const uint32_t key[8], uint64_t counter, uint8_t *out);
+
+// Kernels hashing N whole chunks at once, one SIMD lane per chunk.
+// inputs points to the start of every chunk
+void HashChunksSse41(const uint8_t *const inputs[4], const uint32_t key[8], uint64_t counter, uint8_t *out);
+void HashChunksAvx2(const uint8_t *const inputs[8], const uint32_t key[8], uint64_t counter, uint8_t *out);
+void HashChunksAvx512(const uint8_t *const inputs[16], const uint32_t key[8], uint64_t counter, uint8_t *out);
+
+// Body of the SIMD kernels. V is one of the lane types of SimdLanes.hpp
+template <typename V>
+inline void G(typename V::Vec v[16], int a, int b, int c, int d, typename V::Vec x, typename V::Vec y)
+{
+    v[a] = V::Add(V::Add(v[a], v[b]), x);
+    v[d] = V::template Rotr<16>(V::Xor(v[d], v[a]));
+    v[c] = V::Add(v[c], v[d]);
+    v[b] = V::template Rotr<12>(V::Xor(v[b], v[c]));
+    v[a] = V::Add(V::Add(v[a], v[b]), y);
+    v[d] = V::template Rotr<8>(V::Xor(v[d], v[a]));
+    v[c] = V::Add(v[c], v[d]);
+    v[b] = V::template Rotr<7>(V::Xor(v[b], v[c]));
+}
+
+template <typename V>
+inline void HashChunksSimd(const uint8_t *const inputs[V::N], const uint32_t key[8], uint64_t counter, uint8_t *out)
+{
+    using Vec = typename V::Vec;
+
+    uint32_t counterLow[V::N], counterHigh[V::N];
+    for (size_t i = 0; i < V::N; i++) {
+        counterLow[i] = static_cast<uint32_t>(counter + i);
+        counterHigh[i] = static_cast<uint32_t>((counter + i) >> 32);
+    }
+    const Vec ctrLow = V::Load(counterLow);
+    const Vec ctrHigh = V::Load(counterHigh);
+
+    Vec h[8];
+    for (int i = 0; i < 8; i++)
+        h[i] = V::Set1(key[i]);
+
+    for (size_t block = 0; block < CHUNK_LEN / BLOCK_LEN; block++) {
+        uint8_t flags = 0;
+        if (block == 0)
+            flags |= CHUNK_START;
+        if (block == CHUNK_LEN / BLOCK_LEN - 1)
+            flags |= CHUNK_END;
+
+        Vec m[16];
+        V::LoadTransposed(inputs, block * BLOCK_LEN, m);
+
+        Vec v[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            V::Set1(IV[0]), V::Set1(IV[1]), V::Set1(IV[2]), V::Set1(IV[3]),
+            ctrLow, ctrHigh, V::Set1(BLOCK_LEN), V::Set1(flags),
+        };
+
+        for (int r = 0; r < 7; r++) {
+            const uint8_t *s = MSG_SCHEDULE[r];
+            G<V>(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+            G<V>(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+            G<V>(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+            G<V>(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+            G<V>(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+            G<V>(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+            G<V>(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+            G<V>(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+        }
+
+        for (int i = 0; i < 8; i++)
+            h[i] = V::Xor(v[i], v[i + 8]);
+    }
+
+    // Once per chunk, so not worth a transpose
+    uint32_t words[8][V::N];
+    for (int i = 0; i < 8; i++)
+        V::Store(words[i], h[i]);
+    for (size_t lane = 0; lane < V::N; lane++)
+        for (int i = 0; i < 8; i++)
+            Store32(out + lane * 32 + i * 4, words[i][lane]);
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Reports changes to the entries of directories from kernel events, so only
+// the files that changed have to be hashed. inotify needs a watch for every
+// directory, up to fs.inotify.max_user_watches of them. fanotify marks whole
+// file systems instead, so it suits very large trees, and needs CAP_SYS_ADMIN
+// and Linux 5.9. Events of directories that are not watched are dropped.
+// Linux only
+class ChangeWatcher {
+    public:
+        enum class Backend {
+            INOTIFY,
+            FANOTIFY,
+        };
+
+        struct Event {
+            std::string path;       // The watched directory joined with the name
+            bool directory = false;
+            bool entry = false;     // Created, deleted or moved, not just written to or changed metadata
+        };
+
+        // Throws std::runtime_error when the backend can not be set up
+        explicit ChangeWatcher(Backend backend);
+        ~ChangeWatcher();
+
+        ChangeWatcher(const ChangeWatcher&) = delete;
+        ChangeWatcher& operator=(const ChangeWatcher&) = delete;
+
+        const char *Name() const {return m_Backend == Backend::INOTIFY ? "inotify" : "fanotify";}
+
+        // Watches the entries of directories in place of the ones watched
+        // before, an empty path is the current directory. Returns how many
+        // of them could not be watched
+        size_t Watch(const std::vector<std::string> &directories);
+
+        // Waits up to timeout milliseconds for events and appends them to
+        // events. Returns false when the kernel dropped events because the
+        // queue overflowed, changes may have been missed then
+        bool Read(int timeout, std::vector<Event> &events);
+
+    private:
+        // A file system marked by fanotify
+        struct FileSystem {
+            uint64_t device;
+            uint64_t fsid;
+            int fd;                 // Directory on it the file handles are opened relative to
+        };
+
+        Backend m_Backend;
+        int m_Fd = -1;
+        std::vector<char> m_Buffer;
+        // inotify, watch descriptors of the directories and the other way around
+        std::unordered_map<int, std::string> m_Directories;
+        std::unordered_map<std::string, int> m_Watches;
+        // fanotify, the watched directories by the path the kernel resolves them to
+        std::vector<FileSystem> m_FileSystems;
+        std::unordered_map<std::string, std::string> m_Resolved;
+        std::unordered_map<std::string, std::string> m_Handles;    // Resolved directory by its file handle
+
+        void ReadInotify(std::vector<Event> &events, bool &complete);
+        void ReadFanotify(std::vector<Event> &events, bool &complete);
+        // Watched directory of a file handle fanotify reported, nullptr when not watched
+        const std::string *ResolveHandle(uint64_t fsid, const void *handle);
+};
@@ -1,51 +1,158 @@
 #pragma once
 
+#include <FileReader.hpp>
 #include <Filters.hpp>
 #include <HashingAlgorithm.hpp>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <openssl/crypto.h>
 
+#include <cstdint>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <vector>
 
-class SHAFileUtil
+// Destination of a line filtered while it is streamed, see CryptoUtil.cpp
+class LineSink;
+class JsonDigest;
+
+// Digest of a single file, fed with consecutive chunks of its contents.
+// When the file has filters, the chunks are split into lines and filtered.
+// Files with bytes filters are the exception, whoever reads them reads only
+// the parts FilterBytes::Kept returns and feeds them here in order.
+// Files with normalize filters are normalized on the way in, before any
+// other filter applies, without copying the chunks.
+// JSON files with keys filters are digested in their canonical form.
+// YAML files with keys filters can not be fed in chunks, YamlDigest reads them.
+// Memory does not grow with the length of the lines: only lines with segment
+// filters are held whole, and only up to the max line size. Longer ones are
+// filtered while they stream through.
+class FileDigest
 {
 public:
-    static std::string SHA256(
-        const std::string &filename,
-        const FilterMap &filters);
+    // Starts a new digest on ctx, which must outlive the FileDigest
+    FileDigest(HashingAlgorithm::Context &ctx, const std::string &path, const FilterMap &filters);
+    ~FileDigest();
 
-    static std::string SHA512(
-        const std::string &filename,
-        const FilterMap &filters = GetEmptyFilterMap()
-    );
+    FileDigest(const FileDigest&) = delete;
+    FileDigest& operator=(const FileDigest&) = delete;
 
-    static std::string Blake2s256(
-        const std::string &filename,
-        const FilterMap &filters = GetEmptyFilterMap()
-    );
+    void Update(std::string_view chunk);
+    // Returns the hex encoded digest
+    std::string Final();
 
-    static std::string Blake2s512(
-        const std::string &filename,
-        const FilterMap &filters = GetEmptyFilterMap()
-    );
+    // Lines with segment or patterns filters up to this long are filtered
+    // in memory, longer ones while they stream through. Regexes and plugins
+    // need whole lines, they are not applied to longer lines, nor to lines
+    // of more than FilterPatterns::MAX_REGEX_LINE in the case of regexes
+    static void SetMaxLineSize(size_t bytes);
 
-    static std::string SHA3_256(
+private:
+    HashingAlgorithm::Context &m_Ctx;
+    // nullptr when the file has no filters
+    const FilterPlan *m_Plan;
+    // Where the line counter is in m_Plan
+    std::optional<FilterLines::Cursor> m_LinesCursor;
+    size_t m_NextSegment = 0;
+    // Lines produced by all but the last segment filter of a line. Kept so
+    // a filtered line does not allocate
+    std::string m_Segmented[2];
+    // Line left by the markers of a patterns filter, for its regexes
+    std::string m_Patterned;
+    // One session of every plugin filter of the file, in order, and the
+    // lines the segment and patterns filters and all but the last plugin
+    // leave for the next one
+    std::vector<FilterPlugin::Session> m_Sessions;
+    std::string m_Plugged[2];
+    // Small parts of filtered lines or normalized files waiting to be digested
+    std::string m_Parts;
+    static constexpr size_t SMALL_PART = 256;
+    static constexpr size_t PARTS_BUFFER = 16 * 1024;
+    // Parts of normalized files and of lines filtered by plugins are
+    // gathered in larger buffers, see Digest
+    static constexpr size_t LARGE_PARTS_BUFFER = 256 * 1024;
+    uint64_t m_LineNumber = 0;
+    // What happens to the rest of a line that continues in the next chunk
+    enum class Partial {
+        NONE,
+        PLAIN,      // Digested as it comes
+        SKIPPED,
+        CARRY,      // Kept in m_Carry until it is whole
+        STREAM,     // Too long for m_Carry, fed through m_Stream
+    };
+    Partial m_Partial = Partial::NONE;
+    // Beginning of a line that started in one of the previous chunks
+    std::string m_Carry;
+    std::unique_ptr<LineSink> m_Stream;
+    // Longest line held whole, see SetMaxLineSize
+    size_t m_MaxLine = 0;
+    std::string m_Path;
+    bool m_WarnedLongLine = false;
+    // Last byte of an unfiltered file
+    char m_Last = '\n';
+    // The file has bytes filters, it is fed only the bytes kept and they are
+    // digested as they are
+    bool m_Binary = false;
+    // Set for JSON files with keys filters
+    std::unique_ptr<JsonDigest> m_Json;
+    // Set for files with normalize filters
+    const FilterNormalize *m_Normalize = nullptr;
+    static constexpr std::string_view BOM = "\xEF\xBB\xBF";
+    // Bytes of the byte order mark seen at the start of the file, its size
+    // once it is known whether there is one
+    size_t m_BomBytes = BOM.size();
+    // Blanks at the end of the previous chunk, dropped when the line ends
+    // after them
+    std::string m_Blanks;
+
+    void Normalize(std::string_view chunk);
+    // Digests a chunk as it is after normalization
+    void Digest(std::string_view chunk);
+    void UpdateLines(std::string_view chunk);
+    // part is the next part of the line m_Partial is about, ends when the
+    // line ends with it
+    void ContinueLine(std::string_view part, bool ends);
+    void DigestLine(std::string_view line);
+    void ApplyPlugins(std::string_view line);
+    // Stages of the filters that can work on a line in parts, for a line
+    // longer than m_MaxLine
+    std::unique_ptr<LineSink> LineStream(uint64_t line);
+    void StreamLine(std::string_view line);
+    uint64_t RunLength(uint64_t line, bool &skip);
+    // Segment filters of the line are [first, last) of m_Plan's
+    void LineSegments(uint64_t line, size_t &first, size_t &last);
+    // Parts shorter than small are gathered in m_Parts, until there are
+    // small bytes of them or PARTS_BUFFER when that is more
+    void DigestPart(std::string_view part, size_t small = SMALL_PART);
+    void FlushParts();
+};
+
+class SHAFileUtil
+{
+public:
+    // Hashes the whole file on the context, applying the filters configured for it
+    static std::string SHA_Agnostic(
         const std::string &filename,
+        HashingAlgorithm::Context &ctx,
         const FilterMap &filters = GetEmptyFilterMap()
     );
 
-    static std::string SHA3_512(
+    // Merkle tree over the chunks of a file. A leaf is the digest of 0x00
+    // followed by the chunk, an inner node the digest of 0x01 followed by the
+    // two children. The last node of an odd level moves up a level as it is
+    static std::string MerkleLeaf(
         const std::string &filename,
-        const FilterMap &filters = GetEmptyFilterMap()
+        uint64_t offset,
+        uint64_t length,
+        HashingAlgorithm::Context &ctx
     );
 
-    static std::string SHA_Agnostic(
-        const std::string &filename,
-        const EVP_MD *a,
-        const FilterMap &filters = GetEmptyFilterMap()
+    static std::string MerkleRoot(
+        const std::vector<std::string> &leaves,
+        HashingAlgorithm::Context &ctx
     );
 
 private:
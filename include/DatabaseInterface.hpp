@@ -14,6 +14,8 @@ public:
         INSERT,
         DELETEONE,
         DELETEALL,
+        SELECTLEAVES,   // Chunk digests of a file hashed as a Merkle tree
+        INSERTLEAVES,
     };
 
 public:
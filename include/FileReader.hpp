@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Reads a file as a sequence of consecutive chunks. A chunk returned by
+// Next stays valid until the next call to Next or until the reader is
+// destroyed. Only one reader per thread should be active at a time, the
+// stream reader reuses a per-thread buffer.
+class FileReader {
+    public:
+        enum class Mode {
+            STREAM,     // std::ifstream reads into a reusable buffer
+            MMAP,       // read-only mapping of the file, mapped in windows
+        };
+
+        virtual ~FileReader() = default;
+
+        // Returns false once the whole file was read
+        virtual bool Next(std::string_view &chunk) = 0;
+
+        // Opens the file with the configured mode, throws on failure
+        static std::unique_ptr<FileReader> Open(const std::string &path);
+        // Same as Open, but reads only length bytes starting at offset
+        static std::unique_ptr<FileReader> OpenRange(const std::string &path, uint64_t offset, uint64_t length);
+
+        static void SetMode(Mode mode);
+        // Size of the buffer used by the stream reader
+        static void SetBufferSize(size_t bytes);
+        // Size of the address space window mapped at once by the mmap reader
+        static void SetWindowSize(size_t bytes);
+
+    protected:
+        FileReader() {};
+
+        static Mode s_Mode;
+        static size_t s_BufferSize;
+        static size_t s_WindowSize;
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+/*
+ * C ABI of filter plugins, shared libraries declared in the filter: section
+ * of the config with type "plugin". A plugin filters lines like a patterns
+ * filter does: it is given every line of the file, after the segment and
+ * patterns filters of the file, and returns the spans of it that are kept.
+ * The spans point into the line, which points into the read buffer whenever
+ * no other filter changed the line, so nothing is copied on the way to the
+ * digest.
+ *
+ * The library exports MONITOR_FILTER_ENTRY, a function returning its
+ * monitor_filter_plugin. Its functions may be called from several threads
+ * at once, for different files or different digests of the same file. All
+ * a digest needs to keep from one line to the next belongs in the state
+ * begin returns.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MONITOR_FILTER_ABI_VERSION 1
+
+/* Name of the function the library exports, a monitor_filter_entry_fn */
+#define MONITOR_FILTER_ENTRY "monitor_filter_plugin_entry"
+
+/* Part of a line that is kept, offset counted from the start of the line */
+typedef struct monitor_filter_span {
+    size_t offset;
+    size_t length;
+} monitor_filter_span;
+
+/* Option of the filter, from its options map in the config */
+typedef struct monitor_filter_option {
+    const char *key;
+    const char *value;
+} monitor_filter_option;
+
+/* Returned by apply when the line can not be filtered. The digest of the file
+ * fails with an error */
+#define MONITOR_FILTER_ERROR ((size_t)-1)
+
+typedef struct monitor_filter_plugin {
+    /* MONITOR_FILTER_ABI_VERSION the plugin was built with */
+    uint32_t abi_version;
+    const char *name;
+
+    /* Creates the filter of one file. Returns NULL and writes a message to
+     * error, error_size bytes at most including the terminating null, when
+     * the options are not valid */
+    void *(*create)(const char *path, const monitor_filter_option *options, size_t option_count,
+                    char *error, size_t error_size);
+    void (*destroy)(void *filter);
+
+    /* Optional, may be NULL. begin is called when a digest of the file starts
+     * and returns the state passed to apply for its lines, end when the digest
+     * is over. Without begin, the state is NULL */
+    void *(*begin)(void *filter);
+    void (*end)(void *filter, void *state);
+
+    /* Filters a line of length bytes, without its newline. line_number counts
+     * from 1. Writes the kept spans, in order and not overlapping, to kept and
+     * returns how many there are. When there are more than capacity, only
+     * capacity of them are written and apply is called again for the same
+     * line with room for all of them. Returns MONITOR_FILTER_ERROR on failure */
+    size_t (*apply)(void *filter, void *state, const char *line, size_t length, uint64_t line_number,
+                    monitor_filter_span *kept, size_t capacity);
+} monitor_filter_plugin;
+
+typedef const monitor_filter_plugin *(*monitor_filter_entry_fn)(void);
+
+/* For plugins, to export their entry:
+ * MONITOR_FILTER_EXPORT const monitor_filter_plugin *monitor_filter_plugin_entry(void) */
+#ifdef _WIN32
+#define MONITOR_FILTER_EXPORT __declspec(dllexport)
+#else
+#define MONITOR_FILTER_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+}
+#endif
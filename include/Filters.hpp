@@ -1,16 +1,19 @@
 #pragma once
 
+#include <AhoCorasick.hpp>
+#include <FilterPluginAbi.h>
+#include <SimdSearch.hpp>
+
 #include <cstdint>
+#include <optional>
+#include <regex>
+#include <span>
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include <utility>
 #include <memory>
 #include <vector>
-#include <map>
-
-// forward declaration to allow for FilterMap
-class Filter;
-
-using FilterMap = std::map<std::string, std::vector<std::unique_ptr<Filter>>>;
+#include <unordered_map>
 
 // Base class
 class Filter {
@@ -25,14 +28,47 @@ class Filter {
 // Derived class: filters out entire lines
 class FilterLines : public Filter {
     public:
-        FilterLines(const std::string& filename, const std::unordered_set<uint64_t> &set)
-            : Filter(filename), m_Lines(set) {}
+        // Inclusive range of line numbers
+        using Interval = std::pair<uint64_t, uint64_t>;
+
+        // intervals may overlap and come in any order, they are sorted and
+        // merged here
+        FilterLines(const std::string& filename, std::vector<Interval> intervals);
 
         // returns if or not the filter contains the number
-        bool Contains(const uint64_t n);
+        bool Contains(const uint64_t n) const;
+
+        // Walks the intervals along with the line counter of a file, so
+        // checking a line costs no search. The numbers passed to Contains
+        // must not decrease
+        class Cursor {
+            public:
+                explicit Cursor(const FilterLines &filter) : m_It(filter.m_Intervals.begin()), m_End(filter.m_Intervals.end()) {}
+
+                bool Contains(uint64_t n)
+                {
+                    const Interval *interval = Next(n);
+                    return interval && interval->first <= n;
+                }
+
+                // First interval that ends at or after n, nullptr when there
+                // is none
+                const Interval *Next(uint64_t n)
+                {
+                    while (m_It != m_End && m_It->second < n)
+                        ++m_It;
+                    return m_It != m_End ? &*m_It : nullptr;
+                }
+
+            private:
+                std::vector<Interval>::const_iterator m_It;
+                std::vector<Interval>::const_iterator m_End;
+        };
+
+        const std::vector<Interval> &Intervals() const {return m_Intervals;}
 
     private:
-        std::unordered_set<uint64_t> m_Lines;
+        std::vector<Interval> m_Intervals;
 };
 
 // Derived class: filters out parts (segments) of a line
@@ -42,13 +78,320 @@ class FilterSegment : public Filter {
                     const bool removeAll, const uint64_t line)
             : Filter(filename), m_Start(start), m_End(end), m_removeAll(removeAll), m_Line(line) {}
 
-        // Filters out the part of the string specified
-        std::string Apply(const std::string &s);
-        uint64_t Line() {return m_Line;}
+        // Filters out the part of the string specified. emit is called with
+        // every part of s that is kept, in order. The parts point into s
+        template <typename Emit>
+        void Apply(std::string_view s, Emit &&emit) const;
+        // Appends what is kept of s to out
+        void Apply(std::string_view s, std::string &out) const
+        {
+            Apply(s, [&out](std::string_view part) { out.append(part); });
+        }
+        uint64_t Line() const {return m_Line;}
+        const std::string &Start() const {return m_Start;}
+        const std::string &End() const {return m_End;}
+        bool RemoveAll() const {return m_removeAll;}
 
     private:
         uint64_t m_Line;
         std::string m_Start;
         std::string m_End;
-        const bool m_removeAll;
+        bool m_removeAll;
+};
+
+// Derived class: filters out parts of every line. Between a start and an
+// end marker of any of its pairs, like a segment filter with all set, and
+// whatever matches any of its regexes. All start markers are looked for in
+// one pass, all regexes in another, however many there are
+class FilterPatterns : public Filter {
+    public:
+        // Start and end marker
+        using Markers = std::pair<std::string, std::string>;
+
+        // Throws std::invalid_argument for empty markers and invalid regexes
+        FilterPatterns(const std::string &filename, std::vector<Markers> markers, std::vector<std::string> regexes);
+
+        // emit is called with every part of s that is kept, in order. The
+        // parts point into s, or into scratch when there are regexes.
+        // Markers are applied first: the pair of the first start marker
+        // found removes what is between it and its end marker, and the
+        // search goes on from there. When its end marker is not on the line,
+        // the rest of it is kept
+        template <typename Emit>
+        void Apply(std::string_view s, std::string &scratch, Emit &&emit) const;
+
+        const std::vector<Markers> &MarkerPairs() const {return m_Markers;}
+        const std::vector<std::string> &Regexes() const {return m_Regexes;}
+        bool HasRegexes() const {return m_Regex.has_value();}
+
+        // Longest line the regexes are applied to. std::regex recurses for
+        // every character of a match, a few hundred bytes of stack each, so
+        // a longer line could overflow the stack of the thread hashing it.
+        // Longer lines only go through the markers
+        static constexpr size_t MAX_REGEX_LINE = 16 * 1024;
+        // All start markers, for a line that is fed in parts
+        const AhoCorasick &Starts() const {return m_Starts;}
+        // End marker of every pair on its own, for the same
+        const std::vector<AhoCorasick> &Ends() const {return m_Ends;}
+
+    private:
+        template <typename Emit>
+        void ApplyMarkers(std::string_view s, Emit &&emit) const;
+
+        std::vector<Markers> m_Markers;
+        std::vector<std::string> m_Regexes;
+        AhoCorasick m_Starts;
+        std::vector<AhoCorasick> m_Ends;
+        // All regexes as one alternation
+        std::optional<std::regex> m_Regex;
+};
+
+// Derived class: filters out byte ranges of a file, for binaries with
+// volatile headers or timestamps at fixed offsets. Such files are not split
+// into lines, the bytes outside of the ranges are digested as they are and
+// the ranges are not read at all
+class FilterBytes : public Filter {
+    public:
+        struct Range {
+            // Negative offsets count from the end of the file
+            int64_t offset;
+            uint64_t length;
+        };
+        // Part of a file, [first, second)
+        using Span = std::pair<uint64_t, uint64_t>;
+
+        FilterBytes(const std::string &filename, std::vector<Range> ranges)
+            : Filter(filename), m_Ranges(std::move(ranges)) {}
+
+        // Parts of a file of size bytes that are kept, in order. Ranges
+        // reaching past either end of the file are cut off there
+        std::vector<Span> Kept(uint64_t size) const;
+        const std::vector<Range> &Ranges() const {return m_Ranges;}
+
+    private:
+        std::vector<Range> m_Ranges;
+};
+
+// Derived class: leaves the values at some key paths of a JSON or YAML
+// document out, for configs where a few keys legitimately change. Such files
+// are not split into lines, the document is digested in a canonical form
+// that does not change when only its formatting does, see StructuredDigest.hpp
+class FilterKeys : public Filter {
+    public:
+        enum class Format {JSON, YAML};
+
+        // One step of a key path: a map key, a sequence index or * for any
+        struct Component {
+            std::string key;
+            bool any = false;
+            // The key is a number, which also matches that sequence index
+            bool isIndex = false;
+            uint64_t index = 0;
+        };
+        using Path = std::vector<Component>;
+
+        // paths are dot separated, like metadata.generation or items.*.serial.
+        // Throws std::invalid_argument for empty paths and components
+        FilterKeys(const std::string &filename, Format format, std::vector<std::string> paths);
+
+        Format DocumentFormat() const {return m_Format;}
+        const std::vector<Path> &Paths() const {return m_Paths;}
+        // The paths as configured
+        const std::vector<std::string> &Sources() const {return m_Sources;}
+
+    private:
+        Format m_Format;
+        std::vector<std::string> m_Sources;
+        std::vector<Path> m_Paths;
+};
+
+// Derived class: normalizes a text file before it is digested, so files an
+// editor saved with CRLF line ends, trailing whitespace or a byte order mark
+// hash the same as they did before. Lines keep their numbers, so the other
+// filters of the file apply to the normalized lines as they did
+class FilterNormalize : public Filter {
+    public:
+        // bom strips a UTF-8 byte order mark at the start of the file.
+        // whitespace strips spaces, tabs and CRs at the end of every line,
+        // otherwise only the CRs of CRLF line ends are
+        FilterNormalize(const std::string &filename, bool bom, bool whitespace)
+            : Filter(filename), m_Bom(bom), m_Whitespace(whitespace) {}
+
+        bool Bom() const {return m_Bom;}
+        bool Whitespace() const {return m_Whitespace;}
+
+    private:
+        bool m_Bom;
+        bool m_Whitespace;
+};
+
+// Derived class: filters every line with a plugin, a shared library
+// implementing the C ABI of FilterPluginAbi.h. Copies share the plugin's
+// filter, which is destroyed and unloaded with the last of them
+class FilterPlugin : public Filter {
+    public:
+        using Options = std::vector<std::pair<std::string, std::string>>;
+
+        // Loads library and creates its filter for filename. Throws
+        // std::runtime_error when the library can not be loaded or does not
+        // implement the ABI, std::invalid_argument when the plugin does not
+        // accept the options
+        FilterPlugin(const std::string &filename, const std::string &library, const Options &options);
+
+        // One digest of the file, with the state the plugin keeps for it
+        class Session {
+            public:
+                explicit Session(const FilterPlugin &filter);
+                ~Session();
+                Session(Session &&other) noexcept;
+                Session(const Session&) = delete;
+                Session& operator=(const Session&) = delete;
+                Session& operator=(Session&&) = delete;
+
+                // Spans of line the plugin keeps, valid until the next call.
+                // Throws std::runtime_error when the plugin fails or returns
+                // spans that are not in order inside of the line
+                std::span<const monitor_filter_span> Apply(std::string_view line, uint64_t lineNumber);
+
+            private:
+                const FilterPlugin &m_Filter;
+                void *m_State = nullptr;
+                // Moved to another session, which ends the state
+                bool m_Moved = false;
+                // Room for the spans of a line, grows when a line has more
+                std::vector<monitor_filter_span> m_Kept;
+        };
+
+        const std::string &Library() const {return m_Library;}
+        // Name the plugin gives itself
+        const std::string &Name() const;
+
+    private:
+        // The loaded library and the filter the plugin created
+        struct Instance;
+
+        std::string m_Library;
+        std::shared_ptr<const Instance> m_Instance;
 };
+
+// Filters of one file compiled for FileDigest. All of its lines filters are
+// merged into one interval list, a line is skipped when any of them has it.
+// Segment filters are sorted by their line, filters of the same line keep
+// the order they were configured in. FileDigest walks both forward along
+// with its line counter, so a line costs no lookups, casts or virtual calls.
+// Patterns filters are merged into one, which applies to every line after
+// its segment filters. Plugin filters apply to every line after that, in
+// the order they were configured in. Bytes and keys filters are merged as
+// well, neither can be combined with filters of another type. Normalize
+// filters are merged into one doing what any of them does
+class FilterPlan {
+    public:
+        // Throws std::runtime_error for filters of an unknown type and
+        // std::invalid_argument for bytes or keys filters mixed with others
+        FilterPlan(const std::string &filename, const std::vector<std::unique_ptr<Filter>> &filters);
+
+        // The file has lines, segment, patterns or plugin filters, it is
+        // filtered line by line
+        bool SplitsLines() const {return m_SplitsLines;}
+        const FilterLines &Lines() const {return m_Lines;}
+        const std::vector<FilterSegment> &Segments() const {return m_Segments;}
+        // nullptr when the file has no patterns filters
+        const FilterPatterns *Patterns() const {return m_Patterns ? &*m_Patterns : nullptr;}
+        // nullptr when the file has no bytes filters
+        const FilterBytes *Bytes() const {return m_Bytes ? &*m_Bytes : nullptr;}
+        // nullptr when the file has no keys filters
+        const FilterKeys *Keys() const {return m_Keys ? &*m_Keys : nullptr;}
+        // nullptr when the file has no normalize filters
+        const FilterNormalize *Normalize() const {return m_Normalize ? &*m_Normalize : nullptr;}
+        const std::vector<FilterPlugin> &Plugins() const {return m_Plugins;}
+
+    private:
+        bool m_SplitsLines = false;
+        FilterLines m_Lines;
+        std::vector<FilterSegment> m_Segments;
+        std::optional<FilterPatterns> m_Patterns;
+        std::optional<FilterBytes> m_Bytes;
+        std::optional<FilterKeys> m_Keys;
+        std::optional<FilterNormalize> m_Normalize;
+        std::vector<FilterPlugin> m_Plugins;
+};
+
+// Filter plan of every filtered file, by path
+using FilterMap = std::unordered_map<std::string, FilterPlan>;
+
+template <typename Emit>
+void FilterSegment::Apply(std::string_view s, Emit &&emit) const
+{
+    std::size_t pos = 0;
+
+    while (true) {
+        std::size_t startPos = SimdSearch::Find(s, m_Start, pos);
+        if (startPos == std::string::npos) {
+            emit(s.substr(pos));
+            break;
+        }
+
+        std::size_t endPos = SimdSearch::Find(s, m_End, startPos + m_Start.size());
+        if (endPos == std::string::npos) {
+            emit(s.substr(pos));
+            break;
+        }
+
+        emit(s.substr(pos, startPos + m_Start.size() - pos));
+        pos = endPos;
+
+        if (!m_removeAll) {
+            emit(s.substr(pos));
+            break;
+        }
+    }
+}
+
+template <typename Emit>
+void FilterPatterns::ApplyMarkers(std::string_view s, Emit &&emit) const
+{
+    std::size_t pos = 0;
+
+    while (true) {
+        AhoCorasick::State state = AhoCorasick::ROOT;
+        int32_t index;
+        std::size_t found = m_Starts.Find(s.substr(pos), state, index);
+        if (found == std::string::npos) {
+            emit(s.substr(pos));
+            break;
+        }
+
+        std::size_t startEnd = pos + found;
+        std::size_t endPos = SimdSearch::Find(s, m_Markers[index].second, startEnd);
+        if (endPos == std::string::npos) {
+            emit(s.substr(pos));
+            break;
+        }
+
+        emit(s.substr(pos, startEnd - pos));
+        pos = endPos;
+    }
+}
+
+template <typename Emit>
+void FilterPatterns::Apply(std::string_view s, std::string &scratch, Emit &&emit) const
+{
+    if (!m_Regex) {
+        ApplyMarkers(s, emit);
+        return;
+    }
+
+    if (!m_Markers.empty()) {
+        scratch.clear();
+        ApplyMarkers(s, [&scratch](std::string_view part) { scratch.append(part); });
+        s = scratch;
+    }
+
+    std::size_t pos = 0;
+    for (std::cregex_iterator it(s.data(), s.data() + s.size(), *m_Regex), end; it != end; ++it) {
+        std::size_t matchPos = static_cast<std::size_t>(it->position());
+        emit(s.substr(pos, matchPos - pos));
+        pos = matchPos + static_cast<std::size_t>(it->length());
+    }
+    emit(s.substr(pos));
+}
@@ -1,48 +1,175 @@
 #pragma once
 
 #include <Filters.hpp>
+#include <openssl/evp.h>
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ThreadPool;
+
+// Fingerprint of a huge file split into fixed size chunks. Every leaf is
+// the digest of one chunk, the root combines the leaves pairwise.
+struct ChunkedDigest {
+    std::string root;
+    uint64_t chunkSize = 0;
+    std::vector<std::string> leaves;
+};
+
+// Digest algorithm used for fingerprints. The digest state lives in
+// Contexts which are reused from file to file.
 class HashingAlgorithm {
     public:
-        virtual std::string Run(const std::string &filename, const FilterMap &filters) = 0;
+        // Streaming state of one digest
+        class Context {
+            public:
+                virtual ~Context() = default;
+
+                // Starts a new digest
+                virtual void Init() = 0;
+                virtual void Update(const void *data, size_t len) = 0;
+                // Finishes the digest and returns it hex encoded. Init has to
+                // be called before the context is used again
+                virtual std::string Final() = 0;
+                // Throws away the running digest and starts a new one
+                void Reset() {Init();}
+
+                // New context with a copy of the running digest, for input
+                // that may turn out not to be part of the digest
+                virtual std::unique_ptr<Context> Clone() const = 0;
+                // Takes over the running digest of other, a context of the
+                // same algorithm
+                virtual void CopyFrom(const Context &other) = 0;
+
+                void Update(std::string_view data) {Update(data.data(), data.size());}
+        };
+
+        virtual ~HashingAlgorithm();
+
+        HashingAlgorithm(const HashingAlgorithm&) = delete;
+        HashingAlgorithm& operator=(const HashingAlgorithm&) = delete;
+
+        // New context, for callers that hash several files at once
+        virtual std::unique_ptr<Context> NewContext() const = 0;
+
+        // Name of the digest, like "SHA2-256"
+        const std::string &Name() const {return m_Name;}
+        // Unique for every algorithm created, also after others were destroyed
+        uint64_t Id() const {return m_Id;}
+
+        // Context owned by the calling thread, reused for every file hashed on it
+        Context &ThreadContext() const;
+
+        // Hashes the whole file on the calling thread's context
+        std::string Run(const std::string &filename, const FilterMap &filters) const;
+
+        // Hashes every file of a batch of small files, see Run. Algorithms
+        // that can hash several files at once override it
+        virtual std::vector<std::string> RunBatch(const std::vector<std::string> &filenames, const FilterMap &filters) const;
+        // Same as RunBatch, but a file that can not be read does not fail the
+        // others: its hash is left empty and errors gets why, like UringScanner
+        std::vector<std::string> TryRunBatch(const std::vector<std::string> &filenames, const FilterMap &filters,
+                std::vector<std::string> &errors) const;
+
+        // Hashes the chunks of the first size bytes of the file in parallel on
+        // the pool and combines their digests into a Merkle root. Filters are
+        // not applied, the chunks are hashed as they are
+        ChunkedDigest RunChunked(const std::string &filename, uint64_t size, uint64_t chunkSize, ThreadPool &pool) const;
+
+        // Combines the leaves of RunChunked into the root
+        virtual std::string MerkleRoot(const std::vector<std::string> &leaves) const;
 
     protected:
-        HashingAlgorithm() {};
+        explicit HashingAlgorithm(const std::string &name);
+
+    private:
+        std::string m_Name;
+        // Identifies the algorithm's thread contexts
+        uint64_t m_Id;
 };
 
-class HashingAlgorithmSHA256 : public HashingAlgorithm {
+// Digests provided by OpenSSL. The EVP_MD is fetched from the provider once,
+// when the algorithm is created
+class HashingAlgorithmEVP : public HashingAlgorithm {
     public:
-        HashingAlgorithmSHA256() : HashingAlgorithm() {};
+        ~HashingAlgorithmEVP() override;
+
+        std::unique_ptr<Context> NewContext() const override;
 
-        std::string Run(const std::string &filename, const FilterMap &filters) override;
+    protected:
+        // name is the OpenSSL name of the digest, throws when it is not available
+        explicit HashingAlgorithmEVP(const char *name);
+
+    private:
+        EVP_MD *m_Md;
 };
-class HashingAlgorithmSHA512 : public HashingAlgorithm {
+
+class HashingAlgorithmSHA256 : public HashingAlgorithmEVP {
     public:
-        HashingAlgorithmSHA512() : HashingAlgorithm() {};
+        HashingAlgorithmSHA256() : HashingAlgorithmEVP("SHA2-256") {};
 
-        std::string Run(const std::string &filename, const FilterMap &filters) override;
+        // Files without filters are read whole and hashed in the lanes of
+        // Sha256Multi, when the CPU has a kernel for it
+        std::vector<std::string> RunBatch(const std::vector<std::string> &filenames, const FilterMap &filters) const override;
 };
-class HashingAlgorithmSHA3_256 : public HashingAlgorithm {
+class HashingAlgorithmSHA512 : public HashingAlgorithmEVP {
     public:
-        HashingAlgorithmSHA3_256() : HashingAlgorithm() {};
-
-        std::string Run(const std::string &filename, const FilterMap &filters) override;
+        HashingAlgorithmSHA512() : HashingAlgorithmEVP("SHA2-512") {};
 };
-class HashingAlgorithmSHA3_512 : public HashingAlgorithm {
+class HashingAlgorithmSHA3_256 : public HashingAlgorithmEVP {
     public:
-        HashingAlgorithmSHA3_512() : HashingAlgorithm() {};
-
-        std::string Run(const std::string &filename, const FilterMap &filters) override;
+        HashingAlgorithmSHA3_256() : HashingAlgorithmEVP("SHA3-256") {};
+};
+class HashingAlgorithmSHA3_512 : public HashingAlgorithmEVP {
+    public:
+        HashingAlgorithmSHA3_512() : HashingAlgorithmEVP("SHA3-512") {};
+};
+class HashingAlgorithmBlake2s256 : public HashingAlgorithmEVP {
+    public:
+        HashingAlgorithmBlake2s256() : HashingAlgorithmEVP("BLAKE2S-256") {};
 };
-class HashingAlgorithmBlake2s256 : public HashingAlgorithm {
+// BLAKE2s has no 512 bit variant, BLAKE2b is its 64 bit sibling
+class HashingAlgorithmBlake2b512 : public HashingAlgorithmEVP {
     public:
-        HashingAlgorithmBlake2s256() : HashingAlgorithm() {};
+        HashingAlgorithmBlake2b512() : HashingAlgorithmEVP("BLAKE2B-512") {};
+};
+// See Blake3.hpp. With a pool, updates of at least parallelMinBytes are
+// hashed on all of its threads
+class HashingAlgorithmBLAKE3 : public HashingAlgorithm {
+    public:
+        explicit HashingAlgorithmBLAKE3(ThreadPool *pool = nullptr, size_t parallelMinBytes = 0) :
+            HashingAlgorithm("BLAKE3"), m_Pool(pool), m_ParallelMinBytes(parallelMinBytes) {};
 
-        std::string Run(const std::string &filename, const FilterMap &filters) override;
+        std::unique_ptr<Context> NewContext() const override;
+
+    private:
+        ThreadPool *m_Pool;
+        size_t m_ParallelMinBytes;
 };
-class HashingAlgorithmBlake2s512 : public HashingAlgorithm {
+// Several digests computed in one pass: the file is read and filtered once
+// and every piece of it is fed to each algorithm. A digest is the digests of
+// the algorithms, in order, joined by SEPARATOR
+class HashingAlgorithmMulti : public HashingAlgorithm {
     public:
-        HashingAlgorithmBlake2s512() : HashingAlgorithm() {};
+        static constexpr char SEPARATOR = '+';
+
+        explicit HashingAlgorithmMulti(std::vector<std::unique_ptr<HashingAlgorithm>> algorithms);
+
+        std::unique_ptr<Context> NewContext() const override;
+
+        // Every algorithm combines its own part of the leaves
+        std::string MerkleRoot(const std::vector<std::string> &leaves) const override;
+
+        const std::vector<std::unique_ptr<HashingAlgorithm>> &Algorithms() const {return m_Algorithms;}
+
+        // Digests of the single algorithms in a digest. A digest of a single
+        // algorithm comes back as the only element
+        static std::vector<std::string> Split(const std::string &digest);
 
-        std::string Run(const std::string &filename, const FilterMap &filters) override;
+    private:
+        std::vector<std::unique_ptr<HashingAlgorithm>> m_Algorithms;
 };
@@ -1,13 +1,25 @@
 #pragma once
 
+#include <ChangeWatcher.hpp>
 #include <MailAlertManager.hpp>
 #include <HashingAlgorithm.hpp>
+#include <CryptoUtil.hpp>
 #include <SecurityManager.hpp>
 #include <pybind11/embed.h>
 #include <ModuleManager.hpp>
 #include <Config.hpp>
 #include <Filters.hpp>
+#include <ScanScheduler.hpp>
+#include <StatCache.hpp>
+#include <ThreadPool.hpp>
+#include <Traversal.hpp>
+#include <UringScanner.hpp>
+#include <chrono>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 class Monitor {
@@ -16,7 +28,6 @@ class Monitor {
             Security(SecurityManager::getInstance()),
             Modules(ModuleManager()),
             Cfg(Config::getInstance()),
-            m_hashAlgorhitm(nullptr),
             m_MailingManager(nullptr),
             m_MailingEnabled(false),
             m_MailingNotifyWhenResolved(true)
@@ -34,9 +45,64 @@ class Monitor {
         bool InitialiseConfig(); // for stuff like time period between checks etc
         bool InitialiseFilters();
         bool InitialiseMailing();
+        bool InitialiseStatCache();
+        bool InitialiseSchedule();
         std::string ComputeHash(const std::string &s);    // Algorhitm agnostic method that calls m_hashAlgorhitm with algorhitm set up in config
 
+        // A monitored file that has to be checked in this scan
+        struct ScanEntry {
+            size_t index;               // Into m_files
+            FileStat stat;
+            bool statOk = false;        // When false, the error is reported once the file is hashed
+        };
+
+        // A file of normal or low priority too big for one round of
+        // RunScheduled, hashed a piece per round, see HashPiece
+        struct PieceHash {
+            ScanEntry entry;
+            uint64_t offset = 0;                            // Bytes hashed so far
+            std::unique_ptr<HashingAlgorithm::Context> ctx;
+            std::unique_ptr<FileDigest> digest;             // nullptr until the first piece, and for chunked files
+            ChunkedDigest chunks;                           // Leaves of chunked files, filled piece by piece
+        };
+
         int RunScan();
+        // Spreads the hashing of one scan evenly until deadline
+        void RunPacedScan(std::chrono::steady_clock::time_point deadline);
+        // Checks every file when its class of the schedule says it is due, see RunScheduled
+        void RunScheduled();
+        // Saves the stat cache and moves the verification window once all files were checked
+        void FinishScan();
+        // Event mode: hashes the files events were reported for, see WatchEvents
+        void WatchEvents();
+        void ScanChanged(const std::vector<std::string> &files, std::vector<std::string> entries);
+        // Lists the files under entries again, for ScanChanged
+        void RelistEntries(std::vector<std::string> entries);
+        void UpdateWatches();
+        bool IsWatched(const ChangeWatcher::Event &event) const;
+        // Walks the directories and globs of files: again, reports the files
+        // that appeared or disappeared since the last scan
+        void ExpandFiles();
+        void ReportTreeChange(const std::string &file, bool added);
+        std::vector<ScanEntry> PrefilterScan();     // Drops the files the stat cache says did not change
+        // Stats one file, returns false when it does not have to be hashed
+        bool PrefilterFile(size_t index, ScanEntry &entry) const;
+        bool VerifyThisScan(size_t index) const;    // Whether the file is hashed even when its metadata did not change
+        std::vector<std::vector<ScanEntry>> ScheduleScan(std::vector<ScanEntry> entries) const;  // Splits the files into tasks for m_Pool
+        // The urgent files are started before the others
+        void HashFiles(std::vector<ScanEntry> entries, std::vector<ScanEntry> urgent = {});
+        void ScanFiles(const std::vector<ScanEntry> &batch);
+        bool IsResumable(const ScanEntry &entry) const;     // Whether the file can be hashed in pieces
+        // Hashes up to bytes more of the file, returns true once all of it was hashed and checked
+        bool HashPiece(PieceHash &piece, uint64_t bytes);
+        bool IsChunked(const std::string &file, uint64_t size) const;
+        // Returns true when the file matched its baselines or new baselines were stored
+        bool CheckFile(const std::string &file, const std::string &hash, const ChunkedDigest *chunks = nullptr);
+        std::string DigestKey(const std::string &filecode, size_t digest) const;  // Database key of a digest's baseline
+        void ReportMismatch(const std::string &file, const std::string &filecode, const std::string &details);
+        void UpdateStatCache(const ScanEntry &entry, bool matched);
+        // A file that could not be hashed is skipped and tried again next time, see ScanFiles
+        void ReportUnreadable(const ScanEntry &entry, const std::string &error);
 
     private:
         // Managers
@@ -47,9 +113,37 @@ class Monitor {
     private:
         // Configs
         uint64_t m_u64period = 0;               // Time period between each scans
+        bool m_Pacing = false;                  // Hashing is spread over the period, see RunPacedScan
+        double m_PacedRate = 0;                 // Bytes per second the last paced scan hashed while busy
         std::vector<std::string> m_files;       // Filenames to be monitored
-        HashingAlgorithm *m_hashAlgorhitm;           // Pointer to the function used for checksumming the files
+        // Directories and globs of files: and the exclude: globs, expanded every
+        // scan. nullptr when files: lists only files
+        std::unique_ptr<PathMatcher> m_Matcher;
+        size_t m_LiteralFiles = 0;              // m_files starts with the literal entries, the files m_Matcher matched follow
+        std::unique_ptr<TreeListing> m_Listing; // Files m_Matcher matched on the last scan
+        std::vector<std::string> m_TreeDirectories; // Directories m_Matcher was expanded from, in event mode
+        std::unique_ptr<ChangeWatcher> m_Watcher;   // Files are hashed when events report changes, nullptr polls every period
+        uint64_t m_DebounceMs = 0;              // Quiet time after the last event of a file before it is hashed
+        uint64_t m_FullScanPeriod = 0;          // Seconds between the full scans of event mode
+        std::unordered_map<std::string, size_t> m_FileIndex;   // Into m_files, for the events
+        size_t m_Unwatched = 0;                 // Directories events can not be received for
+        // Files of directories and globs that could not be read, reported only once
+        std::unordered_set<std::string> m_Unreadable;
+        std::mutex m_UnreadableMutex;
+        std::unique_ptr<ScanScheduler> m_Scheduler;     // Intervals of the schedule: classes, nullptr checks all files every period
+        std::unique_ptr<HashingAlgorithm> m_hashAlgorhitm;  // Algorithm used for checksumming the files
+        std::vector<std::string> m_DigestNames; // Name of every digest m_hashAlgorhitm computes, in order
+        bool m_MismatchAll = false;             // Report only when every digest mismatches, not any of them
         FilterMap m_filters;
+        std::vector<std::unique_ptr<UringScanner>> m_Uring;  // One per pool worker when files are read with io_uring
+        std::unique_ptr<ThreadPool> m_Pool;     // Workers hashing the files
+        uint64_t m_ChunkThreshold = 0;          // Files at least this big are hashed in chunks, 0 disables it
+        uint64_t m_ChunkSize = 0;
+        std::unique_ptr<StatCache> m_StatCache;  // Files whose metadata did not change are not hashed, nullptr disables it
+        uint32_t m_VerifyEvery = 0;             // Every this many scans all files are hashed, 0 disables it
+        uint32_t m_VerifyPercent = 0;           // Share of the files hashed every scan regardless of the stat cache
+        uint64_t m_ScanCount = 0;
+        size_t m_VerifyCursor = 0;              // First file of the rotating verification window
         bool m_MailingEnabled;
         MailAlertManager *m_MailingManager;
         bool m_MailingNotifyWhenResolved;
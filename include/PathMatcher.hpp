@@ -0,0 +1,138 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Include and exclude globs compiled into one automaton over the bytes of a
+// path. * matches any characters of a name and ? one of them, [abc], [a-z]
+// and [!abc] one character of a set, ** any number of directories. Wildcards
+// match names starting with a dot as well.
+// A path matches when an include matches it and no exclude does. Excludes
+// not starting with / match at any depth, and an exclude matching a
+// directory excludes everything under it.
+//
+// The globs are merged into a trie of their atoms, so globs sharing a prefix
+// share its states, and Compile turns the includes and the excludes of the
+// trie into a DFA each. They are kept apart as excludes matching at any
+// depth would otherwise multiply the states of every include. A walk feeds
+// both DFAs one name at a time, starting from the state of the directory,
+// so a name costs two table lookups per byte whatever the number of globs.
+// Directories under which nothing can match, because no include can or an
+// exclude covers all of it, lead to DEAD and are not walked
+class PathMatcher {
+    public:
+        // State of the include DFA in the low half, of the exclude DFA in the high one
+        using State = uint64_t;
+        static constexpr State DEAD = 0;
+
+        PathMatcher();
+
+        // Whether a files: entry has to be expanded as a glob rather than read as a file
+        static bool IsGlob(const std::string &entry);
+
+        // An include without wildcards is a directory and stands for every
+        // file under it. Globs can not be added once compiled
+        void Include(const std::string &pattern);
+        void Exclude(const std::string &pattern);
+        // Throws std::invalid_argument when the globs need too many states
+        void Compile();
+
+        // Directories the walks start from, the parts of the includes before
+        // their first component with wildcards, sorted without duplicates.
+        // Empty for the current directory
+        const std::vector<std::string> &Roots() const {return m_Roots;}
+        // State of the entries of root, DEAD when none of them can match
+        State RootState(const std::string &root) const;
+
+        State Feed(State state, std::string_view bytes) const
+        {
+            if (state == DEAD)
+                return DEAD;
+            uint32_t include = static_cast<uint32_t>(state);
+            uint32_t exclude = static_cast<uint32_t>(state >> 32);
+            for (unsigned char c : bytes) {
+                size_t k = m_ClassOf[c];
+                include = m_Include.transitions[include * m_Classes + k];
+                exclude = m_Exclude.transitions[exclude * m_Classes + k];
+                if (include == 0 || exclude == 0)
+                    return DEAD;
+            }
+            return include | static_cast<State>(exclude) << 32;
+        }
+        // Whether a file whose name led to state matches
+        bool Matches(State state) const
+        {
+            return state != DEAD && m_Include.match[static_cast<uint32_t>(state)] && !m_Exclude.match[state >> 32];
+        }
+        // State of the entries of a directory whose name led to state
+        State Descend(State state) const {return Feed(state, "/");}
+
+        // Whether the whole path matches
+        bool MatchesPath(std::string_view path) const
+        {
+            return Matches(Feed(Start(path.starts_with("/")), path));
+        }
+
+        size_t States() const {return m_Include.match.size() + m_Exclude.match.size();}
+        size_t Classes() const {return m_Classes;}
+
+    private:
+        enum class Kind : uint8_t {
+            ROOT,
+            CHAR,
+            ONE,        // ?
+            SET,        // [...]
+            STAR,       // *, loops on the characters of a name
+            DEEP,       // ** followed by more components, loops on whole components
+            DEEP_INNER, // Inside a component DEEP loops on
+            REST,       // ** at the end, loops on anything
+        };
+        struct Atom {
+            Kind kind = Kind::ROOT;
+            unsigned char ch = 0;
+            uint32_t set = 0;       // Into m_Sets
+            bool operator==(const Atom&) const = default;
+        };
+        struct Node {
+            Atom atom;
+            std::vector<uint32_t> children;
+            uint32_t partner = 0;   // DEEP_INNER of a DEEP and the other way around
+            bool include = false;   // An include ends here
+            bool exclude = false;
+            bool includeReachable = false;
+            bool excludeReachable = false;
+            bool excludesBelow = false;     // Everything after this node is excluded
+        };
+        // State s goes to transitions[s * m_Classes + m_ClassOf[byte]]. State 0
+        // of the include DFA is reached when no include can match any more,
+        // of the exclude DFA when everything after is excluded
+        struct Dfa {
+            std::vector<uint32_t> transitions;
+            std::vector<uint8_t> match;
+            uint32_t start[2] = {};     // Of absolute and relative paths
+        };
+
+        // Globs of absolute paths start at node 0, of relative paths at
+        // node 1, so relative includes do not match under absolute roots
+        std::vector<Node> m_Nodes;
+        std::vector<std::array<bool, 256>> m_Sets;
+        std::vector<std::string> m_Roots;
+
+        std::array<uint16_t, 256> m_ClassOf {};
+        size_t m_Classes = 1;
+        Dfa m_Include;
+        Dfa m_Exclude;
+        bool m_Compiled = false;
+
+        std::vector<Atom> Parse(const std::string &pattern, std::string *root);
+        void Insert(uint32_t root, const std::vector<Atom> &atoms, bool include);
+        uint32_t AddNode(const Atom &atom);
+        void ComputeClasses();
+        void Closure(std::vector<uint32_t> &set) const;
+        // Subset construction over the nodes leading to an include or an exclude
+        void Build(Dfa &dfa, bool exclude) const;
+        State Start(bool absolute) const;
+};
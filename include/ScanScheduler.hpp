@@ -0,0 +1,94 @@
+#pragma once
+
+#include <PathMatcher.hpp>
+#include <StatCache.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// When each monitored file is checked next. A file belongs to the first class
+// whose paths or globs match it, other files to the default class, and is
+// due the interval of its class after it was last checked. With a max
+// interval above the interval, the interval of a file doubles every time it
+// was found unchanged, up to the max, and is back at the class interval once
+// its metadata changed. Deadlines are kept in a heap, so finding the files
+// due costs log(files) each
+class ScanScheduler {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        enum class Priority : uint8_t {
+            HIGH,
+            NORMAL,
+            LOW,
+        };
+        static constexpr size_t PRIORITIES = 3;
+
+        struct Class {
+            std::string name;
+            std::vector<std::string> files;     // Paths, directories and globs, like files:
+            Clock::duration interval {};
+            Clock::duration maxInterval {};     // Same as interval when the interval does not adapt
+            Priority priority = Priority::NORMAL;
+        };
+
+        // The files of defaults are ignored, it takes every file no class
+        // matches. Throws std::invalid_argument for invalid globs or intervals
+        ScanScheduler(std::vector<Class> classes, Class defaults);
+
+        static Priority ParsePriority(const std::string &name);
+        static const char *PriorityName(Priority priority);
+
+        // Replaces the monitored files. Files that were monitored before keep
+        // their deadlines and intervals, new ones are due at now. Files Due
+        // returned that are not Done are due again
+        void SetFiles(const std::vector<std::string> &files, Clock::time_point now);
+
+        // Removes the files due at now from the heap, earliest deadline first
+        std::vector<size_t> Due(Clock::time_point now);
+        // A file Due returned was checked at now and had the given metadata,
+        // statOk is false when it could not be read
+        void Done(size_t index, const FileStat &stat, bool statOk, Clock::time_point now);
+
+        // Deadline of the next file, Clock::time_point::max() when none is waiting
+        Clock::time_point Next() const;
+        // How late the file is at now, zero when it is not due yet
+        Clock::duration Lateness(size_t index, Clock::time_point now) const;
+
+        Priority PriorityOf(size_t index) const {return m_Classes[m_Files[index].cls].priority;}
+        const std::vector<Class> &Classes() const {return m_Classes;}
+        // Files in each of Classes(), the default class last
+        std::vector<size_t> Counts() const;
+
+    private:
+        struct File {
+            std::string path;
+            Clock::time_point deadline;
+            Clock::duration interval {};
+            FileStat stat;
+            bool statOk = false;
+            bool checked = false;   // Done at least once, stat is known
+            bool queued = false;    // Returned by Due and not Done yet
+            uint16_t cls = 0;
+        };
+        struct Deadline {
+            Clock::time_point at;
+            size_t index;
+            // Earliest on top of a std::push_heap max heap
+            bool operator<(const Deadline &other) const {return at > other.at;}
+        };
+
+        std::vector<Class> m_Classes;       // The default class last
+        std::vector<std::unique_ptr<PathMatcher>> m_Matchers;      // nullptr for classes without globs
+        std::vector<std::unordered_set<std::string>> m_Paths;      // Files listed without wildcards
+        std::vector<File> m_Files;
+        std::vector<Deadline> m_Heap;
+
+        uint16_t Classify(const std::string &path) const;
+        void Push(size_t index);
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Multi-buffer SHA-256: hashes several messages in lockstep, one message per
+// SIMD lane. Meant for lots of small messages, where hashing them one after
+// another is bound by the latency of the serial compression function.
+// Digests are the same as any other SHA-256
+class Sha256Multi {
+    public:
+        using Digest = std::array<uint8_t, 32>;
+
+        // Number of messages hashed at once, 0 when there is no SIMD kernel
+        // for this CPU or a single message is hashed faster anyway
+        static size_t Lanes();
+        // Name of the kernel in use, for the logs
+        static const char *Implementation();
+
+        // Writes the digest of every message to digests. Without a kernel the
+        // messages are hashed one by one
+        static void Hash(const std::vector<std::string_view> &messages, std::vector<Digest> &digests);
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+// Internals of Sha256Multi shared with the SIMD kernels, see Sha256Multi.hpp
+
+#include <cstddef>
+#include <cstdint>
+
+namespace sha256 {
+
+constexpr uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+constexpr uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// Compress one block of every lane into its state. state[w][lane] is word w
+// of the state of a lane, blocks[lane] its next 64 byte block
+void CompressAvx2(uint32_t state[8][16], const uint8_t *const blocks[8]);
+void CompressAvx512(uint32_t state[8][16], const uint8_t *const blocks[16]);
+
+// Body of the SIMD kernels. V is one of the lane types of SimdLanes.hpp
+template <typename V>
+inline void Round(typename V::Vec a, typename V::Vec b, typename V::Vec c, typename V::Vec &d,
+                  typename V::Vec e, typename V::Vec f, typename V::Vec g, typename V::Vec &h,
+                  typename V::Vec kw)
+{
+    using Vec = typename V::Vec;
+
+    Vec s1 = V::Xor(V::Xor(V::template Rotr<6>(e), V::template Rotr<11>(e)), V::template Rotr<25>(e));
+    Vec ch = V::Xor(V::And(e, f), V::AndNot(e, g));
+    Vec t1 = V::Add(V::Add(h, s1), V::Add(ch, kw));
+    Vec s0 = V::Xor(V::Xor(V::template Rotr<2>(a), V::template Rotr<13>(a)), V::template Rotr<22>(a));
+    Vec maj = V::Or(V::And(a, b), V::And(c, V::Or(a, b)));
+
+    d = V::Add(d, t1);
+    h = V::Add(t1, V::Add(s0, maj));
+}
+
+// Adds round constant t to message word t, computing the word first for
+// the rounds past the first 16
+template <typename V>
+inline typename V::Vec Schedule(typename V::Vec w[16], int t)
+{
+    using Vec = typename V::Vec;
+
+    if (t >= 16) {
+        Vec w2 = w[(t - 2) & 15];
+        Vec w15 = w[(t - 15) & 15];
+        Vec s0 = V::Xor(V::Xor(V::template Rotr<7>(w15), V::template Rotr<18>(w15)), V::template Shr<3>(w15));
+        Vec s1 = V::Xor(V::Xor(V::template Rotr<17>(w2), V::template Rotr<19>(w2)), V::template Shr<10>(w2));
+        w[t & 15] = V::Add(V::Add(w[t & 15], s0), V::Add(w[(t - 7) & 15], s1));
+    }
+    return V::Add(w[t & 15], V::Set1(K[t]));
+}
+
+template <typename V>
+inline void CompressSimd(uint32_t state[8][16], const uint8_t *const blocks[V::N])
+{
+    using Vec = typename V::Vec;
+
+    Vec w[16];
+    V::LoadTransposed(blocks, 0, w);
+    for (int i = 0; i < 16; i++)
+        w[i] = V::ByteSwap(w[i]);
+
+    Vec a = V::Load(state[0]), b = V::Load(state[1]), c = V::Load(state[2]), d = V::Load(state[3]);
+    Vec e = V::Load(state[4]), f = V::Load(state[5]), g = V::Load(state[6]), h = V::Load(state[7]);
+
+    for (int t = 0; t < 64; t += 8) {
+        Round<V>(a, b, c, d, e, f, g, h, Schedule<V>(w, t + 0));
+        Round<V>(h, a, b, c, d, e, f, g, Schedule<V>(w, t + 1));
+        Round<V>(g, h, a, b, c, d, e, f, Schedule<V>(w, t + 2));
+        Round<V>(f, g, h, a, b, c, d, e, Schedule<V>(w, t + 3));
+        Round<V>(e, f, g, h, a, b, c, d, Schedule<V>(w, t + 4));
+        Round<V>(d, e, f, g, h, a, b, c, Schedule<V>(w, t + 5));
+        Round<V>(c, d, e, f, g, h, a, b, Schedule<V>(w, t + 6));
+        Round<V>(b, c, d, e, f, g, h, a, Schedule<V>(w, t + 7));
+    }
+
+    V::Store(state[0], V::Add(a, V::Load(state[0])));
+    V::Store(state[1], V::Add(b, V::Load(state[1])));
+    V::Store(state[2], V::Add(c, V::Load(state[2])));
+    V::Store(state[3], V::Add(d, V::Load(state[3])));
+    V::Store(state[4], V::Add(e, V::Load(state[4])));
+    V::Store(state[5], V::Add(f, V::Load(state[5])));
+    V::Store(state[6], V::Add(g, V::Load(state[6])));
+    V::Store(state[7], V::Add(h, V::Load(state[7])));
+}
+
+}
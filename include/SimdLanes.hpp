@@ -0,0 +1,214 @@
+#pragma once
+
+// Vectors of N lanes of 32 bit words for the multi-lane hash kernels
+// (Blake3Impl.hpp, Sha256MultiImpl.hpp). A kernel hashes one message per
+// lane. Each type is only defined when the file is compiled for its
+// instruction set, the kernel files get the flags from CMakeLists.txt
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE4_1__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#ifdef __SSE4_1__
+struct Sse41Lanes {
+    using Vec = __m128i;
+    static constexpr size_t N = 4;
+
+    static Vec Add(Vec a, Vec b) {return _mm_add_epi32(a, b);}
+    static Vec Xor(Vec a, Vec b) {return _mm_xor_si128(a, b);}
+    static Vec And(Vec a, Vec b) {return _mm_and_si128(a, b);}
+    static Vec Or(Vec a, Vec b) {return _mm_or_si128(a, b);}
+    // ~a & b
+    static Vec AndNot(Vec a, Vec b) {return _mm_andnot_si128(a, b);}
+    static Vec Set1(uint32_t x) {return _mm_set1_epi32(static_cast<int>(x));}
+    static Vec Load(const uint32_t *p) {return _mm_loadu_si128(reinterpret_cast<const Vec*>(p));}
+    static void Store(uint32_t *p, Vec a) {_mm_storeu_si128(reinterpret_cast<Vec*>(p), a);}
+
+    template <int C>
+    static Vec Shr(Vec a) {return _mm_srli_epi32(a, C);}
+
+    template <int C>
+    static Vec Rotr(Vec a)
+    {
+        // Rotations by whole bytes are a single shuffle
+        if constexpr (C == 16)
+            return _mm_shuffle_epi8(a, _mm_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+        else if constexpr (C == 8)
+            return _mm_shuffle_epi8(a, _mm_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+        else
+            return _mm_or_si128(_mm_srli_epi32(a, C), _mm_slli_epi32(a, 32 - C));
+    }
+
+    static Vec ByteSwap(Vec a)
+    {
+        return _mm_shuffle_epi8(a, _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3));
+    }
+
+    // m[w] gets the little endian word w of the 64 bytes at
+    // inputs[lane] + offset, for every lane
+    static void LoadTransposed(const uint8_t *const inputs[N], size_t offset, Vec m[16])
+    {
+        for (int g = 0; g < 4; g++) {
+            Vec x[4];
+            for (int i = 0; i < 4; i++)
+                x[i] = _mm_loadu_si128(reinterpret_cast<const Vec*>(inputs[i] + offset + 16 * g));
+
+            Vec ab01 = _mm_unpacklo_epi32(x[0], x[1]);
+            Vec ab23 = _mm_unpackhi_epi32(x[0], x[1]);
+            Vec cd01 = _mm_unpacklo_epi32(x[2], x[3]);
+            Vec cd23 = _mm_unpackhi_epi32(x[2], x[3]);
+
+            m[4 * g + 0] = _mm_unpacklo_epi64(ab01, cd01);
+            m[4 * g + 1] = _mm_unpackhi_epi64(ab01, cd01);
+            m[4 * g + 2] = _mm_unpacklo_epi64(ab23, cd23);
+            m[4 * g + 3] = _mm_unpackhi_epi64(ab23, cd23);
+        }
+    }
+};
+#endif
+
+#ifdef __AVX2__
+struct Avx2Lanes {
+    using Vec = __m256i;
+    static constexpr size_t N = 8;
+
+    static Vec Add(Vec a, Vec b) {return _mm256_add_epi32(a, b);}
+    static Vec Xor(Vec a, Vec b) {return _mm256_xor_si256(a, b);}
+    static Vec And(Vec a, Vec b) {return _mm256_and_si256(a, b);}
+    static Vec Or(Vec a, Vec b) {return _mm256_or_si256(a, b);}
+    // ~a & b
+    static Vec AndNot(Vec a, Vec b) {return _mm256_andnot_si256(a, b);}
+    static Vec Set1(uint32_t x) {return _mm256_set1_epi32(static_cast<int>(x));}
+    static Vec Load(const uint32_t *p) {return _mm256_loadu_si256(reinterpret_cast<const Vec*>(p));}
+    static void Store(uint32_t *p, Vec a) {_mm256_storeu_si256(reinterpret_cast<Vec*>(p), a);}
+
+    template <int C>
+    static Vec Shr(Vec a) {return _mm256_srli_epi32(a, C);}
+
+    template <int C>
+    static Vec Rotr(Vec a)
+    {
+        // Rotations by whole bytes are a single shuffle
+        if constexpr (C == 16)
+            return _mm256_shuffle_epi8(a, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                                          13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+        else if constexpr (C == 8)
+            return _mm256_shuffle_epi8(a, _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+                                                          12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+        else
+            return _mm256_or_si256(_mm256_srli_epi32(a, C), _mm256_slli_epi32(a, 32 - C));
+    }
+
+    static Vec ByteSwap(Vec a)
+    {
+        return _mm256_shuffle_epi8(a, _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                                      12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3));
+    }
+
+    // m[w] gets the little endian word w of the 64 bytes at
+    // inputs[lane] + offset, for every lane. An 8x8 transpose of each half
+    static void LoadTransposed(const uint8_t *const inputs[N], size_t offset, Vec m[16])
+    {
+        for (int h = 0; h < 2; h++) {
+            Vec x[8];
+            for (int i = 0; i < 8; i++)
+                x[i] = _mm256_loadu_si256(reinterpret_cast<const Vec*>(inputs[i] + offset + 32 * h));
+
+            Vec t[8];
+            for (int i = 0; i < 8; i += 2) {
+                t[i] = _mm256_unpacklo_epi32(x[i], x[i + 1]);
+                t[i + 1] = _mm256_unpackhi_epi32(x[i], x[i + 1]);
+            }
+
+            // Every 128 bit half of qk holds word k (low half) or 4 + k (high
+            // half) of lanes 0-3, q(4 + k) the same for lanes 4-7
+            Vec q0 = _mm256_unpacklo_epi64(t[0], t[2]);
+            Vec q1 = _mm256_unpackhi_epi64(t[0], t[2]);
+            Vec q2 = _mm256_unpacklo_epi64(t[1], t[3]);
+            Vec q3 = _mm256_unpackhi_epi64(t[1], t[3]);
+            Vec q4 = _mm256_unpacklo_epi64(t[4], t[6]);
+            Vec q5 = _mm256_unpackhi_epi64(t[4], t[6]);
+            Vec q6 = _mm256_unpacklo_epi64(t[5], t[7]);
+            Vec q7 = _mm256_unpackhi_epi64(t[5], t[7]);
+
+            m[8 * h + 0] = _mm256_permute2x128_si256(q0, q4, 0x20);
+            m[8 * h + 4] = _mm256_permute2x128_si256(q0, q4, 0x31);
+            m[8 * h + 1] = _mm256_permute2x128_si256(q1, q5, 0x20);
+            m[8 * h + 5] = _mm256_permute2x128_si256(q1, q5, 0x31);
+            m[8 * h + 2] = _mm256_permute2x128_si256(q2, q6, 0x20);
+            m[8 * h + 6] = _mm256_permute2x128_si256(q2, q6, 0x31);
+            m[8 * h + 3] = _mm256_permute2x128_si256(q3, q7, 0x20);
+            m[8 * h + 7] = _mm256_permute2x128_si256(q3, q7, 0x31);
+        }
+    }
+};
+#endif
+
+#ifdef __AVX512F__
+struct Avx512Lanes {
+    using Vec = __m512i;
+    static constexpr size_t N = 16;
+
+    static Vec Add(Vec a, Vec b) {return _mm512_add_epi32(a, b);}
+    static Vec Xor(Vec a, Vec b) {return _mm512_xor_si512(a, b);}
+    static Vec And(Vec a, Vec b) {return _mm512_and_si512(a, b);}
+    static Vec Or(Vec a, Vec b) {return _mm512_or_si512(a, b);}
+    // ~a & b
+    static Vec AndNot(Vec a, Vec b) {return _mm512_andnot_si512(a, b);}
+    static Vec Set1(uint32_t x) {return _mm512_set1_epi32(static_cast<int>(x));}
+    static Vec Load(const uint32_t *p) {return _mm512_loadu_si512(p);}
+    static void Store(uint32_t *p, Vec a) {_mm512_storeu_si512(p, a);}
+
+    template <int C>
+    static Vec Shr(Vec a) {return _mm512_srli_epi32(a, C);}
+
+    template <int C>
+    static Vec Rotr(Vec a) {return _mm512_ror_epi32(a, C);}
+
+    // Without AVX-512BW there is no byte shuffle
+    static Vec ByteSwap(Vec a)
+    {
+        return _mm512_or_si512(_mm512_ror_epi32(_mm512_and_si512(a, Set1(0x00FF00FF)), 8),
+                               _mm512_rol_epi32(_mm512_and_si512(a, Set1(0xFF00FF00)), 8));
+    }
+
+    // m[w] gets the little endian word w of the 64 bytes at
+    // inputs[lane] + offset, for every lane. A 16x16 transpose
+    static void LoadTransposed(const uint8_t *const inputs[N], size_t offset, Vec m[16])
+    {
+        Vec x[16];
+        for (int i = 0; i < 16; i++)
+            x[i] = _mm512_loadu_si512(inputs[i] + offset);
+
+        Vec t[16];
+        for (int i = 0; i < 16; i += 2) {
+            t[i] = _mm512_unpacklo_epi32(x[i], x[i + 1]);
+            t[i + 1] = _mm512_unpackhi_epi32(x[i], x[i + 1]);
+        }
+
+        // 128 bit lane L of u[4q + k] holds word 4L + k of lanes 4q to 4q + 3
+        Vec u[16];
+        for (int q = 0; q < 16; q += 4) {
+            u[q + 0] = _mm512_unpacklo_epi64(t[q], t[q + 2]);
+            u[q + 1] = _mm512_unpackhi_epi64(t[q], t[q + 2]);
+            u[q + 2] = _mm512_unpacklo_epi64(t[q + 1], t[q + 3]);
+            u[q + 3] = _mm512_unpackhi_epi64(t[q + 1], t[q + 3]);
+        }
+
+        for (int k = 0; k < 4; k++) {
+            Vec lo01 = _mm512_shuffle_i32x4(u[k], u[4 + k], 0x44);
+            Vec hi01 = _mm512_shuffle_i32x4(u[k], u[4 + k], 0xEE);
+            Vec lo23 = _mm512_shuffle_i32x4(u[8 + k], u[12 + k], 0x44);
+            Vec hi23 = _mm512_shuffle_i32x4(u[8 + k], u[12 + k], 0xEE);
+
+            m[k] = _mm512_shuffle_i32x4(lo01, lo23, 0x88);
+            m[4 + k] = _mm512_shuffle_i32x4(lo01, lo23, 0xDD);
+            m[8 + k] = _mm512_shuffle_i32x4(hi01, hi23, 0x88);
+            m[12 + k] = _mm512_shuffle_i32x4(hi01, hi23, 0xDD);
+        }
+    }
+};
+#endif
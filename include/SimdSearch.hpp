@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Searches of text buffers that look at 16 or more bytes at once
+class SimdSearch {
+    public:
+        // Same as haystack.find(needle, pos). A position is only compared in
+        // full when both the first and the last byte of the needle match
+        // there, which rules out most of them in markup like HTML where the
+        // first byte alone ('<', '"') is everywhere
+        static size_t Find(std::string_view haystack, std::string_view needle, size_t pos = 0);
+
+        // Finds the end of the first count lines of data. Returns how many
+        // of them are whole lines in data, at most count, and sets end to
+        // the offset just past the newline of the last one (0 when none).
+        // Newlines are counted 64 bytes at a time, with AVX2 when the CPU
+        // has it
+        static uint64_t SkipLines(std::string_view data, uint64_t count, size_t &end);
+
+        // Finds the newlines from pos on that follow a blank, a CR or, when
+        // spaces is set, a space or tab as well. Their positions are stored
+        // in found, up to max of them, and their number is returned. Fewer
+        // than max means there are no more. Looks at 64 bytes at a time like
+        // SkipLines, so text without trailing blanks is gone through at
+        // about memchr speed
+        static size_t FindBlankNewlines(std::string_view data, size_t pos, bool spaces, size_t *found, size_t max);
+
+        static bool IsBlank(char c, bool spaces)
+        {
+            return c == '\r' || (spaces && (c == ' ' || c == '\t'));
+        }
+
+        // Name of the SkipLines kernel in use, for the logs
+        static const char *Implementation();
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+// Internals of SimdSearch shared with its SIMD kernels, see SimdSearch.hpp
+
+#include <SimdSearch.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace simdsearch {
+
+// Kernel of SimdSearch::SkipLines, compiled with -mavx2
+uint64_t SkipLinesAvx2(const char *data, size_t size, uint64_t count, size_t &end);
+
+// Kernel of SimdSearch::FindBlankNewlines, compiled with -mavx2
+size_t FindBlankNewlinesAvx2(const char *data, size_t size, size_t pos, bool spaces, size_t *found, size_t max);
+
+// FindBlankNewlines with memchr, for what FindBlankNewlinesBlocks leaves
+// and targets without a kernel. count newlines were found before pos
+inline size_t FindBlankNewlinesScalar(const char *data, size_t size, size_t pos, bool spaces, size_t *found, size_t count, size_t max)
+{
+    while (count < max && pos < size) {
+        const void *nl = std::memchr(data + pos, '\n', size - pos);
+        if (!nl)
+            break;
+        size_t at = static_cast<size_t>(static_cast<const char*>(nl) - data);
+        if (at > 0 && SimdSearch::IsBlank(data[at - 1], spaces))
+            found[count++] = at;
+        pos = at + 1;
+    }
+    return count;
+}
+
+// Counts newlines from pos on with memchr, for what SkipLinesBlocks leaves
+// and targets without a kernel. found newlines were counted before pos
+inline uint64_t SkipLinesScalar(const char *data, size_t size, size_t pos, uint64_t found, uint64_t count, size_t &end)
+{
+    while (found < count && pos < size) {
+        const void *nl = std::memchr(data + pos, '\n', size - pos);
+        if (!nl)
+            break;
+        pos = end = static_cast<size_t>(static_cast<const char*>(nl) - data) + 1;
+        found++;
+    }
+    return found;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+// Body of SkipLines. Mask64(p) returns a mask with bit i set when p[i] is a
+// newline, for the 64 bytes at p
+template <typename Mask64>
+inline uint64_t SkipLinesBlocks(const char *data, size_t size, uint64_t count, size_t &end, Mask64 &&mask64)
+{
+    uint64_t found = 0;
+    size_t pos = 0;
+    end = 0;
+    if (count == 0)
+        return 0;
+
+    for (; pos + 64 <= size; pos += 64) {
+        uint64_t mask = mask64(data + pos);
+        uint64_t newlines = static_cast<uint64_t>(__builtin_popcountll(mask));
+        if (found + newlines < count) {
+            found += newlines;
+            if (mask)
+                end = pos + 64 - static_cast<size_t>(__builtin_clzll(mask));
+            continue;
+        }
+
+        // The last newline wanted is in this block, drop the ones before it
+        for (uint64_t skip = count - found - 1; skip > 0; skip--)
+            mask &= mask - 1;
+        end = pos + static_cast<size_t>(__builtin_ctzll(mask)) + 1;
+        return count;
+    }
+
+    return SkipLinesScalar(data, size, pos, found, count, end);
+}
+
+// Body of FindBlankNewlines. Masks(p, newlines, blanks) sets the bits of
+// the newlines and of the blanks among the 64 bytes at p. A newline is
+// found when the bit below it is set in blanks, carried over from block to
+// block
+template <typename Masks>
+inline size_t FindBlankNewlinesBlocks(const char *data, size_t size, size_t pos, bool spaces, size_t *found, size_t max, Masks &&masks)
+{
+    size_t count = 0;
+    uint64_t carry = pos > 0 && SimdSearch::IsBlank(data[pos - 1], spaces) ? 1 : 0;
+
+    for (; pos + 64 <= size; pos += 64) {
+        uint64_t newlines, blanks;
+        masks(data + pos, newlines, blanks);
+        uint64_t hits = newlines & ((blanks << 1) | carry);
+        carry = blanks >> 63;
+        while (hits) {
+            found[count++] = pos + static_cast<size_t>(__builtin_ctzll(hits));
+            if (count == max)
+                return count;
+            hits &= hits - 1;
+        }
+    }
+
+    return FindBlankNewlinesScalar(data, size, pos, spaces, found, count, max);
+}
+#endif
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Metadata of a monitored file, used to tell whether it could have changed
+// since it was last hashed
+struct FileStat {
+    uint64_t dev = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+    // Can not be set from user space, so restoring mtime after a change
+    // still leaves a different ctime
+    int64_t ctimeNs = 0;
+
+    bool operator==(const FileStat&) const = default;
+
+    // Reads the metadata with statx where available, returns false on error
+    static bool Read(const std::string &path, FileStat &stat);
+};
+
+// Metadata of the files whose fingerprint matched the baseline. A file with
+// the same metadata on the next scan does not have to be read again.
+// The cache is stored in a text file so a restart does not rehash everything.
+// Safe to use from several threads
+class StatCache {
+    public:
+        // tag identifies the settings the fingerprints were computed with,
+        // a cache saved with a different tag is thrown away on Load
+        StatCache(const std::string &path, const std::string &tag);
+
+        // Missing or corrupted cache file just means an empty cache
+        void Load();
+        // Writes the cache if it changed since the last Save
+        void Save();
+
+        // Whether the file was cached, sets its cached metadata if so
+        bool Get(const std::string &file, FileStat &stat) const;
+        void Set(const std::string &file, const FileStat &stat);
+        void Erase(const std::string &file);
+
+    private:
+        std::string m_Path;
+        std::string m_Tag;
+        mutable std::mutex m_Mutex;
+        std::unordered_map<std::string, FileStat> m_Entries;
+        bool m_Dirty = false;
+};
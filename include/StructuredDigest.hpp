@@ -0,0 +1,183 @@
+#pragma once
+
+#include <Filters.hpp>
+#include <HashingAlgorithm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Digests of JSON and YAML documents with the values at the key paths of a
+// FilterKeys left out. What is digested is a canonical form of the document:
+// minified JSON with every string escaped the same way, each document
+// followed by a newline. Reindenting, reordering whitespace or escaping a
+// character differently does not change the digest. A value left out is
+// replaced by ?, so its key still has to be there.
+
+// Follows the containers a document is in and tells which values are left
+// out. Only the paths that still match are kept for each container, so a
+// value costs nothing once no path leads into it
+class KeyPathTracker {
+    public:
+        explicit KeyPathTracker(const FilterKeys &filter);
+
+        // A document starts, its top level value is never left out
+        void DocumentStarts();
+        // A value starts in the map on top under key. Returns true when it
+        // is left out
+        bool MapValue(std::string_view key);
+        // A value starts in the sequence on top. Returns true when it is
+        // left out
+        bool SequenceValue();
+        // A value starts where no path can match, like a complex YAML key
+        void Unmatched();
+
+        // The value that started last is a map or a sequence
+        void Push();
+        void Pop();
+
+        // Longest component of the paths, longer keys do not match any
+        size_t MaxKeyLength() const {return m_MaxKeyLength;}
+
+    private:
+        struct Frame {
+            // Where the paths of this container start in m_Alive
+            size_t alive;
+            // Index of the next value, in sequences
+            uint64_t index;
+        };
+
+        template <typename Match>
+        bool Select(Match &&match);
+
+        const std::vector<FilterKeys::Path> &m_Paths;
+        size_t m_MaxKeyLength = 0;
+        std::vector<Frame> m_Frames;
+        // Paths still matching, of all open containers one after another
+        std::vector<uint32_t> m_Alive;
+        // Paths matching the value that started last
+        std::vector<uint32_t> m_Child;
+};
+
+// Bytes of the canonical form on their way to the digest. Small ones are
+// collected first, a digest update costs more than the copy
+class CanonicalOutput {
+    public:
+        explicit CanonicalOutput(HashingAlgorithm::Context &ctx) : m_Ctx(ctx) {}
+
+        void Write(std::string_view data)
+        {
+            if (data.size() >= SMALL_WRITE) {
+                Flush();
+                m_Ctx.Update(data);
+                return;
+            }
+            m_Buffer.append(data);
+            if (m_Buffer.size() >= BUFFER_SIZE)
+                Flush();
+        }
+        void Write(char c)
+        {
+            m_Buffer.push_back(c);
+            if (m_Buffer.size() >= BUFFER_SIZE)
+                Flush();
+        }
+        // Writes s as a JSON string, in the canonical escaping
+        void WriteString(std::string_view s);
+        // Same for a string decoded already, byte by byte
+        void WriteStringByte(unsigned char c);
+
+        void Flush()
+        {
+            if (!m_Buffer.empty())
+                m_Ctx.Update(m_Buffer);
+            m_Buffer.clear();
+        }
+        // Drops what was not flushed yet, before the context starts over
+        void Discard() {m_Buffer.clear();}
+
+    private:
+        static constexpr size_t SMALL_WRITE = 256;
+        static constexpr size_t BUFFER_SIZE = 16 * 1024;
+
+        HashingAlgorithm::Context &m_Ctx;
+        std::string m_Buffer;
+};
+
+// JSON fed in chunks of any size. Memory use only grows with how deep the
+// containers nest, never with the size of the document. Several documents
+// one after another (JSON lines) are fine. A file that is not valid JSON,
+// control characters in strings included, is digested as it is from its
+// first byte on, after a marker, like YamlDigest does. The part of it fed
+// already is read again from path for that
+class JsonDigest {
+    public:
+        JsonDigest(HashingAlgorithm::Context &ctx, const std::string &path, const FilterKeys &filter);
+
+        void Update(std::string_view chunk);
+        // Call once after the last chunk, before the context is finalized
+        void Finish();
+
+    private:
+        enum class State : uint8_t {
+            VALUE,          // A value is next
+            FIRST_VALUE,    // A value or ], after [
+            FIRST_KEY,      // A key or }, after {
+            KEY,            // A key, after ,
+            COLON,
+            AFTER_VALUE,    // , or the end of the container, or another document
+            STRING,
+            ESCAPE,         // After a backslash in a string
+            UNICODE,        // In the 4 hex digits of \u
+            NUMBER,
+            LITERAL,        // true, false or null
+            INVALID,
+        };
+        static constexpr size_t NOT_SKIPPING = SIZE_MAX;
+
+        bool Emitting() const {return m_SkipBase == NOT_SKIPPING;}
+        void Parse(std::string_view chunk);
+        void StartValue(std::string_view chunk, size_t &i);
+        void Open(char c);
+        void Close(char c);
+        void EndValue();
+        void StringPart(std::string_view part);
+        void StringByte(unsigned char c);
+        void CodePoint(uint32_t code);
+        void Utf8(uint32_t code);
+        void FlushSurrogate();
+        void Invalid(std::string_view chunk);
+        void Restart();
+
+        HashingAlgorithm::Context &m_Ctx;
+        std::string m_Path;
+        // Bytes of the file before the chunk being parsed
+        uint64_t m_Offset = 0;
+        CanonicalOutput m_Out;
+        KeyPathTracker m_Paths;
+        State m_State = State::VALUE;
+        // { or [ of every open container
+        std::vector<char> m_Stack;
+        // Size of m_Stack when the value being left out started
+        size_t m_SkipBase = NOT_SKIPPING;
+        // The string is a key, it is kept in m_Key for the paths unless it
+        // is too long to match any of them
+        bool m_InKey = false;
+        std::string m_Key;
+        bool m_KeyTooLong = false;
+        std::string_view m_Literal;
+        size_t m_LiteralPos = 0;
+        uint32_t m_Code = 0;
+        int m_HexDigits = 0;
+        // First half of a surrogate pair, waiting for the second one
+        uint32_t m_HighSurrogate = 0;
+};
+
+// YAML documents, parsed with the yaml-cpp event parser, which keeps only
+// what it is looking at in memory. Anchors and aliases are digested as the
+// numbers the parser gives them. A file that is not valid YAML is digested
+// as it is, after a marker. Returns the digest of ctx, throws
+// std::runtime_error when the file can not be read
+std::string YamlDigest(const std::string &path, HashingAlgorithm::Context &ctx, const FilterKeys &filter);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker has its own queue, takes tasks from
+// the front of it and, once it runs dry, steals from the back of the other
+// queues. The thread calling Run works as one of the workers until all its
+// tasks are done, so a task may call Run again without deadlocking the pool.
+// While it waits, it only runs tasks of the batch it passed to Run.
+class ThreadPool {
+    public:
+        using Task = std::function<void()>;
+
+        // threads includes the calling thread, so threads - 1 are spawned
+        explicit ThreadPool(unsigned threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        unsigned Size() const {return static_cast<unsigned>(m_Queues.size());}
+
+        // Index of the worker the calling thread is, in range [0, Size()).
+        // The thread calling Run is worker 0 while it waits.
+        static unsigned WorkerIndex();
+
+        // Runs the tasks and returns when all of them are finished. Task i is
+        // queued on worker i % Size(), so the tasks should be ordered the way
+        // they should start. Rethrows the first exception thrown by a task.
+        void Run(std::vector<Task> tasks);
+
+        // Number of online CPUs, at least 1
+        static unsigned HardwareThreads();
+
+    private:
+        struct Batch;
+        struct Job {
+            Task task;
+            std::shared_ptr<Batch> batch;
+        };
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Job> jobs;
+        };
+
+        std::vector<std::unique_ptr<Queue>> m_Queues;
+        std::vector<std::thread> m_Threads;
+
+        // Wakes up idle workers when new jobs arrive or the pool stops
+        std::mutex m_Mutex;
+        std::condition_variable m_Wakeup;
+        size_t m_Queued = 0;
+        bool m_Stop = false;
+
+        void WorkerLoop(unsigned index);
+        // only, when set, is the batch the job has to be of
+        bool TryRunOne(unsigned index, const Batch *only = nullptr);
+        bool Pop(unsigned index, Job &job, const Batch *only);
+        static void Execute(Job &job);
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <PathMatcher.hpp>
+#include <ThreadPool.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Finds the files a PathMatcher matches, walking from its roots. Every
+// directory is read by a task of its own on the pool, relative to its parent
+// with openat and getdents64 where available, and the names in it are fed to
+// the matcher from the state of the directory. The type of an entry comes
+// with its name, so only symbolic links and entries of file systems that do
+// not report types are stat'ed. Symbolic links to files are followed, to
+// directories they are not, so loops can not be walked. A quarter of the
+// open file limit at most is spent on directories kept open for openat,
+// deeper ones are opened by their path from the closest one kept open
+class TreeWalker {
+    public:
+        struct Stats {
+            uint64_t directories = 0;
+            uint64_t entries = 0;
+            uint64_t errors = 0;    // Directories that could not be read
+            // The ones of them that exist, sorted. What is under them is
+            // not known, rather than gone
+            std::vector<std::string> unreadable;
+        };
+
+        explicit TreeWalker(ThreadPool &pool) : m_Pool(pool) {}
+
+        // Returns the files the compiled matcher matches, sorted without
+        // duplicates. walked, when given, gets the roots and the directories
+        // under them that were read
+        std::vector<std::string> Expand(const PathMatcher &matcher, Stats *stats = nullptr,
+                std::vector<std::string> *walked = nullptr);
+        // Same, for the files under directory only
+        std::vector<std::string> ExpandUnder(const PathMatcher &matcher, const std::string &directory,
+                Stats *stats = nullptr, std::vector<std::string> *walked = nullptr);
+
+    private:
+        ThreadPool &m_Pool;
+
+        std::vector<std::string> WalkRoots(const PathMatcher &matcher, const std::vector<std::string> &candidates,
+                Stats *stats, std::vector<std::string> *walked);
+};
+
+// Files the globs expanded to on the last scan. Stored in a text file, so
+// files added or deleted while the monitor was not running are reported
+class TreeListing {
+    public:
+        // tag identifies the globs, a listing saved with another tag is thrown away on Load
+        TreeListing(const std::string &path, const std::string &tag);
+
+        // Missing or corrupted listing means nothing is known yet
+        void Load();
+        // Replaces the listing and writes it when it changed
+        void Save(const std::vector<std::string> &files);
+
+        // Whether there is a previous listing to compare with
+        bool Known() const {return m_Known;}
+        // Sorted
+        const std::vector<std::string> &Files() const {return m_Files;}
+
+    private:
+        std::string m_Path;
+        std::string m_Tag;
+        std::vector<std::string> m_Files;
+        bool m_Known = false;
+};
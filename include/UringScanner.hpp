@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Filters.hpp>
+#include <HashingAlgorithm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Hashes a batch of files with Linux io_uring. Up to queue depth reads are
+// kept in flight, each one for a different file, and every completed buffer
+// is handed to that file's digest. Buffers are registered with the kernel
+// once when the scanner is created and reused for every scan.
+class UringScanner {
+    public:
+        struct Result {
+            std::string hash;   // empty when the file could not be hashed
+            std::string error;
+        };
+
+        // Whether io_uring can be used on this system. Checked only once
+        static bool Available();
+
+        // Throws std::runtime_error when the ring can not be set up
+        UringScanner(unsigned queueDepth, size_t bufferSize);
+        ~UringScanner();
+
+        UringScanner(const UringScanner&) = delete;
+        UringScanner& operator=(const UringScanner&) = delete;
+
+        // Returns results in the same order as files
+        std::vector<Result> Run(const std::vector<std::string> &files,
+                const HashingAlgorithm &algorithm, const FilterMap &filters);
+
+    private:
+        struct Ring;
+
+        Ring *m_Ring;
+        unsigned m_QueueDepth;
+        size_t m_BufferSize;
+        unsigned char *m_Buffers;
+        // Whether the buffers were registered, plain reads are used if not
+        bool m_Registered;
+        // One digest context per slot, kept between runs with the same algorithm.
+        // Known by its id, an algorithm created where a destroyed one was
+        // must not get its contexts
+        std::vector<std::unique_ptr<HashingAlgorithm::Context>> m_Contexts;
+        uint64_t m_ContextsAlgorithm = 0;
+};
@@ -0,0 +1,132 @@
+// Measures a filter plugin on its own, see include/FilterPluginAbi.h:
+//
+//   filter_plugin_bench <plugin library> <file> [key=value ...]
+//
+// The file is read into memory and its lines are split and fed to the
+// plugin, the way FileDigest does when the line has no other filter. The
+// best of a few runs is printed, next to the time splitting the lines alone
+// takes, so what remains is the cost of the plugin.
+#include <FilterPluginAbi.h>
+
+#include <dlfcn.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+static constexpr int RUNS = 5;
+
+// Splits data into lines and calls apply with each of them, returns the
+// seconds it took
+template <typename Apply>
+static double Run(const std::string &data, Apply &&apply)
+{
+    auto start = std::chrono::steady_clock::now();
+    uint64_t lineNumber = 0;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        const void *nl = std::memchr(data.data() + pos, '\n', data.size() - pos);
+        size_t end = nl ? static_cast<size_t>(static_cast<const char *>(nl) - data.data()) : data.size();
+        apply(data.data() + pos, end - pos, ++lineNumber);
+        pos = end + 1;
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        std::fprintf(stderr, "usage: %s <plugin library> <file> [key=value ...]\n", argv[0]);
+        return 2;
+    }
+
+    void *library = dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+    if (!library) {
+        std::fprintf(stderr, "failed to load %s: %s\n", argv[1], dlerror());
+        return 1;
+    }
+    auto entry = reinterpret_cast<monitor_filter_entry_fn>(dlsym(library, MONITOR_FILTER_ENTRY));
+    const monitor_filter_plugin *plugin = entry ? entry() : nullptr;
+    if (!plugin || plugin->abi_version != MONITOR_FILTER_ABI_VERSION) {
+        std::fprintf(stderr, "%s does not implement ABI version %d\n", argv[1], MONITOR_FILTER_ABI_VERSION);
+        return 1;
+    }
+
+    std::ifstream in(argv[2], std::ios::binary);
+    if (!in) {
+        std::fprintf(stderr, "failed to open %s\n", argv[2]);
+        return 1;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    std::vector<std::string> keys, values;
+    for (int i = 3; i < argc; i++) {
+        const char *eq = std::strchr(argv[i], '=');
+        if (!eq) {
+            std::fprintf(stderr, "options are key=value, not %s\n", argv[i]);
+            return 2;
+        }
+        keys.emplace_back(argv[i], static_cast<size_t>(eq - argv[i]));
+        values.emplace_back(eq + 1);
+    }
+    std::vector<monitor_filter_option> options;
+    for (size_t i = 0; i < keys.size(); i++)
+        options.push_back({keys[i].c_str(), values[i].c_str()});
+
+    char error[256] = "";
+    void *filter = plugin->create(argv[2], options.data(), options.size(), error, sizeof(error));
+    if (!filter) {
+        std::fprintf(stderr, "%s rejected the options: %s\n", plugin->name, error);
+        return 1;
+    }
+
+    double split = 1e9;
+    uint64_t lines = 0;
+    for (int i = 0; i < RUNS; i++)
+        split = std::min(split, Run(data, [&lines](const char *, size_t, uint64_t n) { lines = n; }));
+
+    double filtered = 1e9;
+    size_t keptBytes = 0;
+    std::vector<monitor_filter_span> kept(16);
+    for (int i = 0; i < RUNS; i++) {
+        void *state = plugin->begin ? plugin->begin(filter) : nullptr;
+        keptBytes = 0;
+        bool failed = false;
+        double seconds = Run(data, [&](const char *line, size_t length, uint64_t n) {
+            size_t count = plugin->apply(filter, state, line, length, n, kept.data(), kept.size());
+            if (count != MONITOR_FILTER_ERROR && count > kept.size()) {
+                kept.resize(count);
+                count = plugin->apply(filter, state, line, length, n, kept.data(), kept.size());
+            }
+            if (count == MONITOR_FILTER_ERROR) {
+                failed = true;
+                return;
+            }
+            for (size_t k = 0; k < count; k++)
+                keptBytes += kept[k].length;
+        });
+        if (plugin->end)
+            plugin->end(filter, state);
+        if (failed) {
+            std::fprintf(stderr, "%s failed on a line\n", plugin->name);
+            return 1;
+        }
+        filtered = std::min(filtered, seconds);
+    }
+
+    double mb = static_cast<double>(data.size()) / (1024 * 1024);
+    std::printf("%s: %.1f MB, %llu lines, %.1f%% of the bytes kept\n", plugin->name, mb,
+            static_cast<unsigned long long>(lines), data.empty() ? 100.0 : 100.0 * static_cast<double>(keptBytes) / static_cast<double>(data.size()));
+    std::printf("split only  %8.2f ms  %8.1f MB/s\n", split * 1000, mb / split);
+    std::printf("plugin      %8.2f ms  %8.1f MB/s  %6.1f ns per line over the split\n", filtered * 1000, mb / filtered,
+            lines ? (filtered - split) * 1e9 / static_cast<double>(lines) : 0.0);
+
+    plugin->destroy(filter);
+    dlclose(library);
+    return 0;
+}
@@ -0,0 +1,131 @@
+// Sample filter plugin, see include/FilterPluginAbi.h. Removes ISO 8601
+// timestamps like 2024-05-01T12:30:00.123+02:00 or 2024-05-01 12:30:00 from
+// every line, for logs and generated files stamped with when they were
+// written.
+//
+// Options:
+//   keep_date  "true" to remove only the time of day. Default "false"
+#include <FilterPluginAbi.h>
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+namespace {
+
+struct TimestampFilter {
+    bool keepDate = false;
+};
+
+bool Digits(const char *p, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (p[i] < '0' || p[i] > '9')
+            return false;
+    }
+    return true;
+}
+
+// Length of the timestamp at p, 0 when there is none
+size_t Timestamp(const char *p, const char *end)
+{
+    // Date, then T or a space and the time
+    if (end - p < 19)
+        return 0;
+    if (!Digits(p, 4) || p[4] != '-' || !Digits(p + 5, 2) || p[7] != '-' || !Digits(p + 8, 2))
+        return 0;
+    if ((p[10] != 'T' && p[10] != ' ') || !Digits(p + 11, 2) || p[13] != ':' || !Digits(p + 14, 2)
+            || p[16] != ':' || !Digits(p + 17, 2))
+        return 0;
+
+    const char *q = p + 19;
+    // Fraction of a second
+    if (q < end && (*q == '.' || *q == ',')) {
+        const char *digits = q + 1;
+        while (digits < end && *digits >= '0' && *digits <= '9')
+            digits++;
+        if (digits > q + 1)
+            q = digits;
+    }
+    // Time zone
+    if (q < end && *q == 'Z')
+        q++;
+    else if (end - q >= 6 && (*q == '+' || *q == '-') && Digits(q + 1, 2) && q[3] == ':' && Digits(q + 4, 2))
+        q += 6;
+    return static_cast<size_t>(q - p);
+}
+
+void *Create(const char *, const monitor_filter_option *options, size_t optionCount, char *error, size_t errorSize)
+{
+    TimestampFilter filter;
+    for (size_t i = 0; i < optionCount; i++) {
+        const monitor_filter_option &option = options[i];
+        if (std::strcmp(option.key, "keep_date") == 0 && std::strcmp(option.value, "true") == 0) {
+            filter.keepDate = true;
+        } else if (std::strcmp(option.key, "keep_date") == 0 && std::strcmp(option.value, "false") == 0) {
+            filter.keepDate = false;
+        } else {
+            std::snprintf(error, errorSize, "unknown option %s: %s", option.key, option.value);
+            return nullptr;
+        }
+    }
+    return new (std::nothrow) TimestampFilter(filter);
+}
+
+void Destroy(void *filter)
+{
+    delete static_cast<TimestampFilter *>(filter);
+}
+
+size_t Apply(void *filter, void *, const char *line, size_t length, uint64_t,
+             monitor_filter_span *kept, size_t capacity)
+{
+    const bool keepDate = static_cast<TimestampFilter *>(filter)->keepDate;
+    const char *end = line + length;
+    size_t count = 0;
+    auto keep = [&](size_t offset, size_t size) {
+        if (size == 0)
+            return;
+        if (count < capacity)
+            kept[count] = {offset, size};
+        count++;
+    };
+
+    // Every timestamp has a - after its year, the rest of the line is skipped
+    // at memchr speed
+    size_t pos = 0;
+    size_t search = 4;
+    while (search < length) {
+        const void *dash = std::memchr(line + search, '-', length - search);
+        if (!dash)
+            break;
+        size_t start = static_cast<size_t>(static_cast<const char *>(dash) - line) - 4;
+        size_t size = start >= pos ? Timestamp(line + start, end) : 0;
+        if (size == 0) {
+            search = start + 5;
+            continue;
+        }
+
+        keep(pos, start - pos + (keepDate ? 10 : 0));
+        pos = start + size;
+        search = pos + 4;
+    }
+    keep(pos, length - pos);
+    return count;
+}
+
+}
+
+extern "C" MONITOR_FILTER_EXPORT const monitor_filter_plugin *monitor_filter_plugin_entry(void)
+{
+    static const monitor_filter_plugin plugin = {
+        MONITOR_FILTER_ABI_VERSION,
+        "timestamps",
+        Create,
+        Destroy,
+        nullptr,
+        nullptr,
+        Apply,
+    };
+    return &plugin;
+}
@@ -14,7 +14,10 @@ def init(params):
 
     try:
         db_path = params.get("path", "database.db")
-        connection = sqlite3.connect(db_path)
+        # Queries come from the scan workers of the monitor, not only from the
+        # thread that opened the connection. They hold the GIL for every
+        # query, which keeps them from using the connection at the same time
+        connection = sqlite3.connect(db_path, check_same_thread=False)
 
         cursor = connection.cursor()
         cursor.execute("""
@@ -23,6 +26,13 @@ def init(params):
                 hash TEXT NOT NULL
             )
         """)
+        # Per chunk digests of files hashed as a Merkle tree
+        cursor.execute("""
+            CREATE TABLE IF NOT EXISTS leaves (
+                file TEXT PRIMARY KEY,
+                leaves TEXT NOT NULL
+            )
+        """)
         connection.commit()
         cursor.close()
 
@@ -49,6 +59,19 @@ def run(params):
             "file": "index.html"
         }
 
+    INSERT LEAVES:
+        {
+            "action": "insert_leaves",
+            "file": "index.html",
+            "leaves": "1048576:abc123,def456"
+        }
+
+    SELECT LEAVES:
+        {
+            "action": "select_leaves",
+            "file": "index.html"
+        }
+
     DELETE ONE:
         {   "action": "delete_one",
             "file": "index.html" 
@@ -98,11 +121,42 @@ def run(params):
                 "hash": row[0] if row else "NULL"
             }
 
+        # -------- INSERT LEAVES ---------
+        elif action == "insert_leaves":
+            file = params["file"]
+            leaves = params["leaves"]
+
+            cursor.execute(
+                "INSERT OR REPLACE INTO leaves (file, leaves) VALUES (?, ?)",
+                (file, leaves)
+            )
+            connection.commit()
+
+            return {"status": "OK", "message": "Inserted"}
+
+        # -------- SELECT LEAVES ---------
+        elif action == "select_leaves":
+            file = params["file"]
+
+            cursor.execute(
+                "SELECT leaves FROM leaves WHERE file = ?",
+                (file,)
+            )
+            row = cursor.fetchone()
+
+            return {
+                "status": "OK",
+                "file": file,
+                "leaves": row[0] if row else "NULL"
+            }
+
         # -------- DELETE ONE ---------
         elif action == "delete_one":
             file = params["file"]
 
-            cursor.execute("DELETE FROM integrity WHERE file = ?", (file,))
+            # Baselines of further algorithms are stored as "<file>.<algorithm>"
+            cursor.execute("DELETE FROM integrity WHERE file = ? OR file LIKE ?", (file, file + ".%"))
+            cursor.execute("DELETE FROM leaves WHERE file = ?", (file,))
             connection.commit()
 
             return {"status": "OK", "message": f"Deleted {file}"}
@@ -110,6 +164,7 @@ def run(params):
         # -------- DELETE ALL ---------
         elif action == "delete_all":
             cursor.execute("DELETE FROM integrity")
+            cursor.execute("DELETE FROM leaves")
             connection.commit()
 
             return {"status": "OK", "message": "All rows deleted"}
@@ -0,0 +1,100 @@
+#include <AhoCorasick.hpp>
+
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+
+AhoCorasick::AhoCorasick(const std::vector<std::string> &strings)
+{
+    // Class 0 is every byte none of the strings has
+    for (const std::string &s : strings) {
+        if (s.empty())
+            throw std::invalid_argument("Strings searched for must not be empty");
+        for (unsigned char c : s) {
+            if (m_Class[c] == 0)
+                m_Class[c] = static_cast<uint16_t>(m_Classes++);
+        }
+    }
+
+    if (!strings.empty()) {
+        m_First = static_cast<unsigned char>(strings[0][0]);
+        for (const std::string &s : strings) {
+            if (static_cast<unsigned char>(s[0]) != m_First)
+                m_First = -1;
+        }
+    }
+
+    // Trie of the strings, missing transitions are NONE for now
+    constexpr State NONE = UINT32_MAX;
+    m_Next.assign(m_Classes, NONE);
+    m_Match.assign(1, NO_MATCH);
+    for (size_t i = 0; i < strings.size(); i++) {
+        State state = ROOT;
+        for (unsigned char c : strings[i]) {
+            State &next = m_Next[state * m_Classes + m_Class[c]];
+            if (next == NONE) {
+                next = static_cast<State>(m_Match.size());
+                m_Next.resize(m_Next.size() + m_Classes, NONE);
+                m_Match.push_back(NO_MATCH);
+            }
+            state = m_Next[state * m_Classes + m_Class[c]];
+        }
+        if (m_Match[state] == NO_MATCH)
+            m_Match[state] = static_cast<int32_t>(i);
+    }
+
+    // Breadth first, so the failure state of every state is done before it.
+    // A missing transition goes where the failure state's transition goes
+    std::vector<State> fail(m_Match.size(), ROOT);
+    std::deque<State> queue;
+    for (size_t c = 0; c < m_Classes; c++) {
+        State &next = m_Next[c];
+        if (next == NONE) {
+            next = ROOT;
+        } else {
+            queue.push_back(next);
+        }
+    }
+    while (!queue.empty()) {
+        State state = queue.front();
+        queue.pop_front();
+
+        // Strings ending in the failure state end here as well
+        int32_t inherited = m_Match[fail[state]];
+        if (inherited != NO_MATCH && (m_Match[state] == NO_MATCH || inherited < m_Match[state]))
+            m_Match[state] = inherited;
+
+        for (size_t c = 0; c < m_Classes; c++) {
+            State &next = m_Next[state * m_Classes + c];
+            State fallback = m_Next[fail[state] * m_Classes + c];
+            if (next == NONE) {
+                next = fallback;
+            } else {
+                fail[next] = fallback;
+                queue.push_back(next);
+            }
+        }
+    }
+}
+
+size_t AhoCorasick::Find(std::string_view data, State &state, int32_t &index) const
+{
+    const size_t classes = m_Classes;
+    State current = state;
+    for (size_t i = 0; i < data.size(); i++) {
+        if (current == ROOT && m_First >= 0) {
+            const void *next = std::memchr(data.data() + i, m_First, data.size() - i);
+            if (!next)
+                break;
+            i = static_cast<size_t>(static_cast<const char *>(next) - data.data());
+        }
+        current = m_Next[current * classes + m_Class[static_cast<unsigned char>(data[i])]];
+        if (m_Match[current] != NO_MATCH) {
+            state = current;
+            index = m_Match[current];
+            return i + 1;
+        }
+    }
+    state = current;
+    return std::string_view::npos;
+}
@@ -0,0 +1,336 @@
+#include <Blake3.hpp>
+#include <Blake3Impl.hpp>
+#include <ThreadPool.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace blake3 {
+
+static inline uint32_t Rotr(uint32_t w, int c)
+{
+    return (w >> c) | (w << (32 - c));
+}
+
+static inline void G(uint32_t v[16], int a, int b, int c, int d, uint32_t x, uint32_t y)
+{
+    v[a] = v[a] + v[b] + x;
+    v[d] = Rotr(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = Rotr(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y;
+    v[d] = Rotr(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];
+    v[b] = Rotr(v[b] ^ v[c], 7);
+}
+
+static void Compress(const uint32_t cv[8], const uint8_t block[BLOCK_LEN], uint8_t blockLen, uint64_t counter, uint8_t flags, uint32_t v[16])
+{
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++)
+        m[i] = Load32(block + 4 * i);
+
+    for (int i = 0; i < 8; i++)
+        v[i] = cv[i];
+    for (int i = 0; i < 4; i++)
+        v[8 + i] = IV[i];
+    v[12] = static_cast<uint32_t>(counter);
+    v[13] = static_cast<uint32_t>(counter >> 32);
+    v[14] = blockLen;
+    v[15] = flags;
+
+    for (int r = 0; r < 7; r++) {
+        const uint8_t *s = MSG_SCHEDULE[r];
+        G(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+        G(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+        G(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+        G(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+        G(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+        G(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        G(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+        G(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+}
+
+void CompressInPlace(uint32_t cv[8], const uint8_t block[BLOCK_LEN], uint8_t blockLen, uint64_t counter, uint8_t flags)
+{
+    uint32_t v[16];
+    Compress(cv, block, blockLen, counter, flags, v);
+    for (int i = 0; i < 8; i++)
+        cv[i] = v[i] ^ v[i + 8];
+}
+
+void CompressXof(const uint32_t cv[8], const uint8_t block[BLOCK_LEN], uint8_t blockLen, uint64_t counter, uint8_t flags, uint8_t out[64])
+{
+    uint32_t v[16];
+    Compress(cv, block, blockLen, counter, flags, v);
+    for (int i = 0; i < 8; i++) {
+        Store32(out + 4 * i, v[i] ^ v[i + 8]);
+        Store32(out + 32 + 4 * i, v[i + 8] ^ cv[i]);
+    }
+}
+
+static void HashChunkPortable(const uint8_t *input, const uint32_t key[8], uint64_t counter, uint8_t *out)
+{
+    uint32_t cv[8];
+    std::copy(key, key + 8, cv);
+    for (size_t block = 0; block < CHUNK_LEN / BLOCK_LEN; block++) {
+        uint8_t flags = 0;
+        if (block == 0)
+            flags |= CHUNK_START;
+        if (block == CHUNK_LEN / BLOCK_LEN - 1)
+            flags |= CHUNK_END;
+        CompressInPlace(cv, input + block * BLOCK_LEN, BLOCK_LEN, counter, flags);
+    }
+    for (int i = 0; i < 8; i++)
+        Store32(out + 4 * i, cv[i]);
+}
+
+enum class Kernel {PORTABLE, SSE41, AVX2, AVX512};
+
+static Kernel DetectKernel()
+{
+#if defined(HAVE_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl"))
+        return Kernel::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return Kernel::AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return Kernel::SSE41;
+#endif
+    return Kernel::PORTABLE;
+}
+
+static Kernel ActiveKernel()
+{
+    static const Kernel kernel = DetectKernel();
+    return kernel;
+}
+
+// Hashes N chunks with the kernel, returns the number of chunks hashed
+template <size_t N>
+static size_t HashChunksWith(void (*kernel)(const uint8_t *const[N], const uint32_t[8], uint64_t, uint8_t*),
+        const uint8_t *input, size_t count, const uint32_t key[8], uint64_t counter, uint8_t *out)
+{
+    size_t done = 0;
+    const uint8_t *inputs[N];
+    while (count - done >= N) {
+        for (size_t i = 0; i < N; i++)
+            inputs[i] = input + (done + i) * CHUNK_LEN;
+        kernel(inputs, key, counter + done, out + done * 32);
+        done += N;
+    }
+    return done;
+}
+
+void HashChunks(const uint8_t *input, size_t count, const uint32_t key[8], uint64_t counter, uint8_t *out)
+{
+    size_t done = 0;
+#ifdef HAVE_X86_SIMD
+    // Leftovers of a wide kernel go through the narrower ones
+    Kernel kernel = ActiveKernel();
+    auto next = [&](size_t n) {
+        done += n;
+        input += n * CHUNK_LEN;
+        counter += n;
+        out += n * 32;
+    };
+    if (kernel >= Kernel::AVX512)
+        next(HashChunksWith<16>(HashChunksAvx512, input, count - done, key, counter, out));
+    if (kernel >= Kernel::AVX2)
+        next(HashChunksWith<8>(HashChunksAvx2, input, count - done, key, counter, out));
+    if (kernel >= Kernel::SSE41)
+        next(HashChunksWith<4>(HashChunksSse41, input, count - done, key, counter, out));
+#endif
+    for (size_t i = 0; done + i < count; i++)
+        HashChunkPortable(input + i * CHUNK_LEN, key, counter + i, out + i * 32);
+}
+
+}
+
+using namespace blake3;
+
+const char *Blake3Hasher::Implementation()
+{
+    switch (ActiveKernel()) {
+        case Kernel::AVX512: return "avx512";
+        case Kernel::AVX2:   return "avx2";
+        case Kernel::SSE41:  return "sse4.1";
+        default:             return "portable";
+    }
+}
+
+void Blake3Hasher::ChunkState::Reset(const uint32_t key[8], uint64_t chunkCounter)
+{
+    std::copy(key, key + 8, cv);
+    counter = chunkCounter;
+    bufLen = 0;
+    blocksCompressed = 0;
+}
+
+// Returns the number of bytes taken, which is less than len once the chunk is full
+size_t Blake3Hasher::ChunkState::Update(const uint8_t *input, size_t len)
+{
+    size_t taken = 0;
+    while (taken < len && Len() < CHUNK_LEN) {
+        // The last block of the chunk is compressed in Finalize or when the
+        // chunk is pushed, since only then its flags are known
+        if (bufLen == BLOCK_LEN) {
+            CompressInPlace(cv, buf, BLOCK_LEN, counter, blocksCompressed == 0 ? CHUNK_START : 0);
+            blocksCompressed++;
+            bufLen = 0;
+        }
+
+        size_t n = std::min(BLOCK_LEN - bufLen, len - taken);
+        std::memcpy(buf + bufLen, input + taken, n);
+        bufLen += static_cast<uint8_t>(n);
+        taken += n;
+    }
+    return taken;
+}
+
+void Blake3Hasher::Reset()
+{
+    std::copy(IV, IV + 8, m_Key);
+    m_Chunk.Reset(m_Key, 0);
+    m_StackLen = 0;
+}
+
+void Blake3Hasher::SetPool(ThreadPool *pool, size_t minBytes)
+{
+    m_Pool = pool;
+    m_PoolMinBytes = minBytes;
+}
+
+// Merges the completed subtrees: after n chunks, the stack holds one
+// subtree for every set bit of n. A chunk is only pushed once more input
+// follows it, so none of the merged parents can be the root
+void Blake3Hasher::PushChunkCV(const uint32_t chunkCV[8], uint64_t totalChunks)
+{
+    uint32_t cv[8];
+    std::copy(chunkCV, chunkCV + 8, cv);
+
+    while ((totalChunks & 1) == 0) {
+        uint8_t block[BLOCK_LEN];
+        m_StackLen--;
+        for (int i = 0; i < 8; i++) {
+            Store32(block + 4 * i, m_Stack[m_StackLen][i]);
+            Store32(block + 32 + 4 * i, cv[i]);
+        }
+        std::copy(m_Key, m_Key + 8, cv);
+        CompressInPlace(cv, block, BLOCK_LEN, 0, PARENT);
+        totalChunks >>= 1;
+    }
+
+    std::copy(cv, cv + 8, m_Stack[m_StackLen]);
+    m_StackLen++;
+}
+
+void Blake3Hasher::HashChunks(const uint8_t *input, size_t chunks)
+{
+    // Chaining values are computed in bounded batches, or all at once when
+    // they are computed on the pool
+    constexpr size_t BATCH = 64;
+    uint8_t local[BATCH * 32];
+    std::vector<uint8_t> pooled;
+
+    uint64_t counter = m_Chunk.counter;
+    for (size_t done = 0; done < chunks;) {
+        size_t count = std::min(BATCH, chunks - done);
+        uint8_t *cvs = local;
+
+        if (m_Pool && m_Pool->Size() > 1 && chunks * CHUNK_LEN >= m_PoolMinBytes && done == 0) {
+            count = chunks;
+            pooled.resize(count * 32);
+            cvs = pooled.data();
+
+            // A few tasks per thread so the stealing can even them out,
+            // each a multiple of the widest kernel
+            size_t perTask = std::max<size_t>(16, (count / (m_Pool->Size() * 4) + 15) / 16 * 16);
+            std::vector<ThreadPool::Task> tasks;
+            for (size_t first = 0; first < count; first += perTask) {
+                size_t n = std::min(perTask, count - first);
+                tasks.push_back([=, this] {
+                    blake3::HashChunks(input + first * CHUNK_LEN, n, m_Key, counter + first, cvs + first * 32);
+                });
+            }
+            m_Pool->Run(std::move(tasks));
+        } else {
+            blake3::HashChunks(input + done * CHUNK_LEN, count, m_Key, counter + done, cvs);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            uint32_t cv[8];
+            for (int w = 0; w < 8; w++)
+                cv[w] = Load32(cvs + i * 32 + 4 * w);
+            PushChunkCV(cv, counter + done + i + 1);
+        }
+        done += count;
+    }
+
+    m_Chunk.Reset(m_Key, counter + chunks);
+}
+
+void Blake3Hasher::Update(const void *data, size_t len)
+{
+    const uint8_t *input = static_cast<const uint8_t*>(data);
+
+    while (len > 0) {
+        // A full chunk is finished only now that more input follows it
+        if (m_Chunk.Len() == CHUNK_LEN) {
+            uint32_t cv[8];
+            std::copy(m_Chunk.cv, m_Chunk.cv + 8, cv);
+            uint8_t flags = CHUNK_END | (m_Chunk.blocksCompressed == 0 ? CHUNK_START : 0);
+            CompressInPlace(cv, m_Chunk.buf, m_Chunk.bufLen, m_Chunk.counter, flags);
+            PushChunkCV(cv, m_Chunk.counter + 1);
+            m_Chunk.Reset(m_Key, m_Chunk.counter + 1);
+        }
+
+        // Whole chunks, except the last one, go straight to the kernels
+        if (m_Chunk.Len() == 0 && len > CHUNK_LEN) {
+            size_t chunks = (len - 1) / CHUNK_LEN;
+            HashChunks(input, chunks);
+            input += chunks * CHUNK_LEN;
+            len -= chunks * CHUNK_LEN;
+        }
+
+        size_t taken = m_Chunk.Update(input, len);
+        input += taken;
+        len -= taken;
+    }
+}
+
+void Blake3Hasher::Finalize(uint8_t *out, size_t outLen) const
+{
+    // The output of the current chunk, merged with the subtrees on the stack
+    // from the newest one. The last compression is done with ROOT below
+    uint32_t cv[8];
+    uint8_t block[BLOCK_LEN] = {};
+    uint8_t blockLen = m_Chunk.bufLen;
+    uint64_t counter = m_Chunk.counter;
+    uint8_t flags = CHUNK_END | (m_Chunk.blocksCompressed == 0 ? CHUNK_START : 0);
+    std::copy(m_Chunk.cv, m_Chunk.cv + 8, cv);
+    std::memcpy(block, m_Chunk.buf, m_Chunk.bufLen);
+
+    for (size_t i = m_StackLen; i > 0; i--) {
+        CompressInPlace(cv, block, blockLen, counter, flags);
+        for (int w = 0; w < 8; w++) {
+            Store32(block + 4 * w, m_Stack[i - 1][w]);
+            Store32(block + 32 + 4 * w, cv[w]);
+        }
+        std::copy(m_Key, m_Key + 8, cv);
+        blockLen = BLOCK_LEN;
+        counter = 0;
+        flags = PARENT;
+    }
+
+    uint8_t output[64];
+    for (uint64_t outputBlock = 0; outLen > 0; outputBlock++) {
+        CompressXof(cv, block, blockLen, outputBlock, flags | ROOT, output);
+        size_t n = std::min<size_t>(outLen, sizeof(output));
+        std::memcpy(out, output, n);
+        out += n;
+        outLen -= n;
+    }
+}
@@ -0,0 +1,14 @@
+// AVX2 kernel of Blake3Hasher, compiled with -mavx2 (see CMakeLists.txt)
+#include <Blake3Impl.hpp>
+#include <SimdLanes.hpp>
+
+#ifdef HAVE_X86_SIMD
+namespace blake3 {
+
+void HashChunksAvx2(const uint8_t *const inputs[8], const uint32_t key[8], uint64_t counter, uint8_t *out)
+{
+    HashChunksSimd<Avx2Lanes>(inputs, key, counter, out);
+}
+
+}
+#endif
@@ -0,0 +1,14 @@
+// AVX-512 kernel of Blake3Hasher, compiled with -mavx512f -mavx512vl (see CMakeLists.txt)
+#include <Blake3Impl.hpp>
+#include <SimdLanes.hpp>
+
+#ifdef HAVE_X86_SIMD
+namespace blake3 {
+
+void HashChunksAvx512(const uint8_t *const inputs[16], const uint32_t key[8], uint64_t counter, uint8_t *out)
+{
+    HashChunksSimd<Avx512Lanes>(inputs, key, counter, out);
+}
+
+}
+#endif
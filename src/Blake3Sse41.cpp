@@ -0,0 +1,14 @@
+// SSE4.1 kernel of Blake3Hasher, compiled with -msse4.1 (see CMakeLists.txt)
+#include <Blake3Impl.hpp>
+#include <SimdLanes.hpp>
+
+#ifdef HAVE_X86_SIMD
+namespace blake3 {
+
+void HashChunksSse41(const uint8_t *const inputs[4], const uint32_t key[8], uint64_t counter, uint8_t *out)
+{
+    HashChunksSimd<Sse41Lanes>(inputs, key, counter, out);
+}
+
+}
+#endif
@@ -0,0 +1,362 @@
+#include <ChangeWatcher.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+// Bytes of events read at once
+static constexpr size_t EVENT_BUFFER = 64 * 1024;
+// Resolved file handles kept, the cache starts over when it is full
+static constexpr size_t MAX_HANDLES = 65536;
+
+static constexpr uint32_t INOTIFY_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+        IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_EXCL_UNLINK;
+static constexpr uint32_t INOTIFY_ENTRY = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+static constexpr uint64_t FANOTIFY_MASK = FAN_MODIFY | FAN_ATTRIB | FAN_CLOSE_WRITE | FAN_CREATE | FAN_DELETE |
+        FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR;
+static constexpr uint64_t FANOTIFY_ENTRY = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO;
+
+static std::string JoinPath(const std::string &directory, std::string_view name)
+{
+    std::string path = directory;
+    if (!path.empty() && path.back() != '/')
+        path += '/';
+    path += name;
+    return path;
+}
+
+ChangeWatcher::ChangeWatcher(Backend backend) : m_Backend(backend), m_Buffer(EVENT_BUFFER)
+{
+    if (backend == Backend::INOTIFY) {
+        m_Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_Fd < 0)
+            throw std::runtime_error("inotify_init1 failed: " + std::string(std::strerror(errno)));
+        return;
+    }
+
+    // Directory file handles and names come with the events, no file is
+    // opened for them
+    m_Fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY);
+    if (m_Fd < 0)
+        throw std::runtime_error("fanotify_init failed: " + std::string(std::strerror(errno)));
+
+    // Since Linux 5.13 users without CAP_SYS_ADMIN get this far, but can
+    // not mark file systems, which every Watch would find out
+    if (fanotify_mark(m_Fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_MASK, AT_FDCWD, "/") == 0) {
+        fanotify_mark(m_Fd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, FANOTIFY_MASK, AT_FDCWD, "/");
+    } else if (errno == EPERM) {
+        close(m_Fd);
+        throw std::runtime_error("marking file systems with fanotify is not permitted, it needs CAP_SYS_ADMIN");
+    }
+}
+
+ChangeWatcher::~ChangeWatcher()
+{
+    for (const FileSystem &fs : m_FileSystems)
+        close(fs.fd);
+    if (m_Fd >= 0)
+        close(m_Fd);
+}
+
+size_t ChangeWatcher::Watch(const std::vector<std::string> &directories)
+{
+    size_t failed = 0;
+
+    if (m_Backend == Backend::INOTIFY) {
+        std::unordered_map<std::string, int> watches;
+        for (const std::string &directory : directories) {
+            auto it = m_Watches.find(directory);
+            if (it != m_Watches.end()) {
+                watches.insert(m_Watches.extract(it));
+                continue;
+            }
+
+            int wd = inotify_add_watch(m_Fd, directory.empty() ? "." : directory.c_str(), INOTIFY_MASK);
+            if (wd < 0) {
+                // Deleted since it was listed, the events of its parent tell
+                if (errno != ENOENT)
+                    failed++;
+                continue;
+            }
+            // The directory was watched already, under another path that is
+            // kept, or under the one it had before it was moved
+            auto [owner, added] = m_Directories.try_emplace(wd, directory);
+            if (!added) {
+                if (watches.contains(owner->second))
+                    continue;
+                m_Watches.erase(owner->second);
+                owner->second = directory;
+            }
+            watches.emplace(directory, wd);
+        }
+
+        for (const auto &[directory, wd] : m_Watches) {
+            inotify_rm_watch(m_Fd, wd);
+            m_Directories.erase(wd);
+        }
+        m_Watches = std::move(watches);
+        return failed;
+    }
+
+    // Directories are sorted, so the parent of one was resolved before it
+    // unless it is not watched. A directory that is not a symbolic link
+    // resolves under its parent without asking the kernel
+    std::unordered_map<std::string, std::string> resolved;
+    std::unordered_map<std::string, std::string> watched;
+    std::vector<uint64_t> devices;
+    for (const std::string &directory : directories) {
+        const char *path = directory.empty() ? "." : directory.c_str();
+        struct stat st;
+        if (lstat(path, &st) != 0 || (S_ISLNK(st.st_mode) && stat(path, &st) != 0)) {
+            if (errno != ENOENT)
+                failed++;
+            continue;
+        }
+
+        size_t slash = directory.find_last_of('/');
+        std::string parent = slash == std::string::npos ? "" : slash == 0 ? "/" : directory.substr(0, slash);
+        std::string_view name = std::string_view(directory).substr(slash + 1);
+        auto it = resolved.find(parent);
+        std::string real;
+        if (!S_ISLNK(st.st_mode) && it != resolved.end() && !name.empty() && name != "." && name != "..") {
+            real = JoinPath(it->second, name);
+        } else {
+            char buffer[PATH_MAX];
+            if (!realpath(path, buffer)) {
+                failed++;
+                continue;
+            }
+            real = buffer;
+        }
+
+        if (std::find(devices.begin(), devices.end(), st.st_dev) == devices.end()) {
+            devices.push_back(st.st_dev);
+            bool marked = std::any_of(m_FileSystems.begin(), m_FileSystems.end(),
+                    [&st](const FileSystem &fs) { return fs.device == st.st_dev; });
+            if (!marked) {
+                int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                struct statfs sfs;
+                if (fd < 0 || fstatfs(fd, &sfs) != 0 ||
+                        fanotify_mark(m_Fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_MASK, fd, nullptr) != 0) {
+                    if (fd >= 0)
+                        close(fd);
+                    devices.pop_back();
+                    failed++;
+                    continue;
+                }
+                uint64_t fsid;
+                static_assert(sizeof(fsid) == sizeof(sfs.f_fsid));
+                std::memcpy(&fsid, &sfs.f_fsid, sizeof(fsid));
+                m_FileSystems.push_back({static_cast<uint64_t>(st.st_dev), fsid, fd});
+            }
+        }
+
+        watched.emplace(real, directory);
+        resolved.emplace(directory, std::move(real));
+    }
+
+    // File systems nothing is watched on any more
+    std::erase_if(m_FileSystems, [this, &devices](const FileSystem &fs) {
+        if (std::find(devices.begin(), devices.end(), fs.device) != devices.end())
+            return false;
+        fanotify_mark(m_Fd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, FANOTIFY_MASK, fs.fd, nullptr);
+        close(fs.fd);
+        return true;
+    });
+    m_Resolved = std::move(watched);
+    m_Handles.clear();
+    return failed;
+}
+
+bool ChangeWatcher::Read(int timeout, std::vector<Event> &events)
+{
+    pollfd pfd {m_Fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout);
+    if (ready < 0 && errno != EINTR)
+        throw std::runtime_error("Waiting for file events failed: " + std::string(std::strerror(errno)));
+    if (ready <= 0)
+        return true;
+
+    bool complete = true;
+    if (m_Backend == Backend::INOTIFY)
+        ReadInotify(events, complete);
+    else
+        ReadFanotify(events, complete);
+    return complete;
+}
+
+void ChangeWatcher::ReadInotify(std::vector<Event> &events, bool &complete)
+{
+    while (true) {
+        ssize_t bytes = read(m_Fd, m_Buffer.data(), m_Buffer.size());
+        if (bytes <= 0) {
+            if (bytes < 0 && errno != EAGAIN && errno != EINTR)
+                throw std::runtime_error("Reading inotify events failed: " + std::string(std::strerror(errno)));
+            return;
+        }
+
+        for (ssize_t offset = 0; offset < bytes;) {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(m_Buffer.data() + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                complete = false;
+                continue;
+            }
+            auto it = m_Directories.find(event->wd);
+            if (it == m_Directories.end())
+                continue;
+            // Deleted or on an unmounted file system
+            if (event->mask & IN_IGNORED) {
+                m_Watches.erase(it->second);
+                m_Directories.erase(it);
+                continue;
+            }
+            if (event->len == 0)
+                continue;
+
+            events.push_back({JoinPath(it->second, event->name), (event->mask & IN_ISDIR) != 0,
+                    (event->mask & INOTIFY_ENTRY) != 0});
+        }
+    }
+}
+
+void ChangeWatcher::ReadFanotify(std::vector<Event> &events, bool &complete)
+{
+    while (true) {
+        ssize_t bytes = read(m_Fd, m_Buffer.data(), m_Buffer.size());
+        if (bytes <= 0) {
+            if (bytes < 0 && errno != EAGAIN && errno != EINTR)
+                throw std::runtime_error("Reading fanotify events failed: " + std::string(std::strerror(errno)));
+            return;
+        }
+
+        const fanotify_event_metadata *event = reinterpret_cast<const fanotify_event_metadata *>(m_Buffer.data());
+        for (; FAN_EVENT_OK(event, bytes); event = FAN_EVENT_NEXT(event, bytes)) {
+            if (event->vers != FANOTIFY_METADATA_VERSION)
+                throw std::runtime_error("Unsupported fanotify event version " + std::to_string(event->vers));
+            if (event->fd >= 0)
+                close(event->fd);
+            if (event->mask & FAN_Q_OVERFLOW) {
+                complete = false;
+                continue;
+            }
+
+            bool directory = (event->mask & FAN_ONDIR) != 0;
+            bool entry = (event->mask & FANOTIFY_ENTRY) != 0;
+            const char *info = reinterpret_cast<const char *>(event) + event->metadata_len;
+            const char *end = reinterpret_cast<const char *>(event) + event->event_len;
+            while (info < end) {
+                const fanotify_event_info_header *header = reinterpret_cast<const fanotify_event_info_header *>(info);
+                if (header->len == 0)
+                    break;
+                info += header->len;
+                if (header->info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+                    continue;
+
+                const fanotify_event_info_fid *fid = reinterpret_cast<const fanotify_event_info_fid *>(header);
+                const file_handle *handle = reinterpret_cast<const file_handle *>(fid->handle);
+                const char *name = reinterpret_cast<const char *>(handle->f_handle) + handle->handle_bytes;
+                if (std::strcmp(name, ".") == 0)
+                    continue;
+
+                uint64_t fsid;
+                std::memcpy(&fsid, &fid->fsid, sizeof(fsid));
+                const std::string *watched = ResolveHandle(fsid, handle);
+                if (watched)
+                    events.push_back({JoinPath(*watched, name), directory, entry});
+            }
+
+            // Resolved handles of the directory and the ones under it are stale
+            if (directory && entry)
+                m_Handles.clear();
+        }
+    }
+}
+
+const std::string *ChangeWatcher::ResolveHandle(uint64_t fsid, const void *handle)
+{
+    const file_handle *fh = static_cast<const file_handle *>(handle);
+    std::string key(reinterpret_cast<const char *>(&fsid), sizeof(fsid));
+    key.append(reinterpret_cast<const char *>(&fh->handle_type), sizeof(fh->handle_type));
+    key.append(reinterpret_cast<const char *>(fh->f_handle), fh->handle_bytes);
+
+    auto cached = m_Handles.find(key);
+    if (cached == m_Handles.end()) {
+        auto fs = std::find_if(m_FileSystems.begin(), m_FileSystems.end(),
+                [fsid](const FileSystem &fs) { return fs.fsid == fsid; });
+        if (fs == m_FileSystems.end())
+            return nullptr;
+
+        // Fails when the directory was deleted since
+        int fd = open_by_handle_at(fs->fd, const_cast<file_handle *>(fh), O_PATH | O_CLOEXEC);
+        if (fd < 0)
+            return nullptr;
+        char path[PATH_MAX];
+        ssize_t length = readlink(("/proc/self/fd/" + std::to_string(fd)).c_str(), path, sizeof(path));
+        close(fd);
+        if (length <= 0)
+            return nullptr;
+
+        if (m_Handles.size() >= MAX_HANDLES)
+            m_Handles.clear();
+        cached = m_Handles.emplace(std::move(key), std::string(path, length)).first;
+    }
+
+    auto it = m_Resolved.find(cached->second);
+    return it == m_Resolved.end() ? nullptr : &it->second;
+}
+
+#else
+
+// Without kernel events, Monitor polls every period
+
+ChangeWatcher::ChangeWatcher(Backend backend) : m_Backend(backend)
+{
+    throw std::runtime_error("File events are only supported on Linux");
+}
+
+ChangeWatcher::~ChangeWatcher()
+{
+}
+
+size_t ChangeWatcher::Watch(const std::vector<std::string> &directories)
+{
+    return directories.size();
+}
+
+bool ChangeWatcher::Read(int timeout, std::vector<Event> &events)
+{
+    (void)timeout; (void)events;
+    return true;
+}
+
+void ChangeWatcher::ReadInotify(std::vector<Event> &events, bool &complete)
+{
+    (void)events; (void)complete;
+}
+
+void ChangeWatcher::ReadFanotify(std::vector<Event> &events, bool &complete)
+{
+    (void)events; (void)complete;
+}
+
+const std::string *ChangeWatcher::ResolveHandle(uint64_t fsid, const void *handle)
+{
+    (void)fsid; (void)handle;
+    return nullptr;
+}
+
+#endif
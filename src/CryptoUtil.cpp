@@ -1,7 +1,13 @@
 #include <CryptoUtil.hpp>
+#include <FileReader.hpp>
 #include <Log.hpp>
+#include <SimdSearch.hpp>
+#include <StatCache.hpp>
+#include <StructuredDigest.hpp>
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <openssl/evp.h>
 #include <iomanip>
 #include <iostream>
@@ -47,108 +53,774 @@ static std::string bytesToHex(const std::vector<unsigned char> &v) {
     return bytesToHex(v.data(), v.size());
 }
 
-std::string SHAFileUtil::SHA_Agnostic(const std::string& path, const EVP_MD* algorithm ,const FilterMap &filters)
+// Destination of a line filtered while it is streamed
+class LineSink {
+    public:
+        virtual ~LineSink() = default;
+
+        virtual void Write(std::string_view data) = 0;
+        // The line is over. Only called on the sinks whose output is kept
+        virtual void EndLine() = 0;
+        // Copy of the sink and of everything after it
+        virtual std::unique_ptr<LineSink> Clone() const = 0;
+};
+
+// Feeds the line to the file's digest. Clones work on a copy of the digest,
+// which replaces the file's one when their line is the one kept
+class DigestSink : public LineSink {
+    public:
+        explicit DigestSink(HashingAlgorithm::Context &digest) : m_Digest(digest) {}
+
+        void Write(std::string_view data) override
+        {
+            Ctx().Update(data);
+        }
+
+        void EndLine() override
+        {
+            // Include newline so the hash matches file structure
+            Ctx().Update("\n", 1);
+            if (m_Copy)
+                m_Digest.CopyFrom(*m_Copy);
+        }
+
+        std::unique_ptr<LineSink> Clone() const override
+        {
+            auto clone = std::make_unique<DigestSink>(m_Digest);
+            clone->m_Copy = Ctx().Clone();
+            return clone;
+        }
+
+    private:
+        HashingAlgorithm::Context &Ctx() const {return m_Copy ? *m_Copy : m_Digest;}
+
+        HashingAlgorithm::Context &m_Digest;
+        std::unique_ptr<HashingAlgorithm::Context> m_Copy;
+};
+
+// FilterSegment::Apply on a line that comes in parts. Bytes are passed on
+// as soon as it is known what happens to them, except for the end of a part
+// that may be the beginning of a marker. After a start marker that is not
+// known until the end marker comes, which removes them, or the line ends,
+// which keeps them. They are passed to a clone of everything downstream
+// instead, which takes over when the line ends first.
+class SegmentStage : public LineSink {
+    public:
+        SegmentStage(const FilterSegment &filter, std::unique_ptr<LineSink> next)
+            : m_Filter(filter), m_Next(std::move(next)) {}
+
+        void Write(std::string_view data) override;
+
+        void EndLine() override
+        {
+            LineSink &out = Out();
+            if (!m_Pending.empty())
+                out.Write(m_Pending);
+            out.EndLine();
+        }
+
+        std::unique_ptr<LineSink> Clone() const override
+        {
+            auto clone = std::make_unique<SegmentStage>(m_Filter, m_Next->Clone());
+            clone->m_Mode = m_Mode;
+            clone->m_Pending = m_Pending;
+            if (m_Kept)
+                clone->m_Kept = m_Kept->Clone();
+            return clone;
+        }
+
+    private:
+        enum class Mode {
+            START,  // Looking for the start marker
+            END,    // Looking for the end marker
+            REST,   // Passing on the rest of the line
+        };
+
+        // Where the bytes before the marker looked for go
+        LineSink &Out() {return m_Mode == Mode::END ? *m_Kept : *m_Next;}
+        const std::string &Marker() const {return m_Mode == Mode::START ? m_Filter.Start() : m_Filter.End();}
+
+        // The start marker was passed on, what follows it may be removed
+        void StartFound()
+        {
+            m_Kept = m_Next->Clone();
+            m_Mode = Mode::END;
+        }
+
+        // The end marker is next, what was between them is removed
+        void EndFound()
+        {
+            m_Kept.reset();
+            m_Mode = m_Filter.RemoveAll() ? Mode::START : Mode::REST;
+        }
+
+        const FilterSegment &m_Filter;
+        Mode m_Mode = Mode::START;
+        // End of the previous part that may be the beginning of the marker,
+        // shorter than the marker
+        std::string m_Pending;
+        std::unique_ptr<LineSink> m_Next;
+        // Clone of m_Next getting the bytes after the start marker
+        std::unique_ptr<LineSink> m_Kept;
+};
+
+void SegmentStage::Write(std::string_view data)
 {
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    if (!ctx)
-        throw std::runtime_error("Failed to create EVP_MD_CTX");
+    while (true) {
+        if (m_Mode == Mode::REST) {
+            if (!data.empty())
+                m_Next->Write(data);
+            return;
+        }
+
+        const std::string &marker = Marker();
+        // Bytes at the end of a part that can be the beginning of a marker
+        size_t keep = marker.empty() ? 0 : marker.size() - 1;
+
+        if (!m_Pending.empty()) {
+            // Marker starting in the pending bytes
+            size_t take = std::min(keep, data.size());
+            std::string window = m_Pending + std::string(data.substr(0, take));
+            size_t found = SimdSearch::Find(window, marker);
+
+            if (found != std::string::npos && found < m_Pending.size()) {
+                size_t pending = m_Pending.size();
+                m_Pending.clear();
+                if (m_Mode == Mode::START) {
+                    m_Next->Write(std::string_view(window).substr(0, found + marker.size()));
+                    StartFound();
+                    data = data.substr(found + marker.size() - pending);
+                } else {
+                    if (found > 0)
+                        m_Kept->Write(std::string_view(window).substr(0, found));
+                    EndFound();
+                    // The end marker is not removed, the rest goes through
+                    // the new mode
+                    Write(std::string_view(window).substr(found));
+                    data = data.substr(take);
+                }
+                continue;
+            }
 
-    if (EVP_DigestInit_ex(ctx, algorithm, nullptr) != 1) {
-        EVP_MD_CTX_free(ctx);
-        throw std::runtime_error("Digest initialization failed");
+            if (take < keep) {
+                // Too little data to tell, it all waits for the next part
+                m_Pending = window.substr(window.size() - std::min(keep, window.size()));
+                if (window.size() > m_Pending.size())
+                    Out().Write(std::string_view(window).substr(0, window.size() - m_Pending.size()));
+                return;
+            }
+
+            Out().Write(m_Pending);
+            m_Pending.clear();
+        }
+
+        size_t found = SimdSearch::Find(data, marker);
+        if (found == std::string::npos) {
+            size_t pending = std::min(keep, data.size());
+            if (data.size() > pending)
+                Out().Write(data.substr(0, data.size() - pending));
+            m_Pending = data.substr(data.size() - pending);
+            return;
+        }
+
+        if (m_Mode == Mode::START) {
+            m_Next->Write(data.substr(0, found + marker.size()));
+            StartFound();
+            data = data.substr(found + marker.size());
+        } else {
+            if (found > 0)
+                m_Kept->Write(data.substr(0, found));
+            EndFound();
+            data = data.substr(found);
+        }
     }
+}
+
+// Markers of a patterns filter on a line that comes in parts. The automata
+// carry their state from one part to the next, so unlike SegmentStage no
+// bytes are held back. Bytes after a start marker go to a clone of what is
+// downstream until the end marker is found, as in SegmentStage
+class PatternStage : public LineSink {
+    public:
+        PatternStage(const FilterPatterns &filter, std::unique_ptr<LineSink> next)
+            : m_Filter(filter), m_Next(std::move(next)) {}
 
-    std::ifstream file(path, std::ios::binary);
-    if (!file)
-        throw std::runtime_error("Failed to open file: " + path);
+        void Write(std::string_view data) override;
+
+        void EndLine() override
+        {
+            (m_Kept ? *m_Kept : *m_Next).EndLine();
+        }
+
+        std::unique_ptr<LineSink> Clone() const override
+        {
+            auto clone = std::make_unique<PatternStage>(m_Filter, m_Next->Clone());
+            clone->m_State = m_State;
+            clone->m_Pair = m_Pair;
+            if (m_Kept)
+                clone->m_Kept = m_Kept->Clone();
+            return clone;
+        }
+
+    private:
+        const FilterPatterns &m_Filter;
+        AhoCorasick::State m_State = AhoCorasick::ROOT;
+        // Pair whose end marker is looked for, when m_Kept is set
+        int32_t m_Pair = 0;
+        std::unique_ptr<LineSink> m_Next;
+        // Clone of m_Next getting the bytes after the start marker
+        std::unique_ptr<LineSink> m_Kept;
+};
+
+void PatternStage::Write(std::string_view data)
+{
+    while (!data.empty()) {
+        if (!m_Kept) {
+            size_t found = m_Filter.Starts().Find(data, m_State, m_Pair);
+            if (found == std::string_view::npos) {
+                m_Next->Write(data);
+                return;
+            }
+            m_Next->Write(data.substr(0, found));
+            m_Kept = m_Next->Clone();
+            m_State = AhoCorasick::ROOT;
+            data = data.substr(found);
+            continue;
+        }
+
+        int32_t index;
+        size_t found = m_Filter.Ends()[m_Pair].Find(data, m_State, index);
+        if (found == std::string_view::npos) {
+            m_Kept->Write(data);
+            return;
+        }
+        m_Kept.reset();
+        m_State = AhoCorasick::ROOT;
+        data = data.substr(found);
+        // The end marker is kept, and looked at for start markers
+        Write(m_Filter.MarkerPairs()[m_Pair].second);
+    }
+}
+
+static size_t s_MaxLineSize = 1024 * 1024;
+
+void FileDigest::SetMaxLineSize(size_t bytes)
+{
+    s_MaxLineSize = bytes;
+}
+
+FileDigest::FileDigest(HashingAlgorithm::Context &ctx, const std::string &path, const FilterMap &filters)
+    : m_Ctx(ctx), m_Plan(nullptr)
+{
+    m_Ctx.Init();
 
-    uint64_t lineNumber = 0;
-    std::string line;
     auto it = filters.find(path);
-    // just for logging purposes
-    if (it != filters.end()) 
+    if (it != filters.end()) {
+        // just for logging purposes
         logging::info("Filter for " + path + " found, skiping filtered lines");
+        const FilterKeys *keys = it->second.Keys();
+        if (it->second.Bytes()) {
+            m_Binary = true;
+        } else if (keys) {
+            if (keys->DocumentFormat() != FilterKeys::Format::JSON)
+                throw std::invalid_argument("YAML files with keys filters have to be read by YamlDigest: " + path);
+            m_Json = std::make_unique<JsonDigest>(m_Ctx, path, *keys);
+        } else {
+            m_Normalize = it->second.Normalize();
+            if (m_Normalize && m_Normalize->Bom())
+                m_BomBytes = 0;
+            // Files that are only normalized are digested as unfiltered ones
+            if (it->second.SplitsLines()) {
+                m_Plan = &it->second;
+                m_LinesCursor.emplace(m_Plan->Lines());
+                for (const FilterPlugin &plugin : m_Plan->Plugins())
+                    m_Sessions.emplace_back(plugin);
+                m_Path = path;
+                m_MaxLine = s_MaxLineSize;
+                if (m_Plan->Patterns() && m_Plan->Patterns()->HasRegexes())
+                    m_MaxLine = std::min(m_MaxLine, FilterPatterns::MAX_REGEX_LINE);
+            }
+        }
+    }
+}
 
-    while (std::getline(file, line)) {
-        ++lineNumber;
+FileDigest::~FileDigest() = default;
 
-        if (it != filters.end()) {
-            const std::vector<std::unique_ptr<Filter>>& filterVec = it->second;
-    
-            bool skipLine = false;
+void FileDigest::Update(std::string_view chunk)
+{
+    if (chunk.empty())
+        return;
 
-            for (const auto& f : filterVec) {
-                if (auto* linesFilter = dynamic_cast<FilterLines*>(f.get())) {
-                    // Skip this line if it needs to be skipped
-                    skipLine = linesFilter->Contains(lineNumber);
-                }
-                else if (auto* segFilter = dynamic_cast<FilterSegment*>(f.get())) {
-                    if (lineNumber != segFilter->Line())
-                        continue;
-                    // Remove the not needed parts of the line
-                    line = segFilter->Apply(line);
-                } else {
-                    throw std::runtime_error("Failed to dynamically cast Filter object");
-                }
+    if (m_Json) {
+        m_Json->Update(chunk);
+        return;
+    }
+
+    if (m_Normalize) {
+        Normalize(chunk);
+        return;
+    }
+
+    Digest(chunk);
+}
+
+void FileDigest::Digest(std::string_view chunk)
+{
+    if (m_Plan) {
+        UpdateLines(chunk);
+        return;
+    }
+
+    // Files without filters are hashed chunk by chunk. The digest is the same
+    // as the one the line path produces: every line gets a '\n' appended, so
+    // the only difference from the raw file contents is the newline added to
+    // a last line that does not end with one. Final takes care of that.
+    // Normalized files come in parts between blanks, which are gathered
+    // into large buffers. BLAKE3 only hashes many chunks at a time in large
+    // updates, copying costs less than updates of a line or a few each
+    if (m_Normalize)
+        DigestPart(chunk, LARGE_PARTS_BUFFER);
+    else
+        m_Ctx.Update(chunk);
+    m_Last = chunk.back();
+}
+
+// Strips the byte order mark and the blanks at the end of every line. The
+// chunk is not copied: newlines following a blank are found with
+// SimdSearch::FindBlankNewlines and the parts between the blanks are
+// digested where they are. Only blanks at the end of the chunk are kept,
+// until it is known whether their line ends after them
+void FileDigest::Normalize(std::string_view chunk)
+{
+    if (m_BomBytes < BOM.size()) {
+        while (m_BomBytes < BOM.size() && !chunk.empty() && chunk[0] == BOM[m_BomBytes]) {
+            m_BomBytes++;
+            chunk.remove_prefix(1);
+        }
+        if (chunk.empty())
+            return;
+        if (m_BomBytes < BOM.size()) {
+            // Not a byte order mark after all
+            if (m_BomBytes > 0)
+                Digest(BOM.substr(0, m_BomBytes));
+            m_BomBytes = BOM.size();
+        }
+    }
+
+    const bool spaces = m_Normalize->Whitespace();
+    size_t start = 0;
+
+    if (!m_Blanks.empty()) {
+        size_t blanks = 0;
+        while (blanks < chunk.size() && SimdSearch::IsBlank(chunk[blanks], spaces))
+            blanks++;
+        if (blanks == chunk.size()) {
+            m_Blanks.append(chunk);
+            return;
+        }
+        if (chunk[blanks] == '\n') {
+            start = blanks;
+        } else {
+            Digest(m_Blanks);
+        }
+        m_Blanks.clear();
+    }
+
+    size_t newlines[256];
+    size_t count = std::size(newlines);
+    for (size_t pos = start; count == std::size(newlines); pos = start + 1) {
+        count = SimdSearch::FindBlankNewlines(chunk, pos, spaces, newlines, std::size(newlines));
+        for (size_t i = 0; i < count; i++) {
+            size_t blanks = newlines[i];
+            while (blanks > start && SimdSearch::IsBlank(chunk[blanks - 1], spaces))
+                blanks--;
+            if (blanks > start)
+                Digest(chunk.substr(start, blanks - start));
+            // The newline goes with the next part
+            start = newlines[i];
+        }
+    }
+
+    size_t end = chunk.size();
+    while (end > start && SimdSearch::IsBlank(chunk[end - 1], spaces))
+        end--;
+    if (end > start)
+        Digest(chunk.substr(start, end - start));
+    m_Blanks.assign(chunk.substr(end));
+}
+
+// Splits the chunk into lines. Lines no filter applies to are not looked at
+// one by one: the newlines of a run of them are counted with SimdSearch and
+// the run is digested in one update, newlines included. Only lines with
+// segment filters and lines crossing a chunk boundary go through DigestLine,
+// and only the latter are copied.
+void FileDigest::UpdateLines(std::string_view chunk)
+{
+    size_t pos = 0;
+
+    // Line started in one of the previous chunks
+    if (m_Partial != Partial::NONE) {
+        const char *nl = static_cast<const char *>(std::memchr(chunk.data(), '\n', chunk.size()));
+        if (!nl) {
+            ContinueLine(chunk, false);
+            return;
+        }
+
+        pos = static_cast<size_t>(nl - chunk.data());
+        ContinueLine(chunk.substr(0, pos), true);
+        pos++;
+    }
+
+    while (pos < chunk.size()) {
+        std::string_view rest = chunk.substr(pos);
+        bool skip = false;
+        uint64_t lines = RunLength(m_LineNumber + 1, skip);
+
+        if (lines == 0) {
+            // The line has segment or patterns filters
+            const char *nl = static_cast<const char *>(std::memchr(rest.data(), '\n', rest.size()));
+            if (!nl) {
+                m_Partial = Partial::CARRY;
+                ContinueLine(rest, false);
+                return;
             }
+            size_t end = static_cast<size_t>(nl - rest.data());
+            DigestLine(rest.substr(0, end));
+            pos += end + 1;
+            continue;
+        }
 
-            // Skips the current line and restarts the outer while loop
-            if (skipLine)
-                continue;
+        size_t end = 0;
+        uint64_t found = SimdSearch::SkipLines(rest, lines, end);
+        if (!skip && end > 0)
+            m_Ctx.Update(rest.substr(0, end));
+        m_LineNumber += found;
+        pos += end;
+
+        // The chunk ends in the middle of the run
+        if (found < lines) {
+            if (pos < chunk.size()) {
+                m_Partial = skip ? Partial::SKIPPED : Partial::PLAIN;
+                ContinueLine(chunk.substr(pos), false);
+            }
+            return;
         }
+    }
+}
+
+void FileDigest::ContinueLine(std::string_view part, bool ends)
+{
+    switch (m_Partial) {
+        case Partial::PLAIN:
+            m_Ctx.Update(part);
+            if (ends) {
+                m_Ctx.Update("\n", 1);
+                ++m_LineNumber;
+            }
+            break;
+
+        case Partial::SKIPPED:
+            if (ends)
+                ++m_LineNumber;
+            break;
+
+        case Partial::CARRY:
+            m_Carry.append(part);
+            if (ends) {
+                DigestLine(m_Carry);
+                m_Carry.clear();
+            } else if (m_Carry.size() > m_MaxLine) {
+                // Filtered from here on while it streams through a stage
+                // per filter, in the order they apply
+                m_Stream = LineStream(m_LineNumber + 1);
+                m_Stream->Write(m_Carry);
+                m_Carry.clear();
+                m_Carry.shrink_to_fit();
+                m_Partial = Partial::STREAM;
+            }
+            break;
+
+        case Partial::STREAM:
+            m_Stream->Write(part);
+            if (ends) {
+                m_Stream->EndLine();
+                m_Stream.reset();
+                ++m_LineNumber;
+            }
+            break;
 
-        // Include newline so the hash matches file structure
-        line.push_back('\n');
-        EVP_DigestUpdate(ctx, line.data(), line.size());
+        case Partial::NONE:
+            break;
     }
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int hash_len = 0;
 
-    if (EVP_DigestFinal_ex(ctx, hash, &hash_len) != 1) {
-        EVP_MD_CTX_free(ctx);
-        throw std::runtime_error("Digest finalization failed");
+    if (ends)
+        m_Partial = Partial::NONE;
+}
+
+// Number of lines from line on that are all skipped (skip is set) or all
+// digested as they are. 0 when line itself has segment filters
+uint64_t FileDigest::RunLength(uint64_t line, bool &skip)
+{
+    const FilterLines::Interval *interval = m_LinesCursor->Next(line);
+    if (interval && interval->first <= line) {
+        skip = true;
+        return interval->second - line + 1;
     }
 
-    EVP_MD_CTX_free(ctx);
+    const std::vector<FilterSegment> &segments = m_Plan->Segments();
+    while (m_NextSegment < segments.size() && segments[m_NextSegment].Line() < line)
+        m_NextSegment++;
 
-    std::ostringstream oss;
-    for (unsigned int i = 0; i < hash_len; ++i)
-        oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
+    skip = false;
+    // Patterns and plugin filters apply to every line
+    if (m_Plan->Patterns() || !m_Sessions.empty())
+        return 0;
 
-    return oss.str();
+    uint64_t next = interval ? interval->first : UINT64_MAX;
+    if (m_NextSegment < segments.size())
+        next = std::min(next, segments[m_NextSegment].Line());
+    return next - line;
+}
+
+std::unique_ptr<LineSink> FileDigest::LineStream(uint64_t line)
+{
+    if (!m_WarnedLongLine && ((m_Plan->Patterns() && m_Plan->Patterns()->HasRegexes()) || !m_Sessions.empty())) {
+        logging::warn("[FileDigest] Line " + std::to_string(line) + " of " + m_Path + " is longer than " +
+                std::to_string(m_MaxLine / 1024) + " kB, its regexes and plugins are not applied to it and to "
+                "lines as long after it. It shows up as a change when they removed anything from it before");
+        m_WarnedLongLine = true;
+    }
+
+    // Plugins gather the parts of several lines, they go first
+    FlushParts();
+
+    size_t first, last;
+    LineSegments(line, first, last);
+    std::unique_ptr<LineSink> stream = std::make_unique<DigestSink>(m_Ctx);
+    if (m_Plan->Patterns())
+        stream = std::make_unique<PatternStage>(*m_Plan->Patterns(), std::move(stream));
+    for (size_t i = last; i > first; i--)
+        stream = std::make_unique<SegmentStage>(m_Plan->Segments()[i - 1], std::move(stream));
+    return stream;
+}
+
+// A line of a chunk that is too long to be filtered whole, its number is m_LineNumber
+void FileDigest::StreamLine(std::string_view line)
+{
+    std::unique_ptr<LineSink> stream = LineStream(m_LineNumber);
+    stream->Write(line);
+    stream->EndLine();
+}
+
+// Applies the filters to a single line and digests what is left of it
+void FileDigest::DigestLine(std::string_view line)
+{
+    ++m_LineNumber;
+
+    // Skip this line if it needs to be skipped
+    if (m_LinesCursor->Contains(m_LineNumber))
+        return;
+    if (line.size() > m_MaxLine) {
+        StreamLine(line);
+        return;
+    }
+
+    const std::vector<FilterSegment> &segments = m_Plan->Segments();
+    size_t first, last;
+    LineSegments(m_LineNumber, first, last);
+
+    // Remove the not needed parts of the line. Every filter works on what
+    // the previous one left, the last one feeds the digest with the parts
+    // it keeps. Patterns filters come after the segment filters
+    const FilterPatterns *patterns = m_Plan->Patterns();
+    size_t buffered = patterns ? last : last - std::min<size_t>(last - first, 1);
+    for (size_t i = first; i < buffered; i++) {
+        std::string &modified = m_Segmented[i % 2];
+        modified.clear();
+        segments[i].Apply(line, modified);
+        line = modified;
+    }
+    auto digest = [this](std::string_view part) { DigestPart(part); };
+    if (!m_Sessions.empty()) {
+        // The plugins get the line in one piece, copied only when another
+        // filter changed it
+        if (patterns || first != last) {
+            m_Plugged[0].clear();
+            auto collect = [this](std::string_view part) { m_Plugged[0].append(part); };
+            if (patterns)
+                patterns->Apply(line, m_Patterned, collect);
+            else
+                segments[last - 1].Apply(line, collect);
+            line = m_Plugged[0];
+        }
+        // Every line of the file goes through the plugins, the parts of
+        // several lines are gathered into one update. Final flushes the last
+        ApplyPlugins(line);
+        DigestPart("\n", LARGE_PARTS_BUFFER);
+        return;
+    } else if (patterns) {
+        patterns->Apply(line, m_Patterned, digest);
+        FlushParts();
+    } else if (first == last) {
+        m_Ctx.Update(line);
+    } else {
+        segments[last - 1].Apply(line, digest);
+        FlushParts();
+    }
+
+    // Include newline so the hash matches file structure
+    m_Ctx.Update("\n", 1);
 }
 
-std::string SHAFileUtil::SHA256(const std::string& input ,const FilterMap &filters)
+// Every plugin filters what the one before it kept, the spans the last one
+// keeps are digested where they are
+void FileDigest::ApplyPlugins(std::string_view line)
 {
-    logging::info("Running sha256 calculation");
-    return SHAFileUtil::SHA_Agnostic(input, EVP_sha256(), filters);
+    for (size_t i = 0; i < m_Sessions.size(); i++) {
+        std::span<const monitor_filter_span> kept = m_Sessions[i].Apply(line, m_LineNumber);
+        if (i + 1 == m_Sessions.size()) {
+            for (const monitor_filter_span &span : kept)
+                DigestPart(line.substr(span.offset, span.length), LARGE_PARTS_BUFFER);
+            return;
+        }
+
+        std::string &next = m_Plugged[(i + 1) % 2];
+        next.clear();
+        for (const monitor_filter_span &span : kept)
+            next.append(line.substr(span.offset, span.length));
+        line = next;
+    }
+}
+
+void FileDigest::LineSegments(uint64_t line, size_t &first, size_t &last)
+{
+    const std::vector<FilterSegment> &segments = m_Plan->Segments();
+    while (m_NextSegment < segments.size() && segments[m_NextSegment].Line() < line)
+        m_NextSegment++;
+    first = m_NextSegment;
+    last = first;
+    while (last < segments.size() && segments[last].Line() == line)
+        last++;
+}
+
+// Every digest update has a fixed cost, parts too small to be worth it are
+// gathered and digested together
+void FileDigest::DigestPart(std::string_view part, size_t small)
+{
+    if (part.size() >= small) {
+        FlushParts();
+        m_Ctx.Update(part);
+        return;
+    }
+
+    m_Parts.append(part);
+    if (m_Parts.size() >= std::max(small, PARTS_BUFFER))
+        FlushParts();
 }
 
-std::string SHAFileUtil::SHA512(const std::string& input ,const FilterMap &filters)
+void FileDigest::FlushParts()
 {
-    logging::info("Running sha512 calculation");
-    return SHAFileUtil::SHA_Agnostic(input, EVP_sha512(), filters);
+    if (m_Parts.empty())
+        return;
+    m_Ctx.Update(m_Parts);
+    m_Parts.clear();
 }
-std::string SHAFileUtil::Blake2s256(const std::string &input ,const FilterMap &filters)
+
+std::string FileDigest::Final()
 {
-    logging::info("Running blake2s256 calculation");
-    return SHAFileUtil::SHA_Agnostic(input, EVP_sha512(), filters);
+    if (m_Json) {
+        m_Json->Finish();
+        return m_Ctx.Final();
+    }
+
+    // The file ended in the middle of what looked like a byte order mark.
+    // Blanks at the end of the file are dropped
+    if (m_BomBytes > 0 && m_BomBytes < BOM.size())
+        Digest(BOM.substr(0, m_BomBytes));
+
+    if (m_Plan) {
+        // Last line without the terminating newline
+        if (m_Partial != Partial::NONE)
+            ContinueLine({}, true);
+        FlushParts();
+    } else {
+        FlushParts();
+        if (m_Last != '\n' && !m_Binary)
+            m_Ctx.Update("\n", 1);
+    }
+
+    return m_Ctx.Final();
 }
-std::string SHAFileUtil::Blake2s512(const std::string &input ,const FilterMap &filters)
+
+std::string SHAFileUtil::SHA_Agnostic(const std::string& path, HashingAlgorithm::Context &ctx, const FilterMap &filters)
 {
-    logging::info("Running blake2s512 calculation");
-    return SHAFileUtil::SHA_Agnostic(input, EVP_blake2b512(), filters);
+    auto it = filters.find(path);
+    if (it != filters.end() && it->second.Keys() && it->second.Keys()->DocumentFormat() == FilterKeys::Format::YAML)
+        return YamlDigest(path, ctx, *it->second.Keys());
+
+    FileDigest digest(ctx, path, filters);
+    std::string_view chunk;
+
+    // Only the kept parts of files with bytes filters are read
+    if (it != filters.end() && it->second.Bytes()) {
+        FileStat stat;
+        if (!FileStat::Read(path, stat))
+            throw std::runtime_error("Failed to stat file: " + path);
+
+        for (const auto &[start, end] : it->second.Bytes()->Kept(stat.size)) {
+            std::unique_ptr<FileReader> reader = FileReader::OpenRange(path, start, end - start);
+            while (reader->Next(chunk))
+                digest.Update(chunk);
+        }
+        return digest.Final();
+    }
+
+    std::unique_ptr<FileReader> reader = FileReader::Open(path);
+    while (reader->Next(chunk))
+        digest.Update(chunk);
+
+    return digest.Final();
 }
-std::string SHAFileUtil::SHA3_256(const std::string& input ,const FilterMap &filters)
+
+std::string SHAFileUtil::MerkleLeaf(const std::string &path, uint64_t offset, uint64_t length, HashingAlgorithm::Context &ctx)
 {
-    logging::info("Running sha256 calculation");
-    return SHAFileUtil::SHA_Agnostic(input, EVP_sha3_256(), filters);
+    const unsigned char prefix = 0x00;
+    ctx.Init();
+    ctx.Update(&prefix, 1);
+
+    std::unique_ptr<FileReader> reader = FileReader::OpenRange(path, offset, length);
+    std::string_view chunk;
+    while (reader->Next(chunk))
+        ctx.Update(chunk);
+
+    return ctx.Final();
 }
 
-std::string SHAFileUtil::SHA3_512(const std::string& input ,const FilterMap &filters)
+std::string SHAFileUtil::MerkleRoot(const std::vector<std::string> &leaves, HashingAlgorithm::Context &ctx)
 {
-    logging::info("Running sha512 calculation");
-    return SHAFileUtil::SHA_Agnostic(input, EVP_sha3_512(), filters);
+    if (leaves.empty())
+        throw std::invalid_argument("Merkle tree needs at least one leaf");
+
+    std::vector<std::vector<unsigned char>> level;
+    for (const std::string &leaf : leaves)
+        level.push_back(hexStringToBytes(leaf));
+
+    const unsigned char prefix = 0x01;
+    while (level.size() > 1) {
+        std::vector<std::vector<unsigned char>> next;
+        for (size_t i = 0; i + 1 < level.size(); i += 2) {
+            ctx.Init();
+            ctx.Update(&prefix, 1);
+            ctx.Update(level[i].data(), level[i].size());
+            ctx.Update(level[i + 1].data(), level[i + 1].size());
+            next.push_back(hexStringToBytes(ctx.Final()));
+        }
+        if (level.size() % 2 == 1)
+            next.push_back(std::move(level.back()));
+        level = std::move(next);
+    }
+
+    return bytesToHex(level[0]);
 }
 
 std::string PBKDF2Util::ToHex(const unsigned char* data, size_t len)
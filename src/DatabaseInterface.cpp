@@ -20,6 +20,9 @@ static std::map<std::string, std::string> Run(ModuleManager &mm, py::dict &args)
 
 std::map<std::string, std::string> DatabaseInterface::Query(ModuleManager &mm, Action action) 
 {
+    // Queries are made from the scan workers
+    py::gil_scoped_acquire gil;
+
     if (action != DBAction::DELETEALL) {
         throw std::invalid_argument("Invalid query arguments");
     }
@@ -32,12 +35,16 @@ std::map<std::string, std::string> DatabaseInterface::Query(ModuleManager &mm, A
 
 std::map<std::string, std::string> DatabaseInterface::Query(ModuleManager &mm, Action action, const std::string &file)
 {
-    if (action != DBAction::SELECT && action != DBAction::DELETEONE) {
+    py::gil_scoped_acquire gil;
+
+    if (action != DBAction::SELECT && action != DBAction::DELETEONE && action != DBAction::SELECTLEAVES) {
         throw std::invalid_argument("Invalid query arguments");
     }
     py::dict runArgs;
     if (action == DBAction::SELECT)
         runArgs[py::str("action")] = py::str("select");
+    else if (action == DBAction::SELECTLEAVES)
+        runArgs[py::str("action")] = py::str("select_leaves");
     else
         runArgs[py::str("action")] = py::str("delete_one");
     
@@ -48,14 +55,22 @@ std::map<std::string, std::string> DatabaseInterface::Query(ModuleManager &mm, A
 
 std::map<std::string, std::string> DatabaseInterface::Query(ModuleManager &mm, Action action, const std::string &file, const std::string &hash)
 {
-    if (action != DBAction::INSERT) {
+    py::gil_scoped_acquire gil;
+
+    if (action != DBAction::INSERT && action != DBAction::INSERTLEAVES) {
         throw std::invalid_argument("Invalid query arguments");
     }
 
     py::dict runArgs;
-    runArgs[py::str("action")] = py::str("insert");
     runArgs[py::str("file")] = py::str(file);
-    runArgs[py::str("hash")] = py::str(hash);
+    if (action == DBAction::INSERT) {
+        runArgs[py::str("action")] = py::str("insert");
+        runArgs[py::str("hash")] = py::str(hash);
+    } else {
+        // hash holds the encoded leaves
+        runArgs[py::str("action")] = py::str("insert_leaves");
+        runArgs[py::str("leaves")] = py::str(hash);
+    }
 
     return Run(mm, runArgs);
 }
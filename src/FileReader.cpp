@@ -0,0 +1,269 @@
+#include <FileReader.hpp>
+#include <Log.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+FileReader::Mode FileReader::s_Mode = FileReader::Mode::STREAM;
+size_t FileReader::s_BufferSize = 1024 * 1024;
+size_t FileReader::s_WindowSize = 64 * 1024 * 1024;
+
+#ifndef _WIN32
+// Reading a page of a mapping past the end of a file that was truncated
+// after it was mapped raises SIGBUS. The mappings of the mmap readers are
+// registered here, wherever they are read from, and the handler maps zeros
+// over the faulting page of a registered mapping, so the read goes on and
+// the reader reports the truncation once it is asked for the next chunk.
+// SIGBUS of any other address goes to the handler that was installed before
+namespace {
+    struct MappingGuard {
+        std::atomic<uintptr_t> begin {0};
+        std::atomic<uintptr_t> end {0};
+        std::atomic<bool> used {false};
+        std::atomic<bool> truncated {false};
+    };
+
+    // More readers than this at once are read as a stream
+    constexpr size_t MAX_MAPPINGS = 256;
+    MappingGuard s_Guards[MAX_MAPPINGS];
+    struct sigaction s_PreviousSigbus;
+    uintptr_t s_PageSize = 4096;
+
+    void OnSigbus(int sig, siginfo_t *info, void *context)
+    {
+        uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+        for (MappingGuard &guard : s_Guards) {
+            uintptr_t begin = guard.begin.load(std::memory_order_acquire);
+            if (begin == 0 || address < begin || address >= guard.end.load(std::memory_order_acquire))
+                continue;
+
+            void *page = reinterpret_cast<void *>(address - address % s_PageSize);
+            if (mmap(page, s_PageSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+                break;
+            guard.truncated.store(true, std::memory_order_release);
+            return;
+        }
+
+        if (s_PreviousSigbus.sa_flags & SA_SIGINFO) {
+            s_PreviousSigbus.sa_sigaction(sig, info, context);
+            return;
+        }
+        if (s_PreviousSigbus.sa_handler != SIG_DFL && s_PreviousSigbus.sa_handler != SIG_IGN) {
+            s_PreviousSigbus.sa_handler(sig);
+            return;
+        }
+        // The access faults again and the default action ends the process
+        signal(SIGBUS, SIG_DFL);
+    }
+
+    void InstallSigbusHandler()
+    {
+        static std::once_flag installed;
+        std::call_once(installed, [] {
+            s_PageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+            struct sigaction action {};
+            action.sa_sigaction = OnSigbus;
+            action.sa_flags = SA_SIGINFO | SA_NODEFER;
+            sigemptyset(&action.sa_mask);
+            if (sigaction(SIGBUS, &action, &s_PreviousSigbus) != 0)
+                throw std::runtime_error("Failed to install the SIGBUS handler of the mmap io");
+        });
+    }
+
+    // nullptr when all guards are taken
+    MappingGuard *AcquireGuard()
+    {
+        for (MappingGuard &guard : s_Guards) {
+            bool used = false;
+            if (guard.used.compare_exchange_strong(used, true)) {
+                guard.truncated.store(false);
+                return &guard;
+            }
+        }
+        return nullptr;
+    }
+}
+#endif
+
+void FileReader::SetMode(Mode mode)
+{
+#ifdef _WIN32
+    if (mode == Mode::MMAP) {
+        logging::warn("[FileReader] mmap mode is not supported on this platform, using stream mode");
+        mode = Mode::STREAM;
+    }
+#else
+    if (mode == Mode::MMAP)
+        InstallSigbusHandler();
+#endif
+    s_Mode = mode;
+}
+
+void FileReader::SetBufferSize(size_t bytes)
+{
+    if (bytes == 0)
+        throw std::invalid_argument("Read buffer size must be > 0");
+    s_BufferSize = bytes;
+}
+
+void FileReader::SetWindowSize(size_t bytes)
+{
+    if (bytes == 0)
+        throw std::invalid_argument("Mapping window size must be > 0");
+    s_WindowSize = bytes;
+}
+
+// Reads the file through std::ifstream into a buffer that is reused between files
+class FileReaderStream : public FileReader {
+    public:
+        FileReaderStream(const std::string &path, size_t bufferSize, uint64_t offset, uint64_t length)
+            : m_File(path, std::ios::binary), m_Remaining(length)
+        {
+            if (!m_File)
+                throw std::runtime_error("Failed to open file: " + path);
+            if (offset > 0 && !m_File.seekg(static_cast<std::streamoff>(offset)))
+                throw std::runtime_error("Failed to seek in file: " + path);
+
+            buffer().resize(bufferSize);
+        }
+
+        bool Next(std::string_view &chunk) override
+        {
+            std::vector<char> &buf = buffer();
+            size_t toRead = static_cast<size_t>(std::min<uint64_t>(buf.size(), m_Remaining));
+
+            if (toRead == 0 || (!m_File.read(buf.data(), toRead) && m_File.gcount() == 0)) {
+                if (m_File.bad())
+                    throw std::runtime_error("Failed to read file");
+                return false;
+            }
+
+            chunk = std::string_view(buf.data(), static_cast<size_t>(m_File.gcount()));
+            m_Remaining -= chunk.size();
+            return true;
+        }
+
+    private:
+        std::ifstream m_File;
+        uint64_t m_Remaining;
+
+        static std::vector<char> &buffer()
+        {
+            thread_local std::vector<char> buf;
+            return buf;
+        }
+};
+
+#ifndef _WIN32
+// Maps the file read-only one window at a time so that address space usage
+// stays bounded for huge files. Data is hashed straight from the page cache
+// without being copied into userspace buffers. The file being truncated
+// while it is read is reported as an error, see OnSigbus
+class FileReaderMmap : public FileReader {
+    public:
+        FileReaderMmap(const std::string &path, int fd, uint64_t offset, uint64_t end, size_t windowSize, MappingGuard *guard)
+            : m_Path(path), m_Fd(fd), m_Offset(offset), m_End(end), m_WindowSize(windowSize), m_Guard(guard)
+        {
+            m_PageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        }
+
+        ~FileReaderMmap() override
+        {
+            Unmap();
+            close(m_Fd);
+            m_Guard->used.store(false, std::memory_order_release);
+        }
+
+        bool Next(std::string_view &chunk) override
+        {
+            Unmap();
+            if (m_Guard->truncated.load(std::memory_order_acquire))
+                throw std::runtime_error("File was truncated while it was read: " + m_Path);
+            if (m_Offset >= m_End)
+                return false;
+
+            // Mappings have to start at a page boundary
+            uint64_t mapStart = m_Offset - m_Offset % m_PageSize;
+            size_t skip = static_cast<size_t>(m_Offset - mapStart);
+            size_t length = static_cast<size_t>(std::min<uint64_t>(m_WindowSize, m_End - m_Offset));
+
+            void *addr = mmap(nullptr, skip + length, PROT_READ, MAP_PRIVATE, m_Fd, static_cast<off_t>(mapStart));
+            if (addr == MAP_FAILED)
+                throw std::runtime_error("Failed to map file");
+
+            m_Map = addr;
+            m_MapLength = skip + length;
+            m_Guard->end.store(reinterpret_cast<uintptr_t>(addr) + m_MapLength, std::memory_order_release);
+            m_Guard->begin.store(reinterpret_cast<uintptr_t>(addr), std::memory_order_release);
+            // Only hints, failure is not a problem
+            madvise(m_Map, m_MapLength, MADV_SEQUENTIAL);
+            madvise(m_Map, m_MapLength, MADV_WILLNEED);
+
+            chunk = std::string_view(static_cast<const char *>(m_Map) + skip, length);
+            m_Offset += length;
+            return true;
+        }
+
+    private:
+        std::string m_Path;
+        int m_Fd;
+        uint64_t m_Offset;
+        uint64_t m_End;
+        size_t m_WindowSize;
+        uint64_t m_PageSize;
+        MappingGuard *m_Guard;
+        void *m_Map = nullptr;
+        size_t m_MapLength = 0;
+
+        void Unmap()
+        {
+            m_Guard->begin.store(0, std::memory_order_release);
+            if (m_Map)
+                munmap(m_Map, m_MapLength);
+            m_Map = nullptr;
+            m_MapLength = 0;
+        }
+};
+#endif
+
+std::unique_ptr<FileReader> FileReader::Open(const std::string &path)
+{
+    return OpenRange(path, 0, UINT64_MAX);
+}
+
+std::unique_ptr<FileReader> FileReader::OpenRange(const std::string &path, uint64_t offset, uint64_t length)
+{
+#ifndef _WIN32
+    if (s_Mode == Mode::MMAP) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open file: " + path);
+
+        struct stat st;
+        // Special files (pipes, ...) can not be mapped, and files of procfs
+        // and sysfs say they are empty while they are not. Read them as a stream
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            if (MappingGuard *guard = AcquireGuard()) {
+                uint64_t size = static_cast<uint64_t>(st.st_size);
+                uint64_t end = length > size - std::min(offset, size) ? size : offset + length;
+                return std::make_unique<FileReaderMmap>(path, fd, std::min(offset, size), end, s_WindowSize, guard);
+            }
+        }
+
+        close(fd);
+    }
+#endif
+    return std::make_unique<FileReaderStream>(path, s_BufferSize, offset, length);
+}
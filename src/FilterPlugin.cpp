@@ -0,0 +1,151 @@
+#include <Filters.hpp>
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+// Handle of a loaded library, closed on destruction
+class PluginLibrary {
+    public:
+        explicit PluginLibrary(const std::string &path)
+        {
+#ifdef _WIN32
+            m_Handle = LoadLibraryA(path.c_str());
+            if (!m_Handle)
+                throw std::runtime_error("Failed to load filter plugin " + path + ": error " + std::to_string(GetLastError()));
+#else
+            m_Handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+            if (!m_Handle)
+                throw std::runtime_error("Failed to load filter plugin " + path + ": " + dlerror());
+#endif
+        }
+
+        ~PluginLibrary()
+        {
+#ifdef _WIN32
+            FreeLibrary(m_Handle);
+#else
+            dlclose(m_Handle);
+#endif
+        }
+
+        PluginLibrary(const PluginLibrary&) = delete;
+        PluginLibrary& operator=(const PluginLibrary&) = delete;
+
+        // nullptr when the library does not export it
+        void *Symbol(const char *name) const
+        {
+#ifdef _WIN32
+            return reinterpret_cast<void *>(GetProcAddress(m_Handle, name));
+#else
+            return dlsym(m_Handle, name);
+#endif
+        }
+
+    private:
+#ifdef _WIN32
+        HMODULE m_Handle;
+#else
+        void *m_Handle;
+#endif
+};
+
+struct FilterPlugin::Instance {
+    // Declared first, it is unloaded after the filter is destroyed
+    PluginLibrary library;
+    const monitor_filter_plugin *plugin = nullptr;
+    void *filter = nullptr;
+    std::string name;
+
+    explicit Instance(const std::string &path) : library(path) {}
+
+    ~Instance()
+    {
+        if (filter)
+            plugin->destroy(filter);
+    }
+};
+
+FilterPlugin::FilterPlugin(const std::string &filename, const std::string &library, const Options &options)
+    : Filter(filename), m_Library(library)
+{
+    auto instance = std::make_shared<Instance>(library);
+
+    auto entry = reinterpret_cast<monitor_filter_entry_fn>(instance->library.Symbol(MONITOR_FILTER_ENTRY));
+    if (!entry)
+        throw std::runtime_error("Filter plugin " + library + " does not export " + MONITOR_FILTER_ENTRY);
+    instance->plugin = entry();
+    const monitor_filter_plugin *plugin = instance->plugin;
+    if (!plugin || plugin->abi_version != MONITOR_FILTER_ABI_VERSION)
+        throw std::runtime_error("Filter plugin " + library + " was built for another ABI version, expected "
+                + std::to_string(MONITOR_FILTER_ABI_VERSION));
+    if (!plugin->create || !plugin->destroy || !plugin->apply || !plugin->begin != !plugin->end)
+        throw std::runtime_error("Filter plugin " + library + " does not implement all functions of the ABI");
+    instance->name = plugin->name ? plugin->name : library;
+
+    std::vector<monitor_filter_option> pluginOptions;
+    for (const auto &[key, value] : options)
+        pluginOptions.push_back({key.c_str(), value.c_str()});
+    char error[256] = "";
+    instance->filter = plugin->create(filename.c_str(), pluginOptions.data(), pluginOptions.size(), error, sizeof(error));
+    if (!instance->filter)
+        throw std::invalid_argument("Filter plugin " + instance->name + " rejected its options for " + filename + ": " + error);
+
+    m_Instance = std::move(instance);
+}
+
+const std::string &FilterPlugin::Name() const
+{
+    return m_Instance->name;
+}
+
+FilterPlugin::Session::Session(const FilterPlugin &filter)
+    : m_Filter(filter), m_Kept(16)
+{
+    const Instance &instance = *filter.m_Instance;
+    if (instance.plugin->begin)
+        m_State = instance.plugin->begin(instance.filter);
+}
+
+FilterPlugin::Session::~Session()
+{
+    const Instance &instance = *m_Filter.m_Instance;
+    if (instance.plugin->end && !m_Moved)
+        instance.plugin->end(instance.filter, m_State);
+}
+
+FilterPlugin::Session::Session(Session &&other) noexcept
+    : m_Filter(other.m_Filter), m_State(other.m_State), m_Kept(std::move(other.m_Kept))
+{
+    other.m_Moved = true;
+}
+
+std::span<const monitor_filter_span> FilterPlugin::Session::Apply(std::string_view line, uint64_t lineNumber)
+{
+    const Instance &instance = *m_Filter.m_Instance;
+    size_t count;
+    while (true) {
+        count = instance.plugin->apply(instance.filter, m_State, line.data(), line.size(), lineNumber,
+                m_Kept.data(), m_Kept.size());
+        if (count == MONITOR_FILTER_ERROR)
+            throw std::runtime_error("Filter plugin " + instance.name + " failed on line " + std::to_string(lineNumber)
+                    + " of " + m_Filter.m_Filename);
+        if (count <= m_Kept.size())
+            break;
+        m_Kept.resize(count);
+    }
+
+    std::span<const monitor_filter_span> kept(m_Kept.data(), count);
+    size_t end = 0;
+    for (const monitor_filter_span &span : kept) {
+        if (span.offset < end || span.offset > line.size() || span.length > line.size() - span.offset)
+            throw std::runtime_error("Filter plugin " + instance.name + " returned spans out of order or outside of line "
+                    + std::to_string(lineNumber) + " of " + m_Filter.m_Filename);
+        end = span.offset + span.length;
+    }
+    return kept;
+}
@@ -1,37 +1,205 @@
 #include <Filters.hpp>
 
-bool FilterLines::Contains(const uint64_t n)
+#include <algorithm>
+#include <stdexcept>
+
+FilterLines::FilterLines(const std::string& filename, std::vector<Interval> intervals)
+    : Filter(filename)
+{
+    std::sort(intervals.begin(), intervals.end());
+    for (const Interval &interval : intervals) {
+        // Overlapping or adjacent intervals become one
+        if (!m_Intervals.empty() && interval.first <= m_Intervals.back().second + 1)
+            m_Intervals.back().second = std::max(m_Intervals.back().second, interval.second);
+        else
+            m_Intervals.push_back(interval);
+    }
+}
+
+bool FilterLines::Contains(const uint64_t n) const
 {
-    return m_Lines.contains(n);
+    // First interval ending at or after n
+    auto it = std::lower_bound(m_Intervals.begin(), m_Intervals.end(), n,
+            [](const Interval &interval, uint64_t line) { return interval.second < line; });
+    return it != m_Intervals.end() && it->first <= n;
+}
+
+// Start markers of the pairs, for the automaton
+static std::vector<std::string> StartMarkers(const std::string &filename, const std::vector<FilterPatterns::Markers> &markers)
+{
+    std::vector<std::string> starts;
+    for (const auto &[start, end] : markers) {
+        if (start.empty() || end.empty())
+            throw std::invalid_argument("Markers of the patterns filter for " + filename + " must not be empty");
+        starts.push_back(start);
+    }
+    return starts;
 }
 
-std::string FilterSegment::Apply(const std::string &s)
+FilterPatterns::FilterPatterns(const std::string &filename, std::vector<Markers> markers, std::vector<std::string> regexes)
+    : Filter(filename), m_Markers(std::move(markers)), m_Regexes(std::move(regexes)), m_Starts(StartMarkers(filename, m_Markers))
 {
-    std::string result;
-    std::size_t pos = 0;
+    for (const auto &[start, end] : m_Markers)
+        m_Ends.emplace_back(std::vector<std::string>{end});
 
-    while (true) {
-        std::size_t startPos = s.find(m_Start, pos);
-        if (startPos == std::string::npos) {
-            result.append(s.substr(pos));
-            break;
+    if (m_Regexes.empty())
+        return;
+
+    // Each one on its own first, so an error names the regex
+    std::string alternation;
+    for (const std::string &regex : m_Regexes) {
+        try {
+            std::regex check(regex);
+        } catch (const std::regex_error &e) {
+            throw std::invalid_argument("Invalid regex [" + regex + "] in the patterns filter for " + filename + ": " + e.what());
         }
+        if (!alternation.empty())
+            alternation += '|';
+        alternation += "(?:" + regex + ")";
+    }
+    m_Regex.emplace(alternation, std::regex::ECMAScript | std::regex::optimize);
+}
 
-        std::size_t endPos = s.find(m_End, startPos + m_Start.size());
-        if (endPos == std::string::npos) {
-            result.append(s.substr(pos));
-            break;
+std::vector<FilterBytes::Span> FilterBytes::Kept(uint64_t size) const
+{
+    std::vector<Span> removed;
+    for (const Range &range : m_Ranges) {
+        uint64_t start;
+        if (range.offset >= 0) {
+            start = std::min<uint64_t>(static_cast<uint64_t>(range.offset), size);
+        } else {
+            uint64_t back = static_cast<uint64_t>(-(range.offset + 1)) + 1;
+            start = size - std::min(back, size);
         }
+        uint64_t end = start + std::min(range.length, size - start);
+        if (end > start)
+            removed.emplace_back(start, end);
+    }
+    std::sort(removed.begin(), removed.end());
 
-        result.append(s.substr(pos, startPos + m_Start.size() - pos));
-        pos = endPos;
+    std::vector<Span> kept;
+    uint64_t pos = 0;
+    for (const Span &span : removed) {
+        if (span.first > pos)
+            kept.emplace_back(pos, span.first);
+        pos = std::max(pos, span.second);
+    }
+    if (pos < size)
+        kept.emplace_back(pos, size);
+    return kept;
+}
 
-        if (!m_removeAll) {
-            result.append(s.substr(pos));
-            break;
+FilterKeys::FilterKeys(const std::string &filename, Format format, std::vector<std::string> paths)
+    : Filter(filename), m_Format(format), m_Sources(std::move(paths))
+{
+    for (const std::string &source : m_Sources) {
+        Path path;
+        size_t start = 0;
+        while (true) {
+            size_t end = source.find('.', start);
+            Component component;
+            component.key = source.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            if (component.key.empty())
+                throw std::invalid_argument("Invalid key path [" + source + "] in the keys filter for " + filename);
+
+            component.any = component.key == "*";
+            component.isIndex = component.key.find_first_not_of("0123456789") == std::string::npos;
+            if (component.isIndex) {
+                try {
+                    component.index = std::stoull(component.key);
+                } catch (const std::out_of_range &) {
+                    component.isIndex = false;
+                }
+            }
+            path.push_back(std::move(component));
+
+            if (end == std::string::npos)
+                break;
+            start = end + 1;
         }
+        m_Paths.push_back(std::move(path));
     }
+}
 
-    return result;
+// Lines filters of the file, in one list for FilterLines to merge
+static std::vector<FilterLines::Interval> AllIntervals(const std::vector<std::unique_ptr<Filter>> &filters)
+{
+    std::vector<FilterLines::Interval> intervals;
+    for (const auto& f : filters) {
+        if (auto* linesFilter = dynamic_cast<FilterLines*>(f.get()))
+            intervals.insert(intervals.end(), linesFilter->Intervals().begin(), linesFilter->Intervals().end());
+    }
+    return intervals;
 }
 
+FilterPlan::FilterPlan(const std::string &filename, const std::vector<std::unique_ptr<Filter>> &filters)
+    : m_Lines(filename, AllIntervals(filters))
+{
+    std::vector<FilterPatterns::Markers> markers;
+    std::vector<std::string> regexes;
+    bool patterns = false;
+    std::vector<FilterBytes::Range> ranges;
+    std::vector<std::string> keyPaths;
+    std::optional<FilterKeys::Format> keysFormat;
+    bool bom = false;
+    bool whitespace = false;
+    // Types of filters the file has, bytes and keys filters have to be alone
+    bool bytes = false;
+    bool keys = false;
+    bool normalize = false;
+    bool lines = false;
+
+    for (const auto& f : filters) {
+        if (auto* bytesFilter = dynamic_cast<FilterBytes*>(f.get())) {
+            ranges.insert(ranges.end(), bytesFilter->Ranges().begin(), bytesFilter->Ranges().end());
+            bytes = true;
+            continue;
+        }
+        if (auto* keysFilter = dynamic_cast<FilterKeys*>(f.get())) {
+            if (keysFormat && *keysFormat != keysFilter->DocumentFormat())
+                throw std::invalid_argument("Keys filters of " + filename + " disagree about the document format");
+            keysFormat = keysFilter->DocumentFormat();
+            keyPaths.insert(keyPaths.end(), keysFilter->Sources().begin(), keysFilter->Sources().end());
+            keys = true;
+            continue;
+        }
+        if (auto* normalizeFilter = dynamic_cast<FilterNormalize*>(f.get())) {
+            bom = bom || normalizeFilter->Bom();
+            whitespace = whitespace || normalizeFilter->Whitespace();
+            normalize = true;
+            continue;
+        }
+        lines = true;
+
+        if (dynamic_cast<FilterLines*>(f.get())) {
+            continue;
+        } else if (auto* segFilter = dynamic_cast<FilterSegment*>(f.get())) {
+            m_Segments.push_back(*segFilter);
+        } else if (auto* patternsFilter = dynamic_cast<FilterPatterns*>(f.get())) {
+            markers.insert(markers.end(), patternsFilter->MarkerPairs().begin(), patternsFilter->MarkerPairs().end());
+            regexes.insert(regexes.end(), patternsFilter->Regexes().begin(), patternsFilter->Regexes().end());
+            patterns = true;
+        } else if (auto* pluginFilter = dynamic_cast<FilterPlugin*>(f.get())) {
+            m_Plugins.push_back(*pluginFilter);
+        } else {
+            throw std::runtime_error("Failed to dynamically cast Filter object");
+        }
+    }
+
+    if (bytes && (lines || keys || normalize))
+        throw std::invalid_argument("Bytes filters of " + filename + " can not be combined with filters of other types");
+    if (keys && (lines || normalize))
+        throw std::invalid_argument("Keys filters of " + filename + " can not be combined with filters of other types");
+    if (bytes)
+        m_Bytes.emplace(filename, std::move(ranges));
+    if (keys)
+        m_Keys.emplace(filename, *keysFormat, std::move(keyPaths));
+    if (patterns)
+        m_Patterns.emplace(filename, std::move(markers), std::move(regexes));
+    if (normalize)
+        m_Normalize.emplace(filename, bom, whitespace);
+    m_SplitsLines = lines;
+
+    std::stable_sort(m_Segments.begin(), m_Segments.end(),
+            [](const FilterSegment &a, const FilterSegment &b) { return a.Line() < b.Line(); });
+}
@@ -1,27 +1,368 @@
 #include <HashingAlgorithm.hpp>
+#include <Blake3.hpp>
 #include <CryptoUtil.hpp>
+#include <FileReader.hpp>
+#include <Sha256Multi.hpp>
+#include <ThreadPool.hpp>
 
-std::string HashingAlgorithmSHA256::Run(const std::string &s, const FilterMap &filters)
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <unordered_map>
+
+// Context of the EVP digests
+class EVPContext : public HashingAlgorithm::Context {
+    public:
+        explicit EVPContext(const EVP_MD *md) : m_Md(md), m_Ctx(EVP_MD_CTX_new())
+        {
+            if (!m_Ctx)
+                throw std::runtime_error("Failed to create EVP_MD_CTX");
+        }
+
+        ~EVPContext() override
+        {
+            EVP_MD_CTX_free(m_Ctx);
+        }
+
+        void Init() override
+        {
+            if (EVP_DigestInit_ex2(m_Ctx, m_Md, nullptr) != 1)
+                throw std::runtime_error("Digest initialization failed");
+        }
+
+        void Update(const void *data, size_t len) override
+        {
+            if (EVP_DigestUpdate(m_Ctx, data, len) != 1)
+                throw std::runtime_error("Digest update failed");
+        }
+
+        std::string Final() override
+        {
+            unsigned char hash[EVP_MAX_MD_SIZE];
+            unsigned int hash_len = 0;
+
+            if (EVP_DigestFinal_ex(m_Ctx, hash, &hash_len) != 1)
+                throw std::runtime_error("Digest finalization failed");
+
+            return PBKDF2Util::ToHex(hash, hash_len);
+        }
+
+        std::unique_ptr<Context> Clone() const override
+        {
+            auto clone = std::make_unique<EVPContext>(m_Md);
+            clone->CopyFrom(*this);
+            return clone;
+        }
+
+        void CopyFrom(const Context &other) override
+        {
+            if (EVP_MD_CTX_copy_ex(m_Ctx, static_cast<const EVPContext&>(other).m_Ctx) != 1)
+                throw std::runtime_error("Digest copy failed");
+        }
+
+    private:
+        const EVP_MD *m_Md;
+        EVP_MD_CTX *m_Ctx;
+};
+
+class Blake3Context : public HashingAlgorithm::Context {
+    public:
+        Blake3Context(ThreadPool *pool, size_t parallelMinBytes)
+        {
+            m_Hasher.SetPool(pool, parallelMinBytes);
+        }
+
+        void Init() override
+        {
+            m_Hasher.Reset();
+        }
+
+        void Update(const void *data, size_t len) override
+        {
+            m_Hasher.Update(data, len);
+        }
+
+        std::string Final() override
+        {
+            unsigned char hash[Blake3Hasher::OUT_LEN];
+            m_Hasher.Finalize(hash, sizeof(hash));
+            return PBKDF2Util::ToHex(hash, sizeof(hash));
+        }
+
+        std::unique_ptr<Context> Clone() const override
+        {
+            return std::make_unique<Blake3Context>(*this);
+        }
+
+        void CopyFrom(const Context &other) override
+        {
+            m_Hasher = static_cast<const Blake3Context&>(other).m_Hasher;
+        }
+
+    private:
+        Blake3Hasher m_Hasher;
+};
+
+static std::string JoinDigests(const std::vector<std::string> &digests)
+{
+    std::string joined;
+    for (const std::string &digest : digests) {
+        if (!joined.empty())
+            joined += HashingAlgorithmMulti::SEPARATOR;
+        joined += digest;
+    }
+    return joined;
+}
+
+// Context of HashingAlgorithmMulti, feeds every update to all the contexts
+class MultiContext : public HashingAlgorithm::Context {
+    public:
+        explicit MultiContext(std::vector<std::unique_ptr<HashingAlgorithm::Context>> contexts) :
+            m_Contexts(std::move(contexts)) {}
+
+        void Init() override
+        {
+            for (auto &ctx : m_Contexts)
+                ctx->Init();
+        }
+
+        void Update(const void *data, size_t len) override
+        {
+            // Big updates, like mmap windows, are passed on in pieces that
+            // stay in the cache until the last digest has read them
+            const char *p = static_cast<const char*>(data);
+            while (len > 0) {
+                size_t n = std::min(len, PIECE_SIZE);
+                for (auto &ctx : m_Contexts)
+                    ctx->Update(p, n);
+                p += n;
+                len -= n;
+            }
+        }
+
+        std::string Final() override
+        {
+            std::vector<std::string> digests;
+            for (auto &ctx : m_Contexts)
+                digests.push_back(ctx->Final());
+            return JoinDigests(digests);
+        }
+
+        std::unique_ptr<Context> Clone() const override
+        {
+            std::vector<std::unique_ptr<HashingAlgorithm::Context>> contexts;
+            for (auto &ctx : m_Contexts)
+                contexts.push_back(ctx->Clone());
+            return std::make_unique<MultiContext>(std::move(contexts));
+        }
+
+        void CopyFrom(const Context &other) override
+        {
+            const MultiContext &multi = static_cast<const MultiContext&>(other);
+            for (size_t i = 0; i < m_Contexts.size(); i++)
+                m_Contexts[i]->CopyFrom(*multi.m_Contexts[i]);
+        }
+
+    private:
+        static constexpr size_t PIECE_SIZE = 256 * 1024;
+        std::vector<std::unique_ptr<HashingAlgorithm::Context>> m_Contexts;
+};
+
+HashingAlgorithm::HashingAlgorithm(const std::string &name) : m_Name(name)
+{
+    static std::atomic<uint64_t> nextId{0};
+    m_Id = nextId++;
+}
+
+HashingAlgorithm::~HashingAlgorithm() = default;
+
+HashingAlgorithmEVP::HashingAlgorithmEVP(const char *name)
+    : HashingAlgorithm(name), m_Md(EVP_MD_fetch(nullptr, name, nullptr))
+{
+    if (!m_Md)
+        throw std::runtime_error(std::string("Digest ") + name + " is not available");
+}
+
+HashingAlgorithmEVP::~HashingAlgorithmEVP()
 {
-    return SHAFileUtil::SHA256(s, filters);
+    EVP_MD_free(m_Md);
 }
-std::string HashingAlgorithmSHA512::Run(const std::string &s, const FilterMap &filters)
+
+std::unique_ptr<HashingAlgorithm::Context> HashingAlgorithmEVP::NewContext() const
 {
-    return SHAFileUtil::SHA512(s, filters);
+    return std::make_unique<EVPContext>(m_Md);
 }
-std::string HashingAlgorithmSHA3_256::Run(const std::string &s, const FilterMap &filters)
+
+std::unique_ptr<HashingAlgorithm::Context> HashingAlgorithmBLAKE3::NewContext() const
 {
-    return SHAFileUtil::SHA3_256(s, filters);
+    return std::make_unique<Blake3Context>(m_Pool, m_ParallelMinBytes);
 }
-std::string HashingAlgorithmSHA3_512::Run(const std::string &s, const FilterMap &filters)
+
+HashingAlgorithm::Context &HashingAlgorithm::ThreadContext() const
 {
-    return SHAFileUtil::SHA3_512(s, filters);
+    // Keyed by id and not by address, so an algorithm created where a
+    // destroyed one used to be never gets the old one's context
+    thread_local std::unordered_map<uint64_t, std::unique_ptr<Context>> contexts;
+
+    std::unique_ptr<Context> &ctx = contexts[m_Id];
+    if (!ctx)
+        ctx = NewContext();
+    return *ctx;
 }
-std::string HashingAlgorithmBlake2s256::Run(const std::string &s, const FilterMap &filters)
+
+std::string HashingAlgorithm::Run(const std::string &filename, const FilterMap &filters) const
 {
-    return SHAFileUtil::Blake2s256(s, filters);
+    return SHAFileUtil::SHA_Agnostic(filename, ThreadContext(), filters);
 }
-std::string HashingAlgorithmBlake2s512::Run(const std::string &s, const FilterMap &filters)
+
+std::vector<std::string> HashingAlgorithm::RunBatch(const std::vector<std::string> &filenames, const FilterMap &filters) const
+{
+    std::vector<std::string> hashes;
+    hashes.reserve(filenames.size());
+    for (const std::string &filename : filenames)
+        hashes.push_back(Run(filename, filters));
+    return hashes;
+}
+
+std::vector<std::string> HashingAlgorithm::TryRunBatch(const std::vector<std::string> &filenames, const FilterMap &filters,
+        std::vector<std::string> &errors) const
+{
+    errors.assign(filenames.size(), std::string());
+    try {
+        return RunBatch(filenames, filters);
+    } catch (const std::runtime_error &) {
+        // Hashed one by one again to know which files failed
+    }
+
+    std::vector<std::string> hashes(filenames.size());
+    for (size_t i = 0; i < filenames.size(); i++) {
+        try {
+            hashes[i] = Run(filenames[i], filters);
+        } catch (const std::runtime_error &e) {
+            errors[i] = e.what();
+        }
+    }
+    return hashes;
+}
+
+std::vector<std::string> HashingAlgorithmSHA256::RunBatch(const std::vector<std::string> &filenames, const FilterMap &filters) const
+{
+    if (Sha256Multi::Lanes() == 0 || filenames.size() < 2)
+        return HashingAlgorithm::RunBatch(filenames, filters);
+
+    std::vector<std::string> hashes(filenames.size());
+    std::vector<std::string> contents;
+    std::vector<size_t> indices;
+    contents.reserve(filenames.size());
+
+    for (size_t i = 0; i < filenames.size(); i++) {
+        // Filters need the line by line path
+        if (filters.contains(filenames[i])) {
+            hashes[i] = Run(filenames[i], filters);
+            continue;
+        }
+
+        std::unique_ptr<FileReader> reader = FileReader::Open(filenames[i]);
+        std::string content;
+        std::string_view chunk;
+        while (reader->Next(chunk))
+            content.append(chunk);
+        // Same as FileDigest, a last line without a newline gets one
+        if (!content.empty() && content.back() != '\n')
+            content.push_back('\n');
+
+        contents.push_back(std::move(content));
+        indices.push_back(i);
+    }
+
+    std::vector<std::string_view> messages(contents.begin(), contents.end());
+    std::vector<Sha256Multi::Digest> digests;
+    Sha256Multi::Hash(messages, digests);
+    for (size_t j = 0; j < indices.size(); j++)
+        hashes[indices[j]] = PBKDF2Util::ToHex(digests[j].data(), digests[j].size());
+
+    return hashes;
+}
+
+ChunkedDigest HashingAlgorithm::RunChunked(const std::string &filename, uint64_t size, uint64_t chunkSize, ThreadPool &pool) const
+{
+    if (chunkSize == 0)
+        throw std::invalid_argument("Chunk size must be > 0");
+
+    ChunkedDigest digest;
+    digest.chunkSize = chunkSize;
+    // Empty files still get one (empty) leaf
+    uint64_t chunks = size == 0 ? 1 : (size + chunkSize - 1) / chunkSize;
+    digest.leaves.resize(chunks);
+
+    std::vector<ThreadPool::Task> tasks;
+    for (uint64_t i = 0; i < chunks; i++) {
+        tasks.push_back([&, i] {
+            uint64_t offset = i * chunkSize;
+            digest.leaves[i] = SHAFileUtil::MerkleLeaf(filename, offset, std::min(chunkSize, size - offset), ThreadContext());
+        });
+    }
+    pool.Run(std::move(tasks));
+
+    digest.root = MerkleRoot(digest.leaves);
+    return digest;
+}
+
+std::string HashingAlgorithm::MerkleRoot(const std::vector<std::string> &leaves) const
+{
+    return SHAFileUtil::MerkleRoot(leaves, ThreadContext());
+}
+
+static std::string JoinNames(const std::vector<std::unique_ptr<HashingAlgorithm>> &algorithms)
+{
+    std::vector<std::string> names;
+    for (const auto &algorithm : algorithms)
+        names.push_back(algorithm->Name());
+    return JoinDigests(names);
+}
+
+HashingAlgorithmMulti::HashingAlgorithmMulti(std::vector<std::unique_ptr<HashingAlgorithm>> algorithms)
+    : HashingAlgorithm(JoinNames(algorithms)), m_Algorithms(std::move(algorithms))
+{
+    if (m_Algorithms.empty())
+        throw std::invalid_argument("At least one hash algorithm is required");
+}
+
+std::unique_ptr<HashingAlgorithm::Context> HashingAlgorithmMulti::NewContext() const
+{
+    std::vector<std::unique_ptr<Context>> contexts;
+    for (const auto &algorithm : m_Algorithms)
+        contexts.push_back(algorithm->NewContext());
+    return std::make_unique<MultiContext>(std::move(contexts));
+}
+
+std::string HashingAlgorithmMulti::MerkleRoot(const std::vector<std::string> &leaves) const
+{
+    std::vector<std::vector<std::string>> split(m_Algorithms.size());
+    for (const std::string &leaf : leaves) {
+        std::vector<std::string> digests = Split(leaf);
+        if (digests.size() != m_Algorithms.size())
+            throw std::runtime_error("Leaf " + leaf + " does not have a digest for every algorithm");
+        for (size_t i = 0; i < digests.size(); i++)
+            split[i].push_back(std::move(digests[i]));
+    }
+
+    std::vector<std::string> roots;
+    for (size_t i = 0; i < m_Algorithms.size(); i++)
+        roots.push_back(m_Algorithms[i]->MerkleRoot(split[i]));
+    return JoinDigests(roots);
+}
+
+std::vector<std::string> HashingAlgorithmMulti::Split(const std::string &digest)
 {
-    return SHAFileUtil::Blake2s512(s, filters);
+    std::vector<std::string> digests;
+    size_t start = 0;
+    while (true) {
+        size_t end = digest.find(SEPARATOR, start);
+        digests.push_back(digest.substr(start, end - start));
+        if (end == std::string::npos)
+            break;
+        start = end + 1;
+    }
+    return digests;
 }
@@ -362,6 +362,7 @@ void MailAlertManager::resetAll()
 
 bool MailAlertManager::isIncidentOngoing(const std::string &incidentId)
 {
+    std::lock_guard<std::mutex> lock(mutex_);
     return incidents_.contains(incidentId);
 }
 
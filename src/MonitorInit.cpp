@@ -1,17 +1,23 @@
 #include "MailAlertManager.hpp"
 #include <HashingAlgorithm.hpp>
+#include <Blake3.hpp>
+#include <SimdSearch.hpp>
 #include <CryptoUtil.hpp>
+#include <FileReader.hpp>
+#include <UringScanner.hpp>
+#include <chrono>
 #include <csignal>
 #include <cstdint>
 #include <Monitor.hpp>
 #include <Log.hpp>
+#include <map>
 #include <memory>
-#include <ranges>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <yaml-cpp/exceptions.h>
 #include <yaml-cpp/node/parse.h>
+#include <yaml-cpp/node/emit.h>
 #include <Config.hpp>
 #include <vector>
 
@@ -62,6 +68,12 @@ bool Monitor::Initialise()
         m_filters.clear();
     }
 
+    result = InitialiseStatCache();
+    if (!result) {
+        logging::err("Failed to initialise the stat cache");
+        return false;
+    }
+
     return true;
 }
 
@@ -75,7 +87,7 @@ bool Monitor::InitialiseModules()
     return result;
 }
 
-static void FilterLinesPopulateSet(std::unordered_set<uint64_t> &set, const std::string &csv)
+static void FilterLinesPopulateIntervals(std::vector<FilterLines::Interval> &intervals, const std::string &csv)
 {
         std::stringstream ss(csv);
         std::string token;
@@ -90,11 +102,7 @@ static void FilterLinesPopulateSet(std::unordered_set<uint64_t> &set, const std:
                 std::istringstream iss(token);
                 if (iss >> lower >> dash >> upper && dash == '-' && lower < upper) {
                     // range string is valid
-                    // Replaced this line with the line below because libc++ that CI uses doesnt 
-                    // have it yet. It will most likely be forgotten lol
-                    //set.insert_range(std::views::iota(lower, upper + 1));
-                    set.insert( std::views::iota(lower, upper + 1).begin(),
-                                std::views::iota(lower, upper + 1).end());
+                    intervals.emplace_back(lower, upper);
                 } else {
                     // in case user is incapable of understanding child-like syntax
                     throw std::invalid_argument("Invalid format for filter range [" + token + "]. Use correct format [lower-upper]");
@@ -103,11 +111,30 @@ static void FilterLinesPopulateSet(std::unordered_set<uint64_t> &set, const std:
             // handle single line filter
             else {
                 uint64_t line = std::stoull(token);
-                set.insert(line);
+                intervals.emplace_back(line, line);
             }
         }
 }
 
+// Ranges in the offset:length format, offsets may be negative
+static void FilterBytesPopulateRanges(std::vector<FilterBytes::Range> &ranges, const std::string &csv)
+{
+        std::stringstream ss(csv);
+        std::string token;
+
+        while (std::getline(ss, token, ',')) {
+            int64_t offset = 0;
+            uint64_t length = 0;
+            char colon;
+
+            std::istringstream iss(token);
+            if (iss >> offset >> colon >> length && colon == ':' && length > 0 && (iss >> std::ws).eof())
+                ranges.push_back({offset, length});
+            else
+                throw std::invalid_argument("Invalid format for filter bytes [" + token + "]. Use correct format [offset:length]");
+        }
+}
+
 bool Monitor::InitialiseFilters()
 {
     YAML::Node filterNode;
@@ -121,6 +148,8 @@ bool Monitor::InitialiseFilters()
         // No filters are going to be applied because none exist
         return false;
 
+    // Filters of every file, in the order they are configured
+    std::map<std::string, std::vector<std::unique_ptr<Filter>>> filters;
     for (const auto& entry : filterNode) {
         std::string type = entry["type"].as<std::string>();
 
@@ -129,10 +158,10 @@ bool Monitor::InitialiseFilters()
             std::string linesCSV = entry["lines"].as<std::string>();
     
             logging::info("Setting up Lines filter for " + filename);
-            std::unordered_set<uint64_t> lines;
-            FilterLinesPopulateSet(lines, linesCSV);
+            std::vector<FilterLines::Interval> lines;
+            FilterLinesPopulateIntervals(lines, linesCSV);
             
-            m_filters[filename].push_back(std::make_unique<FilterLines>(filename, lines));
+            filters[filename].push_back(std::make_unique<FilterLines>(filename, std::move(lines)));
         } else if (type == "segment") {
             std::string filename    = entry["file"].as<std::string>();
             std::string start       = entry["start"].as<std::string>();
@@ -142,12 +171,77 @@ bool Monitor::InitialiseFilters()
             if (entry["all"]) 
                 all = entry["all"].as<bool>();
             
-            m_filters[filename].push_back(std::make_unique<FilterSegment>(filename, start, end, all, line));
+            filters[filename].push_back(std::make_unique<FilterSegment>(filename, start, end, all, line));
+        } else if (type == "bytes") {
+            std::string filename = entry["file"].as<std::string>();
+            std::string rangesCSV = entry["ranges"].as<std::string>();
+
+            logging::info("Setting up Bytes filter for " + filename);
+            std::vector<FilterBytes::Range> ranges;
+            FilterBytesPopulateRanges(ranges, rangesCSV);
+
+            filters[filename].push_back(std::make_unique<FilterBytes>(filename, std::move(ranges)));
+        } else if (type == "keys") {
+            std::string filename = entry["file"].as<std::string>();
+            std::vector<std::string> paths = entry["keys"].as<std::vector<std::string>>();
+            // By default from the extension
+            std::string format = filename.ends_with(".yaml") || filename.ends_with(".yml") ? "yaml" : "json";
+            if (entry["format"])
+                format = entry["format"].as<std::string>();
+            if (format != "json" && format != "yaml")
+                throw std::invalid_argument("Unsupported document format: " + format + ". Use json or yaml");
+
+            logging::info("Setting up Keys filter for " + filename);
+            filters[filename].push_back(std::make_unique<FilterKeys>(filename,
+                    format == "yaml" ? FilterKeys::Format::YAML : FilterKeys::Format::JSON, std::move(paths)));
+        } else if (type == "normalize") {
+            std::string filename = entry["file"].as<std::string>();
+            bool bom = true;
+            if (entry["bom"])
+                bom = entry["bom"].as<bool>();
+            bool whitespace = true;
+            if (entry["whitespace"])
+                whitespace = entry["whitespace"].as<bool>();
+
+            logging::info("Setting up Normalize filter for " + filename);
+            filters[filename].push_back(std::make_unique<FilterNormalize>(filename, bom, whitespace));
+        } else if (type == "plugin") {
+            std::string filename = entry["file"].as<std::string>();
+            std::string library = entry["library"].as<std::string>();
+            FilterPlugin::Options options;
+            if (entry["options"]) {
+                for (const auto& option : entry["options"])
+                    options.emplace_back(option.first.as<std::string>(), option.second.as<std::string>());
+            }
+
+            auto plugin = std::make_unique<FilterPlugin>(filename, library, options);
+            logging::info("Setting up Plugin filter " + plugin->Name() + " from " + library + " for " + filename);
+            filters[filename].push_back(std::move(plugin));
+        } else if (type == "patterns") {
+            std::string filename = entry["file"].as<std::string>();
+            std::vector<FilterPatterns::Markers> markers;
+            if (entry["markers"]) {
+                for (const auto& pair : entry["markers"])
+                    markers.emplace_back(pair["start"].as<std::string>(), pair["end"].as<std::string>());
+            }
+            std::vector<std::string> regexes;
+            if (entry["regex"])
+                regexes = entry["regex"].as<std::vector<std::string>>();
+            if (markers.empty() && regexes.empty())
+                throw std::invalid_argument("Patterns filter for " + filename + " needs markers or regex");
+
+            logging::info("Setting up Patterns filter for " + filename + " with " + std::to_string(markers.size())
+                    + " markers and " + std::to_string(regexes.size()) + " regexes");
+            filters[filename].push_back(std::make_unique<FilterPatterns>(filename, std::move(markers), std::move(regexes)));
         } else {
             throw std::invalid_argument("Unknown filter type: " + type);
         }
     }
 
+    for (const auto& [filename, fileFilters] : filters)
+        m_filters.emplace(filename, FilterPlan(filename, fileFilters));
+    logging::info(std::string("Lines of filtered files are counted with the ") + SimdSearch::Implementation() + " implementation");
+
     return true;
 }
 
@@ -155,40 +249,321 @@ bool Monitor::InitialiseConfig()
 {
     // Period
     m_u64period = Cfg.get<uint64_t>("monitor.period", 60);
-    // Hashing algorhitm
-    std::string hashAlgo = Cfg.get<std::string>("monitor.algorithm", "sha");
-    uint32_t key_lenght = Cfg.get<uint32_t>("monitor.key_length", 256);
-
-    if (key_lenght != 256 && key_lenght != 512)
-        throw std::invalid_argument("Invalid key lenght. Only 256 and 512 is supported");
-
-    if (hashAlgo == "sha" && key_lenght == 256)
-        m_hashAlgorhitm = new HashingAlgorithmSHA256();
-    else if (hashAlgo == "sha" && key_lenght == 512)
-        m_hashAlgorhitm = new HashingAlgorithmSHA512();
-    else if (hashAlgo == "blake2s" && key_lenght == 256)
-        m_hashAlgorhitm = new HashingAlgorithmBlake2s256();
-    else if (hashAlgo == "blake2s" && key_lenght == 512)
-        m_hashAlgorhitm = new HashingAlgorithmBlake2s512();
-    else if (hashAlgo == "sha3" && key_lenght == 256)
-        m_hashAlgorhitm = new HashingAlgorithmSHA3_256();
-    else if (hashAlgo == "sha3" && key_lenght == 512)
-        m_hashAlgorhitm = new HashingAlgorithmSHA3_512();
+    m_Pacing = Cfg.get<bool>("monitor.pacing", false);
+    if (m_Pacing && m_u64period == 0) {
+        logging::warn("pacing has no effect with a period of 0");
+        m_Pacing = false;
+    }
+
+    // Number of threads hashing files, 0 means one per online CPU
+    uint32_t threads = Cfg.get<uint32_t>("monitor.threads", 0);
+    if (threads == 0)
+        threads = ThreadPool::HardwareThreads();
+    m_Pool = std::make_unique<ThreadPool>(threads);
+
+    // Hashing algorhitm. A list of algorithms takes precedence over algorithm and key_length
+    std::vector<std::string> algorithms = Cfg.get<std::vector<std::string>>("monitor.algorithms", {});
+    if (algorithms.empty()) {
+        std::string hashAlgo = Cfg.get<std::string>("monitor.algorithm", "sha");
+        uint32_t key_lenght = Cfg.get<uint32_t>("monitor.key_length", 256);
+
+        if (key_lenght != 256 && key_lenght != 512)
+            throw std::invalid_argument("Invalid key lenght. Only 256 and 512 is supported");
+
+        if (hashAlgo == "sha" || (hashAlgo == "blake2s" && key_lenght == 256))
+            algorithms.push_back(hashAlgo + std::to_string(key_lenght));
+        else if (hashAlgo == "sha3")
+            algorithms.push_back("sha3_" + std::to_string(key_lenght));
+        else if ((hashAlgo == "blake2s" || hashAlgo == "blake2b") && key_lenght == 512)
+            algorithms.push_back("blake2b512");
+        else if (hashAlgo == "blake3" && key_lenght == 256)
+            algorithms.push_back("blake3");
+        else
+            throw std::invalid_argument("Unsupported hash algorithm: " + hashAlgo + " with key length " + std::to_string(key_lenght));
+    }
+
+    std::vector<std::unique_ptr<HashingAlgorithm>> hashAlgorithms;
+    m_DigestNames.clear();
+    for (const std::string &algorithm : algorithms) {
+        if (algorithm == "sha256")
+            hashAlgorithms.push_back(std::make_unique<HashingAlgorithmSHA256>());
+        else if (algorithm == "sha512")
+            hashAlgorithms.push_back(std::make_unique<HashingAlgorithmSHA512>());
+        else if (algorithm == "sha3_256")
+            hashAlgorithms.push_back(std::make_unique<HashingAlgorithmSHA3_256>());
+        else if (algorithm == "sha3_512")
+            hashAlgorithms.push_back(std::make_unique<HashingAlgorithmSHA3_512>());
+        else if (algorithm == "blake2s256")
+            hashAlgorithms.push_back(std::make_unique<HashingAlgorithmBlake2s256>());
+        else if (algorithm == "blake2b512")
+            hashAlgorithms.push_back(std::make_unique<HashingAlgorithmBlake2b512>());
+        else if (algorithm == "blake3") {
+            // Big updates, like mmap windows, can be hashed on all threads
+            uint64_t parallelKB = Cfg.get<uint64_t>("monitor.blake3_parallel_kb", 0);
+            hashAlgorithms.push_back(std::make_unique<HashingAlgorithmBLAKE3>(parallelKB ? m_Pool.get() : nullptr, parallelKB * 1024));
+            logging::info(std::string("BLAKE3 uses the ") + Blake3Hasher::Implementation() + " implementation");
+        }
+        else
+            throw std::invalid_argument("Unsupported hash algorithm: " + algorithm);
+
+        for (const std::string &name : m_DigestNames) {
+            if (name == hashAlgorithms.back()->Name())
+                throw std::invalid_argument("Hash algorithm " + algorithm + " is listed more than once");
+        }
+        m_DigestNames.push_back(hashAlgorithms.back()->Name());
+    }
+
+    // Several algorithms share one read of every file
+    if (hashAlgorithms.size() == 1)
+        m_hashAlgorhitm = std::move(hashAlgorithms.front());
+    else
+        m_hashAlgorhitm = std::make_unique<HashingAlgorithmMulti>(std::move(hashAlgorithms));
+
+    std::string mismatch = Cfg.get<std::string>("monitor.mismatch", "any");
+    if (mismatch != "any" && mismatch != "all")
+        throw std::invalid_argument("Unsupported mismatch mode: " + mismatch + ". Use any or all");
+    m_MismatchAll = mismatch == "all";
+
+    // How the monitored files are read
+    std::string ioMode = Cfg.get<std::string>("monitor.io", "stream");
+    if (ioMode == "stream" || ioMode == "uring")
+        FileReader::SetMode(FileReader::Mode::STREAM);
+    else if (ioMode == "mmap")
+        FileReader::SetMode(FileReader::Mode::MMAP);
     else
-        throw std::invalid_argument("Unsupported hash algorithm: " + hashAlgo);
+        throw std::invalid_argument("Unsupported io mode: " + ioMode);
+
+    uint64_t readBufferKB = Cfg.get<uint64_t>("monitor.read_buffer_kb", 1024);
+    if (readBufferKB == 0)
+        throw std::invalid_argument("monitor.read_buffer_kb must be greater than 0");
+    FileReader::SetBufferSize(readBufferKB * 1024);
+
+    uint64_t mmapWindowMB = Cfg.get<uint64_t>("monitor.mmap_window_mb", 64);
+    if (mmapWindowMB == 0)
+        throw std::invalid_argument("monitor.mmap_window_mb must be greater than 0");
+    FileReader::SetWindowSize(mmapWindowMB * 1024 * 1024);
+
+    // Lines with segment or patterns filters longer than this are filtered while streamed
+    uint64_t maxLineKB = Cfg.get<uint64_t>("monitor.max_line_kb", 1024);
+    if (maxLineKB == 0)
+        throw std::invalid_argument("monitor.max_line_kb must be greater than 0");
+    FileDigest::SetMaxLineSize(maxLineKB * 1024);
+
+    // Huge files hashed as a Merkle tree of chunks
+    m_ChunkThreshold = Cfg.get<uint64_t>("monitor.chunk_threshold_mb", 0) * 1024 * 1024;
+    m_ChunkSize = Cfg.get<uint64_t>("monitor.chunk_size_mb", 64) * 1024 * 1024;
+    if (m_ChunkSize == 0)
+        throw std::invalid_argument("monitor.chunk_size_mb must be greater than 0");
+
+    // Stat cache, set up in InitialiseStatCache once the filters are known
+    m_VerifyEvery = Cfg.get<uint32_t>("monitor.verify_every", 0);
+    m_VerifyPercent = Cfg.get<uint32_t>("monitor.verify_percent", 5);
+    if (m_VerifyPercent > 100)
+        throw std::invalid_argument("monitor.verify_percent must be between 0 and 100");
+
+    if (ioMode == "uring") {
+        uint32_t queueDepth = Cfg.get<uint32_t>("monitor.uring_queue_depth", 32);
+        if (queueDepth == 0)
+            throw std::invalid_argument("monitor.uring_queue_depth must be greater than 0");
+
+        if (!UringScanner::Available()) {
+            logging::warn("io_uring is not available on this system, using stream io");
+        } else {
+            // Rings can not be shared between threads, every worker gets its
+            // own and the reads in flight are split between them
+            unsigned workerDepth = std::max(1u, queueDepth / threads);
+            try {
+                for (uint32_t i = 0; i < threads; i++)
+                    m_Uring.push_back(std::make_unique<UringScanner>(workerDepth, readBufferKB * 1024));
+            } catch (const std::runtime_error &e) {
+                logging::warn(std::string("Failed to set up io_uring, using stream io: ") + e.what());
+                m_Uring.clear();
+            }
+        }
+    }
 
+    // How changes are noticed, see Monitor::WatchEvents
+    std::string events = Cfg.get<std::string>("monitor.events", "poll");
+    if (events != "poll" && events != "inotify" && events != "fanotify")
+        throw std::invalid_argument("Unsupported events mode: " + events + ". Use poll, inotify or fanotify");
+    m_DebounceMs = Cfg.get<uint64_t>("monitor.debounce_ms", 500);
+    m_FullScanPeriod = Cfg.get<uint64_t>("monitor.full_scan_period", 3600);
+    if (m_FullScanPeriod == 0)
+        throw std::invalid_argument("monitor.full_scan_period must be greater than 0");
+
+    if (events == "fanotify") {
+        try {
+            m_Watcher = std::make_unique<ChangeWatcher>(ChangeWatcher::Backend::FANOTIFY);
+        } catch (const std::runtime_error &e) {
+            logging::warn(std::string("Failed to set up fanotify, using inotify: ") + e.what());
+            events = "inotify";
+        }
+    }
+    if (events == "inotify") {
+        try {
+            m_Watcher = std::make_unique<ChangeWatcher>(ChangeWatcher::Backend::INOTIFY);
+        } catch (const std::runtime_error &e) {
+            logging::warn(std::string("Failed to set up inotify, scanning every period: ") + e.what());
+        }
+    }
+    if (m_Watcher) {
+        logging::info(std::string("Changes are found with ") + m_Watcher->Name() + " events, all files are checked every " +
+                std::to_string(m_FullScanPeriod) + " seconds");
+        if (m_Pacing)
+            logging::warn("pacing has no effect with events");
+        m_Pacing = false;
+    }
+
+    std::vector<std::string> entries;
     try {
-        m_files = Cfg.get<std::vector<std::string>>("files");
+        entries = Cfg.get<std::vector<std::string>>("files");
     } catch (const YAML::BadConversion &e) {
         // When we get BadConversion, it most likely means that
-        // no files were provided. YAML expects to return a 
+        // no files were provided. YAML expects to return a
         // vector of strings but there is no value at all
         throw std::invalid_argument("You need to provide at least one file for monitoring");
     }
-    if (m_files.size() == 0) {
+    if (entries.size() == 0) {
         throw std::invalid_argument("You need to provide at least one file for monitoring");
     }
 
+    // Directories and globs are compiled into one matcher with the excludes
+    // and expanded on every scan, see ExpandFiles
+    auto matcher = std::make_unique<PathMatcher>();
+    std::string globs;
+    for (const std::string &entry : entries) {
+        if (!PathMatcher::IsGlob(entry)) {
+            m_files.push_back(entry);
+            continue;
+        }
+
+        matcher->Include(entry);
+        logging::info("Monitoring files matching " + entry);
+        globs += entry + "\t";
+    }
+    m_LiteralFiles = m_files.size();
+
+    // Excludes apply to the files directories and globs match, files listed
+    // by their path are always monitored
+    std::vector<std::string> excludes = Cfg.get<std::vector<std::string>>("exclude", {});
+    if (!excludes.empty() && globs.empty())
+        logging::warn("exclude has no effect, files lists no directories or globs");
+
+    if (!globs.empty()) {
+        globs += "exclude";
+        for (const std::string &exclude : excludes) {
+            matcher->Exclude(exclude);
+            globs += "\t" + exclude;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        matcher->Compile();
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        logging::info("Compiled " + std::to_string(excludes.size()) + " excludes with the globs of files into " +
+                std::to_string(matcher->States()) + " states and " + std::to_string(matcher->Classes()) +
+                " byte classes in " + std::to_string(us) + " us");
+        m_Matcher = std::move(matcher);
+
+        // Kept next to the database, like the stat cache
+        std::string path = Cfg.get<std::string>("monitor.dbpath", "database.db") + ".tree";
+        m_Listing = std::make_unique<TreeListing>(path, globs);
+        m_Listing->Load();
+    }
+
+    return InitialiseSchedule();
+}
+
+// Classes of the schedule, files no class matches are checked every period
+bool Monitor::InitialiseSchedule()
+{
+    YAML::Node scheduleNode = Cfg.get<YAML::Node>("schedule", YAML::Node());
+    if (!scheduleNode.IsDefined() || scheduleNode.IsNull())
+        return true;
+    if (m_Watcher) {
+        logging::warn("schedule has no effect with events, files are hashed when they change");
+        return true;
+    }
+    if (m_Pacing) {
+        logging::warn("pacing has no effect with schedule, scheduled files are checked in small rounds already");
+        m_Pacing = false;
+    }
+
+    auto seconds = [](double value) {
+        return std::chrono::duration_cast<ScanScheduler::Clock::duration>(std::chrono::duration<double>(value));
+    };
+
+    std::vector<ScanScheduler::Class> classes;
+    for (const auto &entry : scheduleNode) {
+        ScanScheduler::Class &cls = classes.emplace_back();
+        cls.name = "schedule " + std::to_string(classes.size());
+        cls.files = entry["files"].as<std::vector<std::string>>();
+        if (cls.files.empty())
+            throw std::invalid_argument("files of " + cls.name + " must not be empty");
+
+        double interval = entry["interval"].as<double>();
+        if (!(interval > 0))
+            throw std::invalid_argument("interval of " + cls.name + " must be greater than 0");
+        cls.interval = seconds(interval);
+        double maxInterval = entry["max_interval"] ? entry["max_interval"].as<double>() : interval;
+        if (!(maxInterval >= interval))
+            throw std::invalid_argument("max_interval of " + cls.name + " must not be less than its interval");
+        cls.maxInterval = seconds(maxInterval);
+        if (entry["priority"])
+            cls.priority = ScanScheduler::ParsePriority(entry["priority"].as<std::string>());
+    }
+
+    // Files no class matches are checked every period, and the globs expanded
+    if (m_u64period == 0)
+        throw std::invalid_argument("monitor.period must be greater than 0 with schedule, it is the interval of the files no class matches");
+
+    ScanScheduler::Class defaults;
+    defaults.name = "period";
+    defaults.interval = std::chrono::seconds(m_u64period);
+    defaults.maxInterval = defaults.interval;
+    m_Scheduler = std::make_unique<ScanScheduler>(std::move(classes), std::move(defaults));
+
+    auto format = [](ScanScheduler::Clock::duration duration) {
+        std::ostringstream out;
+        out << std::chrono::duration<double>(duration).count();
+        return out.str();
+    };
+    for (const ScanScheduler::Class &cls : m_Scheduler->Classes()) {
+        logging::info("Files of " + cls.name + " are checked every " + format(cls.interval) + " seconds" +
+                (cls.maxInterval > cls.interval ? ", up to " + format(cls.maxInterval) + " while they do not change" : "") +
+                " with " + ScanScheduler::PriorityName(cls.priority) + " priority");
+    }
+
+    return true;
+}
+
+bool Monitor::InitialiseStatCache()
+{
+    // false by default
+    if (!Cfg.get<bool>("monitor.stat_cache", false))
+        return true;
+
+    // Everything the fingerprints depend on. When any of it changes, the
+    // cached files have to be hashed again to be compared with the baselines
+    std::string settings = m_hashAlgorhitm->Name() + "\n"
+        + std::to_string(m_ChunkThreshold) + "\n"
+        + std::to_string(m_ChunkSize) + "\n";
+    try {
+        settings += YAML::Dump(Cfg.get<YAML::Node>("filter"));
+    } catch (const std::runtime_error &e) {
+        // No filters
+    }
+    if (m_filters.empty())
+        settings += "\nno filters";
+
+    HashingAlgorithm::Context &ctx = m_hashAlgorhitm->ThreadContext();
+    ctx.Init();
+    ctx.Update(settings);
+
+    // Kept next to the database, whose baselines it refers to
+    std::string path = Cfg.get<std::string>("monitor.dbpath", "database.db") + ".statcache";
+    m_StatCache = std::make_unique<StatCache>(path, ctx.Final());
+    m_StatCache->Load();
+
     return true;
 }
 
@@ -4,6 +4,14 @@
 #include <Log.hpp>
 #include <cstdint>
 #include <DatabaseInterface.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <iterator>
+#include <thread>
+#include <unordered_set>
 
 using Q = DatabaseInterface::Action;
 
@@ -19,17 +27,81 @@ std::string hash8(const std::string& s) {
 
 extern volatile int _signal_Interrupt;
 
+// A file is hashed once no event came for it for the debounce, but a file
+// written to all the time not later than this many debounces after its first event
+static constexpr int DEBOUNCE_LIMIT = 10;
+// Longest wait for events, so an interrupt is noticed
+static constexpr int64_t MAX_WAIT_MS = 1000;
+
+// Sleeps until at on the monotonic clock, returns false when interrupted
+static bool SleepUntil(std::chrono::steady_clock::time_point at)
+{
+    while (!_signal_Interrupt) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= at)
+            return true;
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(at - now,
+                std::chrono::milliseconds(MAX_WAIT_MS)));
+    }
+    return false;
+}
+
 void Monitor::StartMonitoring()
 {
     logging::msg("Starting logging session");
 
+    if (m_Watcher) {
+        WatchEvents();
+        return;
+    }
+    if (m_Scheduler) {
+        RunScheduled();
+        return;
+    }
+
+    // Every scan starts a period after the one before it did, not after it
+    // ended, so the scans do not drift by the time they take
+    using Clock = std::chrono::steady_clock;
+    auto period = std::chrono::seconds(m_u64period);
+    Clock::time_point cycle = Clock::now();
     while (!_signal_Interrupt) {
         logging::msg("Running integrity scan");
-        RunScan();
-        SLEEP(m_u64period);
+        Clock::time_point deadline = cycle + period;
+        if (m_Pacing)
+            RunPacedScan(deadline);
+        else
+            RunScan();
+
+        Clock::time_point now = Clock::now();
+        if (now <= deadline) {
+            cycle = deadline;
+            SleepUntil(deadline);
+            continue;
+        }
+        // Late, the next scan starts right away
+        if (m_u64period > 0) {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - cycle).count();
+            logging::warn("[Monitor] Integrity scan took " + std::to_string(ms) + " ms, longer than the period of " +
+                    std::to_string(m_u64period) + " seconds");
+        }
+        cycle = now;
     }
 }
 
+// A round of scheduled checks aims to take this long, so files of high
+// priority becoming due wait for about this much at most
+static constexpr auto ROUND_TARGET = std::chrono::milliseconds(100);
+// Bytes a round starts with and never goes below, every file counts as
+// FILE_COST bytes on top of its size for opening and stat'ing it
+static constexpr uint64_t MIN_ROUND_BYTES = 4 * 1024 * 1024;
+static constexpr uint64_t FILE_COST = 16 * 1024;
+
+// Files below this size are grouped into one task
+static constexpr uint64_t SMALL_FILE_SIZE = 256 * 1024;
+// Limits of one group of small files
+static constexpr uint64_t SMALL_BATCH_BYTES = 4 * 1024 * 1024;
+static constexpr size_t SMALL_BATCH_FILES = 64;
+
 int Monitor::RunScan()
 {
     //- Compute a hash
@@ -38,53 +110,1074 @@ int Monitor::RunScan()
     //- Verify that the hashes are valid
     //    - If not, send a notify alert to the mailing manager
     //- Continue with next file until all files done
+    //
+    // Files are processed on the thread pool, see ScheduleScan
 
-    for (const std::string &file : m_files) {
-        // Compute a hash
-        std::string hashCompare = ComputeHash(file);
-        logging::info("Compare =  " + hashCompare);
+    if (m_Matcher)
+        ExpandFiles();
 
-        std::string filecode = hash8(file);
+    HashFiles(PrefilterScan());
+    FinishScan();
 
-        // Retrieve a hash from database
-        DatabaseQuery query = DatabaseInterface::Query(Modules, Q::SELECT, filecode);
-        if (query["status"] != "OK") {
-            logging::err("Database error: " + query["message"]);
-            continue;    
-        }
-        
-        std::string hashBaseline = query["hash"];
-        logging::info("Baseline = " + hashBaseline);
-        // This means that no baseline was found, so we insert the new baseline
-        if (hashBaseline == "NULL") {
-            logging::msg("Query for " + filecode + " returned NULL, inserting new baseline");
-            query = DatabaseInterface::Query(Modules, Q::INSERT, filecode, hashCompare);
-            if (query["status"] != "OK") {
-                logging::err("Database error: " + query["message"]);
+    return 0;
+}
+
+void Monitor::FinishScan()
+{
+    if (m_StatCache)
+        m_StatCache->Save();
+
+    if (!m_files.empty()) {
+        size_t window = (m_files.size() * m_VerifyPercent + 99) / 100;
+        m_VerifyCursor = (m_VerifyCursor + window) % m_files.size();
+    }
+    m_ScanCount++;
+}
+
+void Monitor::HashFiles(std::vector<ScanEntry> entries, std::vector<ScanEntry> urgent)
+{
+    std::vector<ThreadPool::Task> tasks;
+    for (std::vector<ScanEntry> &batch : ScheduleScan(std::move(urgent)))
+        tasks.push_back([this, batch = std::move(batch)] { ScanFiles(batch); });
+    for (std::vector<ScanEntry> &batch : ScheduleScan(std::move(entries)))
+        tasks.push_back([this, batch = std::move(batch)] { ScanFiles(batch); });
+
+    // Workers take the GIL back only for the database queries
+    py::gil_scoped_release release;
+    m_Pool->Run(std::move(tasks));
+}
+
+// Paced mode. The files are stat'ed up front to know how many bytes the
+// scan has to hash, and then hashed in slices of about ROUND_TARGET worth
+// of the period each. Every slice starts when the work before it would be
+// done if the whole scan were spread evenly until the deadline, so the disk
+// sees a steady trickle rather than a burst every period. Files are stat'ed
+// again right before their slice is hashed, and the plan follows the sizes
+// they have then. When the work does not fit, the slices run back to back
+void Monitor::RunPacedScan(std::chrono::steady_clock::time_point deadline)
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+
+    if (m_Matcher)
+        ExpandFiles();
+    std::vector<ScanEntry> planned = PrefilterScan();
+
+    auto cost = [](const ScanEntry &entry) {return FILE_COST + entry.stat.size;};
+    uint64_t total = 0;
+    for (const ScanEntry &entry : planned)
+        total += cost(entry);
+
+    // The last slice should be done by the deadline too
+    Clock::time_point begin = Clock::now();
+    Clock::duration window = std::max<Clock::duration>(deadline - begin - ROUND_TARGET, Clock::duration::zero());
+    double seconds = std::chrono::duration<double>(window).count();
+    // Share of the work one slice takes
+    double roundShare = std::min(std::chrono::duration<double>(ROUND_TARGET).count() / seconds, 1.0);
+    if (m_PacedRate > 0 && total / m_PacedRate > seconds) {
+        logging::warn("[Monitor] " + std::to_string(total / (1024 * 1024)) + " MB to hash take about " +
+                std::to_string(static_cast<uint64_t>(total / m_PacedRate)) + " seconds at the " +
+                std::to_string(static_cast<uint64_t>(m_PacedRate / (1024 * 1024))) + " MB/s of the last scan, " +
+                "more than the period allows. The files are hashed without pauses");
+    }
+
+    Clock::duration busy = begin - start;
+    uint64_t done = 0;
+    size_t slices = 0;
+    bool late = false;
+    for (size_t next = 0; next < planned.size();) {
+        // Where the work done so far ends when spread evenly
+        double share = total > 0 ? static_cast<double>(done) / total : 1.0;
+        if (!SleepUntil(begin + std::chrono::duration_cast<Clock::duration>(window * share)))
+            break;
+
+        Clock::time_point sliceStart = Clock::now();
+        uint64_t sliceBytes = std::max(static_cast<uint64_t>(total * roundShare), MIN_ROUND_BYTES);
+        std::vector<ScanEntry> slice;
+        uint64_t bytes = 0;
+        while (next < planned.size() && bytes < sliceBytes) {
+            const ScanEntry &plan = planned[next++];
+            ScanEntry entry;
+            bool hash = PrefilterFile(plan.index, entry);
+            uint64_t actual = hash ? cost(entry) : FILE_COST;
+            total = total - cost(plan) + actual;
+            bytes += actual;
+            if (hash)
+                slice.push_back(entry);
+        }
+
+        HashFiles(std::move(slice));
+        done += bytes;
+        slices++;
+        Clock::time_point sliceEnd = Clock::now();
+        busy += sliceEnd - sliceStart;
+
+        if (!late && sliceEnd > deadline && next < planned.size()) {
+            late = true;
+            logging::warn("[Monitor] Paced scan reached the end of the period with " +
+                    std::to_string(planned.size() - next) + " files left, hashing them without pauses");
+        }
+    }
+
+    double busySeconds = std::chrono::duration<double>(busy).count();
+    if (done > 0 && busySeconds > 0)
+        m_PacedRate = done / busySeconds;
+    logging::info("Paced scan checked " + std::to_string(done / (1024 * 1024)) + " MB in " + std::to_string(slices) +
+            " slices, busy " + std::to_string(static_cast<uint64_t>(busySeconds * 1000)) + " ms of " +
+            std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count()) + " ms");
+
+    FinishScan();
+}
+
+// Scheduled mode. Every period the globs are expanded again and a scan is
+// counted for the stat cache and the verification window. In between, a
+// file is checked whenever the schedule says it is due. Due files are
+// checked in rounds: files of high priority always go into the next round
+// and are hashed first, the others fill it up to a byte budget and the rest
+// waits for the rounds after it. The budget follows how long rounds take,
+// so a backlog of big files never holds back high priority files for much
+// longer than ROUND_TARGET. Files of normal and low priority bigger than the
+// budget are hashed in pieces instead, one file at a time, normal before
+// low. The piece of a round gets what the other files leave of the budget,
+// at least half of it
+void Monitor::RunScheduled()
+{
+    using Clock = ScanScheduler::Clock;
+    constexpr size_t HIGH = static_cast<size_t>(ScanScheduler::Priority::HIGH);
+    std::array<std::deque<size_t>, ScanScheduler::PRIORITIES> backlog;
+    std::array<std::deque<PieceHash>, ScanScheduler::PRIORITIES> pieces;
+    // Files hashed in part when the period ended, resumed when they come
+    // up again unchanged
+    std::unordered_map<std::string, PieceHash> paused;
+    auto period = std::chrono::seconds(m_u64period);
+    Clock::time_point nextPeriod = Clock::now();
+    uint64_t budget = MIN_ROUND_BYTES;
+    bool started = false;
+    size_t checked = 0;
+    size_t hashed = 0;
+    Clock::duration latest {};
+
+    while (!_signal_Interrupt) {
+        Clock::time_point now = Clock::now();
+        if (now >= nextPeriod) {
+            if (started) {
+                FinishScan();
+                logging::msg("Checked " + std::to_string(checked) + " scheduled files, hashed " + std::to_string(hashed) +
+                        " of them. The latest was checked " +
+                        std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(latest).count()) +
+                        " ms after it was due");
+            } else {
+                logging::msg("Running scheduled integrity checks");
             }
+            started = true;
+
+            paused.clear();
+            for (std::deque<PieceHash> &queue : pieces) {
+                for (PieceHash &piece : queue) {
+                    if (piece.offset > 0)
+                        paused.emplace(m_files[piece.entry.index], std::move(piece));
+                }
+                queue.clear();
+            }
+            if (m_Matcher)
+                ExpandFiles();
+            // Indices into m_files may have changed, the files not checked yet are due again
+            for (std::deque<size_t> &queue : backlog)
+                queue.clear();
+            m_Scheduler->SetFiles(m_files, Clock::now());
+            std::vector<size_t> counts = m_Scheduler->Counts();
+            std::string classes;
+            for (size_t i = 0; i < counts.size(); i++)
+                classes += (i ? ", " : "") + std::to_string(counts[i]) + " in " + m_Scheduler->Classes()[i].name;
+            logging::info("Scheduled files: " + classes);
+            checked = 0;
+            hashed = 0;
+            latest = Clock::duration::zero();
+
+            nextPeriod += period;
+            if (nextPeriod <= now)
+                nextPeriod = now + period;
             continue;
         }
 
-        if (hashCompare != hashBaseline) {
-            logging::warn("[Monitor] File " + file + " fingerprint does not match baseline, file may be compromised");
+        for (size_t index : m_Scheduler->Due(now))
+            backlog[static_cast<size_t>(m_Scheduler->PriorityOf(index))].push_back(index);
 
-            if (m_MailingEnabled) {
-                m_MailingManager->sendIncidentReport(filecode, "The computed fingerprint does not match an "
-                        "entry in one or more database. \nFile on path '" + file + "' may be "
-                        "compromised,\nit is recommended to verify the integrity of the files\n");
-            }
-        } else {
-            // Handle resolved incidents
-            if (m_MailingEnabled && m_MailingManager->isIncidentOngoing(filecode)) {
-                if (m_MailingNotifyWhenResolved) {
-                    m_MailingManager->sendIncidentResolved(filecode, "The incident has been resolved, further action may not be necessary\n");
+        std::vector<ScanEntry> taken;
+        std::vector<ScanEntry> urgent;
+        std::vector<ScanEntry> entries;
+        uint64_t bytes = 0;
+        bool piecing = std::any_of(pieces.begin(), pieces.end(),
+                [](const std::deque<PieceHash> &queue) { return !queue.empty(); });
+        uint64_t fill = piecing ? budget / 2 : budget;
+        for (size_t priority = 0; priority < backlog.size(); priority++) {
+            std::deque<size_t> &queue = backlog[priority];
+            while (!queue.empty() && (priority == HIGH || bytes < fill)) {
+                size_t index = queue.front();
+                queue.pop_front();
+                latest = std::max(latest, m_Scheduler->Lateness(index, now));
+
+                ScanEntry entry;
+                bool hash = PrefilterFile(index, entry);
+                bytes += FILE_COST;
+                if (hash && priority != HIGH && entry.stat.size > budget && IsResumable(entry)) {
+                    PieceHash &piece = pieces[priority].emplace_back();
+                    auto it = paused.find(m_files[index]);
+                    if (it != paused.end() && it->second.entry.stat == entry.stat)
+                        piece = std::move(it->second);
+                    if (it != paused.end())
+                        paused.erase(it);
+                    piece.entry = entry;
+                    continue;
                 }
-                m_MailingManager->markResolved(filecode);
+                taken.push_back(entry);
+                if (!hash)
+                    continue;
+                bytes += entry.stat.size;
+                (priority == HIGH ? urgent : entries).push_back(entry);
             }
         }
+
+        // Normal before low
+        auto active = std::find_if(pieces.begin(), pieces.end(),
+                [](const std::deque<PieceHash> &queue) { return !queue.empty(); });
+        PieceHash *piece = active != pieces.end() ? &active->front() : nullptr;
+
+        if (taken.empty() && !piece) {
+            std::this_thread::sleep_until(std::min({m_Scheduler->Next(), nextPeriod,
+                    now + std::chrono::milliseconds(MAX_WAIT_MS)}));
+            continue;
+        }
+
+        hashed += urgent.size() + entries.size();
+        checked += taken.size();
+        Clock::time_point start = Clock::now();
+        if (!urgent.empty() || !entries.empty())
+            HashFiles(std::move(entries), std::move(urgent));
+        bool pieceDone = false;
+        bool pieceFailed = false;
+        if (piece) {
+            try {
+                pieceDone = HashPiece(*piece, std::max(budget - std::min(bytes, budget), budget / 2));
+            } catch (const std::runtime_error &e) {
+                // What was hashed of it is dropped, the file is due again after its interval
+                ReportUnreadable(piece->entry, e.what());
+                pieceFailed = true;
+            }
+        }
+        Clock::time_point end = Clock::now();
+        for (const ScanEntry &entry : taken)
+            m_Scheduler->Done(entry.index, entry.stat, entry.statOk, end);
+        if (pieceDone || pieceFailed) {
+            m_Scheduler->Done(piece->entry.index, piece->entry.stat, piece->entry.statOk, end);
+            hashed += pieceDone;
+            checked++;
+            active->pop_front();
+        }
+
+        // Only a round the budget cut short tells whether the budget is too small
+        bool limited = (piece && !pieceDone && !pieceFailed) || std::any_of(backlog.begin() + HIGH + 1, backlog.end(),
+                [](const std::deque<size_t> &queue) { return !queue.empty(); });
+        if (limited && end - start < ROUND_TARGET / 2)
+            budget *= 2;
+        else if (end - start > ROUND_TARGET * 2)
+            budget = std::max(budget / 2, MIN_ROUND_BYTES);
     }
+}
 
-    return 0;
+// Event mode. Every full_scan_period, and right away when the kernel dropped
+// events, all files are checked like in a polling scan. In between, only the
+// files events were reported for are hashed, once they were quiet for the
+// debounce. When entries were created, deleted or moved, the files under
+// them are listed again first, which reports new and deleted files
+void Monitor::WatchEvents()
+{
+    using Clock = std::chrono::steady_clock;
+    struct Pending {
+        Clock::time_point first;
+        Clock::time_point last;
+        bool entry;
+    };
+    std::unordered_map<std::string, Pending> pending;
+    std::vector<ChangeWatcher::Event> events;
+    auto debounce = std::chrono::milliseconds(m_DebounceMs);
+    Clock::time_point nextScan = Clock::now();
+    bool complete = true;
+
+    while (!_signal_Interrupt) {
+        Clock::time_point now = Clock::now();
+        if (!complete || now >= nextScan) {
+            if (!complete)
+                logging::warn("[Monitor] File events were lost, running integrity scan");
+            else
+                logging::msg("Running integrity scan");
+            RunScan();
+            UpdateWatches();
+            // The scan checked them
+            pending.clear();
+            complete = true;
+            nextScan = Clock::now() + std::chrono::seconds(m_FullScanPeriod);
+            continue;
+        }
+
+        std::vector<std::string> due;
+        std::vector<std::string> entries;
+        Clock::time_point wake = nextScan;
+        for (auto it = pending.begin(); it != pending.end();) {
+            Clock::time_point at = std::min(it->second.last + debounce, it->second.first + debounce * DEBOUNCE_LIMIT);
+            if (at > now) {
+                wake = std::min(wake, at);
+                ++it;
+                continue;
+            }
+            if (it->second.entry)
+                entries.push_back(it->first);
+            due.push_back(it->first);
+            it = pending.erase(it);
+        }
+        if (!due.empty()) {
+            ScanChanged(due, std::move(entries));
+            continue;
+        }
+
+        int64_t wait = std::chrono::ceil<std::chrono::milliseconds>(wake - now).count();
+        events.clear();
+        complete = m_Watcher->Read(static_cast<int>(std::clamp<int64_t>(wait, 0, MAX_WAIT_MS)), events);
+        now = Clock::now();
+        for (const ChangeWatcher::Event &event : events) {
+            if (!IsWatched(event))
+                continue;
+            // A file the globs match that is not known yet has to be listed
+            bool entry = event.entry || !m_FileIndex.contains(event.path);
+            auto [it, added] = pending.try_emplace(event.path, Pending{now, now, entry});
+            if (!added) {
+                it->second.last = now;
+                it->second.entry |= entry;
+            }
+        }
+    }
+}
+
+// Hashes the files events were reported for. The stat cache is not asked,
+// the events tell they changed, and it is saved by the full scans only: an
+// entry that was not saved means the file is hashed once more after a restart
+void Monitor::ScanChanged(const std::vector<std::string> &files, std::vector<std::string> entries)
+{
+    if (!entries.empty() && m_Matcher) {
+        if (m_Listing->Known()) {
+            RelistEntries(std::move(entries));
+        } else {
+            ExpandFiles();
+            UpdateWatches();
+        }
+    }
+
+    std::vector<ScanEntry> changed;
+    for (const std::string &file : files) {
+        auto it = m_FileIndex.find(file);
+        if (it == m_FileIndex.end())
+            continue;
+
+        ScanEntry entry;
+        entry.index = it->second;
+        entry.statOk = FileStat::Read(file, entry.stat);
+        // Deleted, RelistEntries reported the files of directories and globs.
+        // A file deleted after this stat fails to be hashed, see ReportUnreadable
+        if (!entry.statOk) {
+            if (entry.index < m_LiteralFiles)
+                ReportTreeChange(file, false);
+            continue;
+        }
+        changed.push_back(entry);
+    }
+
+    logging::msg("Checking " + std::to_string(changed.size()) + " changed files");
+    HashFiles(std::move(changed));
+}
+
+// Files of the previous listing under a directory that could not be read
+// are not known to be gone, they stay in found, which is sorted
+static void KeepUnreadable(std::vector<std::string> &found, const std::vector<std::string> &unreadable,
+        const std::vector<std::string> &previous)
+{
+    size_t middle = found.size();
+    for (const std::string &directory : unreadable) {
+        std::string prefix = directory.empty() || directory.ends_with("/") ? directory : directory + "/";
+        auto it = std::lower_bound(previous.begin(), previous.end(), prefix);
+        for (; it != previous.end() && it->starts_with(prefix); it++) {
+            // Relative roots only have relative files
+            if (!prefix.empty() || !it->starts_with("/"))
+                found.push_back(*it);
+        }
+    }
+    if (found.size() == middle)
+        return;
+
+    std::sort(found.begin() + middle, found.end());
+    std::inplace_merge(found.begin(), found.begin() + middle, found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+}
+
+// Files of the sorted listing that are path or under it
+static std::vector<std::string> ListedUnder(const std::vector<std::string> &listed, const std::string &path)
+{
+    std::vector<std::string> files;
+    if (std::binary_search(listed.begin(), listed.end(), path))
+        files.push_back(path);
+    std::string prefix = path + "/";
+    auto it = std::lower_bound(listed.begin(), listed.end(), prefix);
+    for (; it != listed.end() && it->starts_with(prefix); it++)
+        files.push_back(*it);
+    return files;
+}
+
+// Instead of expanding all globs again, only the entries events were reported
+// for are looked at: a directory is walked, a file is listed when the globs
+// match it. What they had under them in the listing and do not have any more
+// is reported as deleted, what they have that it did not as new
+void Monitor::RelistEntries(std::vector<std::string> entries)
+{
+    // An entry under another one is walked with it
+    std::sort(entries.begin(), entries.end());
+    std::vector<std::string> listed = m_Listing->Files();
+    std::vector<std::string> added;
+    std::vector<std::string> deleted;
+    bool watchesChanged = false;
+    const std::string *outer = nullptr;
+
+    for (const std::string &entry : entries) {
+        if (outer && entry.starts_with(*outer + "/"))
+            continue;
+        outer = &entry;
+
+        std::vector<std::string> found;
+        std::vector<std::string> walked;
+        std::error_code ec;
+        if (std::filesystem::symlink_status(entry, ec).type() == std::filesystem::file_type::directory) {
+            TreeWalker::Stats stats;
+            found = TreeWalker(*m_Pool).ExpandUnder(*m_Matcher, entry, &stats, &walked);
+            KeepUnreadable(found, stats.unreadable, listed);
+        } else if (m_Matcher->MatchesPath(entry) && std::filesystem::is_regular_file(entry, ec)) {
+            found.push_back(entry);
+        }
+        std::erase_if(found, [this](const std::string &file) {
+            auto it = m_FileIndex.find(file);
+            return it != m_FileIndex.end() && it->second < m_LiteralFiles;
+        });
+
+        std::vector<std::string> known = ListedUnder(listed, entry);
+        size_t addedBefore = added.size();
+        size_t deletedBefore = deleted.size();
+        std::set_difference(found.begin(), found.end(), known.begin(), known.end(), std::back_inserter(added));
+        std::set_difference(known.begin(), known.end(), found.begin(), found.end(), std::back_inserter(deleted));
+
+        std::vector<std::string> kept;
+        kept.reserve(listed.size() + added.size() - addedBefore);
+        std::set_difference(listed.begin(), listed.end(), deleted.begin() + deletedBefore, deleted.end(),
+                std::back_inserter(kept));
+        listed.clear();
+        std::merge(kept.begin(), kept.end(), added.begin() + addedBefore, added.end(), std::back_inserter(listed));
+
+        // Directories under the entry are watched when it is one, they may
+        // have been watched before
+        std::vector<std::string> unwatched;
+        std::erase_if(m_TreeDirectories, [&entry, &unwatched](const std::string &directory) {
+            bool under = directory == entry || directory.starts_with(entry + "/");
+            if (under)
+                unwatched.push_back(directory);
+            return under;
+        });
+        std::sort(unwatched.begin(), unwatched.end());
+        std::sort(walked.begin(), walked.end());
+        watchesChanged |= unwatched != walked;
+        m_TreeDirectories.insert(m_TreeDirectories.end(), walked.begin(), walked.end());
+    }
+
+    logging::info("Listed " + std::to_string(entries.size()) + " changed entries again, " + std::to_string(added.size()) +
+            " files appeared and " + std::to_string(deleted.size()) + " were deleted");
+
+    for (const std::string &file : deleted) {
+        ReportTreeChange(file, false);
+        if (m_StatCache)
+            m_StatCache->Erase(file);
+
+        // The last file takes its place
+        auto it = m_FileIndex.find(file);
+        if (it == m_FileIndex.end())
+            continue;
+        size_t index = it->second;
+        m_FileIndex.erase(it);
+        if (index != m_files.size() - 1) {
+            m_files[index] = std::move(m_files.back());
+            m_FileIndex[m_files[index]] = index;
+        }
+        m_files.pop_back();
+    }
+    for (const std::string &file : added) {
+        ReportTreeChange(file, true);
+        if (m_FileIndex.emplace(file, m_files.size()).second)
+            m_files.push_back(file);
+    }
+    m_Listing->Save(listed);
+
+    if (watchesChanged)
+        UpdateWatches();
+}
+
+// Watches the directories of the listed files and the ones the globs were
+// expanded from, and indexes m_files by path for the events
+void Monitor::UpdateWatches()
+{
+    m_FileIndex.clear();
+    m_FileIndex.reserve(m_files.size());
+    std::vector<std::string> directories = m_TreeDirectories;
+    for (size_t i = 0; i < m_files.size(); i++) {
+        m_FileIndex.emplace(m_files[i], i);
+        if (i < m_LiteralFiles)
+            directories.push_back(std::filesystem::path(m_files[i]).parent_path().string());
+    }
+    std::sort(directories.begin(), directories.end());
+    directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
+
+    size_t unwatched = m_Watcher->Watch(directories);
+    if (unwatched > 0 && unwatched != m_Unwatched) {
+        logging::warn("[Monitor] " + std::to_string(unwatched) + " of " + std::to_string(directories.size()) +
+                " directories can not be watched with " + m_Watcher->Name() + ", changes under them are only "
+                "found by the full scans. fanotify does not need a watch for every directory");
+    }
+    m_Unwatched = unwatched;
+}
+
+// Whether an event is about a monitored file, or an entry under which the
+// globs may match files
+bool Monitor::IsWatched(const ChangeWatcher::Event &event) const
+{
+    if (m_FileIndex.contains(event.path))
+        return true;
+    if (!m_Matcher)
+        return false;
+    if (event.directory)
+        return event.entry && m_Matcher->RootState(event.path) != PathMatcher::DEAD;
+    return m_Matcher->MatchesPath(event.path);
+}
+
+void Monitor::ExpandFiles()
+{
+    auto start = std::chrono::steady_clock::now();
+    TreeWalker::Stats stats;
+    std::vector<std::string> found = TreeWalker(*m_Pool).Expand(*m_Matcher, &stats,
+            m_Watcher ? &m_TreeDirectories : nullptr);
+    if (m_Listing->Known())
+        KeepUnreadable(found, stats.unreadable, m_Listing->Files());
+
+    // Literal entries stay where they are and are not reported when they
+    // appear or disappear
+    m_files.resize(m_LiteralFiles);
+    std::unordered_set<std::string> literal(m_files.begin(), m_files.end());
+    std::erase_if(found, [&literal](const std::string &file) { return literal.contains(file); });
+
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    logging::info("Globs matched " + std::to_string(found.size()) + " files, " + std::to_string(stats.entries) +
+            " entries of " + std::to_string(stats.directories) + " directories were read in " + std::to_string(ms) + " ms");
+    if (stats.errors > 0)
+        logging::warn("[Monitor] " + std::to_string(stats.errors) + " directories could not be read, "
+                "files listed under them before are kept");
+
+    // Nothing to compare with on the first run, or when the globs changed
+    if (m_Listing->Known()) {
+
+        const std::vector<std::string> &previous = m_Listing->Files();
+        std::vector<std::string> added;
+        std::vector<std::string> deleted;
+        std::set_difference(found.begin(), found.end(), previous.begin(), previous.end(), std::back_inserter(added));
+        std::set_difference(previous.begin(), previous.end(), found.begin(), found.end(), std::back_inserter(deleted));
+
+        for (const std::string &file : added)
+            ReportTreeChange(file, true);
+        for (const std::string &file : deleted) {
+            ReportTreeChange(file, false);
+            if (m_StatCache)
+                m_StatCache->Erase(file);
+        }
+    }
+    m_Listing->Save(found);
+
+    m_files.insert(m_files.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+}
+
+// New files get an incident of their own, a deleted file the one of its
+// fingerprint, so restoring it unchanged resolves it
+void Monitor::ReportTreeChange(const std::string &file, bool added)
+{
+    std::string filecode = hash8(file);
+    if (added) {
+        logging::warn("[Monitor] New file " + file + " appeared in a monitored directory");
+        if (m_MailingEnabled) {
+            m_MailingManager->sendIncidentReport(filecode + ".new", "A new file appeared on path '" + file +
+                    "'.\nIt is recommended to verify that it was meant to be there\n");
+        }
+        return;
+    }
+
+    logging::warn("[Monitor] File " + file + " was deleted from a monitored directory");
+    if (m_MailingEnabled) {
+        m_MailingManager->sendIncidentReport(filecode, "File on path '" + file + "' was deleted,\n"
+                "it is recommended to verify the integrity of the files\n");
+    }
+}
+
+// Stats the monitored files and returns the ones that have to be checked.
+// With the stat cache, a file is skipped when its metadata is the same as
+// when it last matched its baseline, unless it is due for verification
+std::vector<Monitor::ScanEntry> Monitor::PrefilterScan()
+{
+    std::vector<ScanEntry> entries;
+    entries.reserve(m_files.size());
+    size_t skipped = 0;
+
+    for (size_t i = 0; i < m_files.size(); i++) {
+        ScanEntry entry;
+        if (PrefilterFile(i, entry))
+            entries.push_back(entry);
+        else if (entry.statOk)
+            skipped++;
+    }
+
+    if (m_StatCache)
+        logging::info("Stat cache: " + std::to_string(skipped) + " of " + std::to_string(m_files.size()) +
+                " files did not change and will not be hashed");
+
+    return entries;
+}
+
+bool Monitor::PrefilterFile(size_t index, ScanEntry &entry) const
+{
+    const std::string &file = m_files[index];
+    entry.index = index;
+    entry.statOk = FileStat::Read(file, entry.stat);
+    // Deleted since the globs were expanded, reported on the next scan
+    if (!entry.statOk && index >= m_LiteralFiles)
+        return false;
+
+    // Any other metadata, a different size included, only means the file has
+    // to be hashed: its digest may still match, like one of a file that just
+    // got a newline at its end
+    FileStat cached;
+    if (m_StatCache && entry.statOk && m_StatCache->Get(file, cached) && cached == entry.stat && !VerifyThisScan(index))
+        return false;
+    return true;
+}
+
+bool Monitor::VerifyThisScan(size_t index) const
+{
+    if (m_VerifyEvery > 0 && (m_ScanCount + 1) % m_VerifyEvery == 0)
+        return true;
+
+    // Rotating window of verify_percent of the files, moved every scan
+    size_t window = (m_files.size() * m_VerifyPercent + 99) / 100;
+    size_t offset = (index + m_files.size() - m_VerifyCursor) % m_files.size();
+    return offset < window;
+}
+
+// Groups the files into tasks for the thread pool. Big files get
+// a task each and are started first, so the scan is not left waiting for one
+// big file at the end. Small files are batched together so the per task
+// overhead does not dominate. Workers start with the biggest tasks and idle
+// workers steal the smallest ones from the back of the busy workers' queues.
+std::vector<std::vector<Monitor::ScanEntry>> Monitor::ScheduleScan(std::vector<ScanEntry> entries) const
+{
+    // Size of files that could not be stat'ed is 0
+    std::stable_sort(entries.begin(), entries.end(),
+            [](const ScanEntry &a, const ScanEntry &b) { return a.stat.size > b.stat.size; });
+
+    std::vector<std::vector<ScanEntry>> batches;
+    uint64_t smallBytes = 0;
+    for (ScanEntry &entry : entries) {
+        uint64_t size = entry.stat.size;
+        if (size >= SMALL_FILE_SIZE) {
+            batches.push_back({entry});
+            continue;
+        }
+
+        if (smallBytes == 0 || smallBytes + size > SMALL_BATCH_BYTES
+                || batches.back().size() >= SMALL_BATCH_FILES) {
+            batches.emplace_back();
+            smallBytes = 0;
+        }
+        batches.back().push_back(entry);
+        // Count empty files as well so the batch is always started
+        smallBytes += size + 1;
+    }
+
+    return batches;
+}
+
+// Runs on a pool worker
+void Monitor::ScanFiles(const std::vector<ScanEntry> &batch)
+{
+    // Huge files are split into chunks hashed in parallel by the whole pool
+    std::vector<const ScanEntry*> rest;
+    for (const ScanEntry &entry : batch) {
+        const std::string &file = m_files[entry.index];
+
+        if (!entry.statOk || !IsChunked(file, entry.stat.size)) {
+            rest.push_back(&entry);
+            continue;
+        }
+
+        ChunkedDigest digest;
+        try {
+            digest = m_hashAlgorhitm->RunChunked(file, entry.stat.size, m_ChunkSize, *m_Pool);
+        } catch (const std::runtime_error &e) {
+            ReportUnreadable(entry, e.what());
+            continue;
+        }
+        UpdateStatCache(entry, CheckFile(file, digest.root, &digest));
+    }
+
+    // With io_uring, the whole batch is read with many reads in flight
+    if (!m_Uring.empty()) {
+        std::vector<std::string> files;
+        for (const ScanEntry *entry : rest)
+            files.push_back(m_files[entry->index]);
+
+        UringScanner &uring = *m_Uring[ThreadPool::WorkerIndex()];
+        std::vector<UringScanner::Result> results = uring.Run(files, *m_hashAlgorhitm, m_filters);
+        for (size_t i = 0; i < files.size(); i++) {
+            if (!results[i].error.empty())
+                ReportUnreadable(*rest[i], results[i].error);
+            else
+                UpdateStatCache(*rest[i], CheckFile(files[i], results[i].hash));
+        }
+        return;
+    }
+
+    // The algorithm may hash the small files of the batch all at once
+    std::vector<std::string> files;
+    for (const ScanEntry *entry : rest)
+        files.push_back(m_files[entry->index]);
+
+    std::vector<std::string> errors;
+    std::vector<std::string> hashes = m_hashAlgorhitm->TryRunBatch(files, m_filters, errors);
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!errors[i].empty())
+            ReportUnreadable(*rest[i], errors[i]);
+        else
+            UpdateStatCache(*rest[i], CheckFile(files[i], hashes[i]));
+    }
+}
+
+// Whether the file is big enough to be hashed in chunks
+bool Monitor::IsChunked(const std::string &file, uint64_t size) const
+{
+    // Filters work on lines, chunks would split them
+    if (m_ChunkThreshold == 0 || m_filters.contains(file))
+        return false;
+
+    return size >= m_ChunkThreshold;
+}
+
+// YAML keys filters parse the whole document and bytes filters read only
+// some ranges of the file, such files are hashed at once
+bool Monitor::IsResumable(const ScanEntry &entry) const
+{
+    if (!entry.statOk)
+        return false;
+
+    auto it = m_filters.find(m_files[entry.index]);
+    if (it == m_filters.end())
+        return true;
+    const FilterKeys *keys = it->second.Keys();
+    return !it->second.Bytes() && !(keys && keys->DocumentFormat() == FilterKeys::Format::YAML);
+}
+
+// The digest of the file is kept between the pieces, the file is opened
+// again for every piece so no reader stays open between rounds. Chunked
+// files get as many more of their leaves as bytes cover, at least one
+bool Monitor::HashPiece(PieceHash &piece, uint64_t bytes)
+{
+    const std::string &file = m_files[piece.entry.index];
+    uint64_t size = piece.entry.stat.size;
+
+    if (IsChunked(file, size)) {
+        std::vector<std::string> &leaves = piece.chunks.leaves;
+        if (leaves.empty()) {
+            piece.chunks.chunkSize = m_ChunkSize;
+            leaves.resize(std::max<uint64_t>((size + m_ChunkSize - 1) / m_ChunkSize, 1));
+        }
+        uint64_t first = piece.offset / m_ChunkSize;
+        uint64_t last = std::min<uint64_t>(first + std::max<uint64_t>(bytes / m_ChunkSize, 1), leaves.size());
+
+        std::vector<ThreadPool::Task> tasks;
+        for (uint64_t i = first; i < last; i++) {
+            tasks.push_back([&, i] {
+                uint64_t offset = i * m_ChunkSize;
+                leaves[i] = SHAFileUtil::MerkleLeaf(file, offset, std::min(m_ChunkSize, size - offset),
+                        m_hashAlgorhitm->ThreadContext());
+            });
+        }
+        {
+            py::gil_scoped_release release;
+            m_Pool->Run(std::move(tasks));
+        }
+        piece.offset = last * m_ChunkSize;
+        if (last < leaves.size())
+            return false;
+
+        piece.chunks.root = m_hashAlgorhitm->MerkleRoot(leaves);
+        UpdateStatCache(piece.entry, CheckFile(file, piece.chunks.root, &piece.chunks));
+        return true;
+    }
+
+    if (!piece.digest) {
+        piece.ctx = m_hashAlgorhitm->NewContext();
+        piece.digest = std::make_unique<FileDigest>(*piece.ctx, file, m_filters);
+    }
+    std::unique_ptr<FileReader> reader = FileReader::OpenRange(file, piece.offset, bytes);
+    std::string_view chunk;
+    uint64_t read = 0;
+    while (reader->Next(chunk)) {
+        piece.digest->Update(chunk);
+        read += chunk.size();
+    }
+    piece.offset += read;
+    // Read up to the end of the file like a whole file hash, also when it grew
+    if (read == bytes)
+        return false;
+
+    UpdateStatCache(piece.entry, CheckFile(file, piece.digest->Final()));
+    return true;
+}
+
+// Remembers the metadata of files that matched their baseline. The file was
+// stat'ed before it was read, so a change made while it was hashed shows up
+// as different metadata on the next scan
+void Monitor::UpdateStatCache(const ScanEntry &entry, bool matched)
+{
+    if (!m_StatCache)
+        return;
+
+    if (matched && entry.statOk)
+        m_StatCache->Set(m_files[entry.index], entry.stat);
+    else
+        m_StatCache->Erase(m_files[entry.index]);
+}
+
+// Files that matched a directory or glob may just not be readable by the
+// monitor, like /etc/shadow under /etc/** when it does not run as root, or
+// were deleted since they were listed, which the next listing reports. One
+// bad file must not stop the scan of the others. Listed files are expected
+// to be there, they are reported every time, as deleted once they are gone
+void Monitor::ReportUnreadable(const ScanEntry &entry, const std::string &error)
+{
+    const std::string &file = m_files[entry.index];
+    UpdateStatCache(entry, false);
+    FileStat stat;
+    bool exists = FileStat::Read(file, stat);
+
+    if (entry.index < m_LiteralFiles) {
+        if (!exists) {
+            ReportTreeChange(file, false);
+            return;
+        }
+        logging::err("[Monitor] File " + file + " could not be hashed: " + error);
+        if (m_MailingEnabled) {
+            m_MailingManager->sendIncidentReport(hash8(file) + ".unreadable", "File on path '" + file +
+                    "' could not be read: " + error + "\nIt is recommended to verify the integrity of the files\n");
+        }
+        return;
+    }
+
+    // Deleted since it was listed
+    if (!exists)
+        return;
+    std::lock_guard<std::mutex> lock(m_UnreadableMutex);
+    if (m_Unreadable.insert(file).second)
+        logging::warn("[Monitor] Skipping " + file + ", it could not be hashed: " + error);
+}
+
+// Leaves are stored as "<chunk size>:<leaf>,<leaf>,..."
+static std::string EncodeLeaves(const ChunkedDigest &digest)
+{
+    std::string encoded = std::to_string(digest.chunkSize) + ":";
+    for (size_t i = 0; i < digest.leaves.size(); i++) {
+        if (i > 0)
+            encoded += ",";
+        encoded += digest.leaves[i];
+    }
+    return encoded;
+}
+
+// Describes which byte ranges differ between the baseline leaves and the
+// current ones. Returns an empty string when it can not be told
+static std::string ChangedRanges(const ChunkedDigest &digest, const std::string &encoded)
+{
+    size_t colon = encoded.find(':');
+    if (colon == std::string::npos)
+        return "";
+
+    uint64_t chunkSize = 0;
+    try {
+        chunkSize = std::stoull(encoded.substr(0, colon));
+    } catch (const std::exception &) {
+        return "";
+    }
+    // Chunk size changed in the config, leaves can not be compared
+    if (chunkSize != digest.chunkSize)
+        return "";
+
+    std::vector<std::string> baseline;
+    std::stringstream ss(encoded.substr(colon + 1));
+    std::string leaf;
+    while (std::getline(ss, leaf, ','))
+        baseline.push_back(leaf);
+
+    // Consecutive changed chunks are merged into one range
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    size_t count = std::max(baseline.size(), digest.leaves.size());
+    for (size_t i = 0; i < count; i++) {
+        if (i < baseline.size() && i < digest.leaves.size() && baseline[i] == digest.leaves[i])
+            continue;
+
+        uint64_t begin = i * chunkSize;
+        uint64_t end = begin + chunkSize - 1;
+        if (!ranges.empty() && ranges.back().second + 1 == begin)
+            ranges.back().second = end;
+        else
+            ranges.emplace_back(begin, end);
+    }
+
+    std::string result;
+    for (const auto &[begin, end] : ranges) {
+        if (!result.empty())
+            result += ", ";
+        result += std::to_string(begin) + "-" + std::to_string(end);
+    }
+    if (baseline.size() != digest.leaves.size())
+        result += " (file size changed)";
+    return result;
+}
+
+// Compares the computed hash with the baseline and reports incidents.
+// chunks is set for files hashed in chunks, see IsChunked
+bool Monitor::CheckFile(const std::string &file, const std::string &hashCompare, const ChunkedDigest *chunks)
+{
+    logging::info("Compare =  " + hashCompare);
+
+    std::string filecode = hash8(file);
+
+    // One digest per configured algorithm, each with its own baseline
+    std::vector<std::string> digests = HashingAlgorithmMulti::Split(hashCompare);
+    std::vector<std::string> baselines(digests.size());
+    size_t found = 0;
+    size_t mismatched = 0;
+    bool lengthChanged = false;
+
+    // Retrieve the hashes from database
+    for (size_t i = 0; i < digests.size(); i++) {
+        DatabaseQuery query = DatabaseInterface::Query(Modules, Q::SELECT, DigestKey(filecode, i));
+        if (query["status"] != "OK") {
+            logging::err("Database error: " + query["message"]);
+            return false;
+        }
+
+        baselines[i] = query["hash"];
+        logging::info("Baseline = " + baselines[i]);
+        if (baselines[i] == "NULL")
+            continue;
+
+        found++;
+        if (digests[i] != baselines[i]) {
+            mismatched++;
+            // Like baselines of blake2s 256, which used to be SHA-512
+            if (digests[i].size() != baselines[i].size())
+                lengthChanged = true;
+        }
+    }
+
+    bool mismatch = m_MismatchAll ? found > 0 && mismatched == found : mismatched > 0;
+
+    if (mismatch) {
+        // For chunked files, tell which parts of the file changed
+        std::string ranges;
+        if (chunks) {
+            DatabaseQuery query = DatabaseInterface::Query(Modules, Q::SELECTLEAVES, filecode);
+            if (query["status"] == "OK" && query["leaves"] != "NULL")
+                ranges = ChangedRanges(*chunks, query["leaves"]);
+        }
+
+        std::string details = ranges.empty() ? "" : "Changed byte ranges: " + ranges;
+        if (lengthChanged)
+            details = "The baseline was created with a different algorithm or key length";
+
+        ReportMismatch(file, filecode, details);
+        return false;
+    }
+
+    if (mismatched > 0) {
+        // Only with mismatch "all". Not an incident, but not trusted enough
+        // to store baselines or to be skipped by the stat cache
+        for (size_t i = 0; i < digests.size(); i++) {
+            if (baselines[i] != "NULL" && digests[i] != baselines[i])
+                logging::warn("[Monitor] File " + file + " " + m_DigestNames[i] + " fingerprint does not match baseline, the other ones do");
+        }
+        return false;
+    }
+
+    // This means that no baseline was found, so we insert the new baseline.
+    // New files get all of them, files whose digests matched get the ones of
+    // algorithms added to the configuration since
+    for (size_t i = 0; i < digests.size(); i++) {
+        if (baselines[i] != "NULL")
+            continue;
+
+        std::string key = DigestKey(filecode, i);
+        logging::msg("Query for " + key + " returned NULL, inserting new baseline");
+        DatabaseQuery query = DatabaseInterface::Query(Modules, Q::INSERT, key, digests[i]);
+        if (query["status"] != "OK") {
+            logging::err("Database error: " + query["message"]);
+            return false;
+        }
+    }
+    // Leaves hold every digest, they are stored again with new ones
+    if (found < digests.size() && chunks) {
+        DatabaseQuery query = DatabaseInterface::Query(Modules, Q::INSERTLEAVES, filecode, EncodeLeaves(*chunks));
+        if (query["status"] != "OK") {
+            logging::err("Database error: " + query["message"]);
+        }
+    }
+
+    // Handle resolved incidents
+    if (found > 0 && m_MailingEnabled && m_MailingManager->isIncidentOngoing(filecode)) {
+        if (m_MailingNotifyWhenResolved) {
+            m_MailingManager->sendIncidentResolved(filecode, "The incident has been resolved, further action may not be necessary\n");
+        }
+        m_MailingManager->markResolved(filecode);
+    }
+    return true;
+}
+
+// The first digest keeps the key of single digest baselines, so they stay
+// valid when algorithms are added after it
+std::string Monitor::DigestKey(const std::string &filecode, size_t digest) const
+{
+    if (digest == 0)
+        return filecode;
+    return filecode + "." + m_DigestNames[digest];
+}
+
+// details, when not empty, tell more about what changed
+void Monitor::ReportMismatch(const std::string &file, const std::string &filecode, const std::string &details)
+{
+    logging::warn("[Monitor] File " + file + " fingerprint does not match baseline, file may be compromised" +
+            (details.empty() ? "" : ". " + details));
+
+    if (m_MailingEnabled) {
+        m_MailingManager->sendIncidentReport(filecode, "The computed fingerprint does not match an "
+                "entry in one or more database. \nFile on path '" + file + "' may be "
+                "compromised,\nit is recommended to verify the integrity of the files\n" +
+                (details.empty() ? "" : details + "\n"));
+    }
 }
 
 std::string Monitor::ComputeHash(const std::string &filename)
@@ -0,0 +1,407 @@
+#include <PathMatcher.hpp>
+
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <unordered_map>
+
+// DFA states at most, each of them takes Classes() transitions
+static constexpr size_t MAX_STATES = 100000;
+
+static bool HasWildcards(std::string_view text)
+{
+    return text.find_first_of("*?[") != std::string_view::npos;
+}
+
+// Length of the [...] expression at the start of pattern, 0 when it is not
+// closed and the [ is just a character
+static size_t SetLength(std::string_view pattern)
+{
+    size_t i = 1;
+    if (i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^'))
+        i++;
+    // ] right after the [ is part of the set
+    if (i < pattern.size() && pattern[i] == ']')
+        i++;
+    size_t close = pattern.find(']', i);
+    return close == std::string_view::npos ? 0 : close + 1;
+}
+
+// Characters of a [...] expression. Never /, it separates names
+static std::array<bool, 256> ParseSet(std::string_view expression)
+{
+    bool negated = expression[1] == '!' || expression[1] == '^';
+    std::string_view set = expression.substr(1 + negated, expression.size() - 2 - negated);
+
+    std::array<bool, 256> chars {};
+    for (size_t i = 0; i < set.size(); i++) {
+        unsigned char first = set[i];
+        unsigned char last = first;
+        if (i + 2 < set.size() && set[i + 1] == '-') {
+            last = set[i + 2];
+            i += 2;
+        }
+        for (unsigned c = first; c <= last; c++)
+            chars[c] = true;
+    }
+
+    if (negated) {
+        for (bool &in : chars)
+            in = !in;
+    }
+    chars['/'] = false;
+    return chars;
+}
+
+PathMatcher::PathMatcher()
+{
+    m_Nodes.resize(2);
+}
+
+bool PathMatcher::IsGlob(const std::string &entry)
+{
+    if (HasWildcards(entry) || entry.ends_with("/"))
+        return true;
+
+    std::error_code ec;
+    return std::filesystem::is_directory(entry, ec);
+}
+
+// Splits the glob into atoms, the / between names included. root, when set,
+// gets the names before the first one with wildcards
+std::vector<PathMatcher::Atom> PathMatcher::Parse(const std::string &pattern, std::string *root)
+{
+    std::vector<std::string> parts;
+    size_t pos = 0;
+    while (pos <= pattern.size()) {
+        size_t slash = pattern.find('/', pos);
+        if (slash == std::string::npos)
+            slash = pattern.size();
+        // Repeated and trailing slashes
+        if (slash > pos)
+            parts.push_back(pattern.substr(pos, slash - pos));
+        pos = slash + 1;
+    }
+
+    bool absolute = pattern.starts_with("/");
+    if (root) {
+        *root = absolute ? "/" : "";
+        for (size_t i = 0; i < parts.size() && !HasWildcards(parts[i]); i++) {
+            if (i > 0)
+                *root += "/";
+            *root += parts[i];
+        }
+    }
+
+    std::vector<Atom> atoms;
+    if (absolute)
+        atoms.push_back({Kind::CHAR, '/'});
+
+    for (size_t i = 0; i < parts.size(); i++) {
+        const std::string &part = parts[i];
+        bool last = i + 1 == parts.size();
+        if (part == "**") {
+            // Consecutive ** are the same as one
+            if (!last && parts[i + 1] == "**")
+                continue;
+            // Takes the / after it along
+            atoms.push_back({last ? Kind::REST : Kind::DEEP});
+            continue;
+        }
+
+        for (size_t p = 0; p < part.size(); p++) {
+            char c = part[p];
+            size_t length = c == '[' ? SetLength(std::string_view(part).substr(p)) : 0;
+            if (c == '*') {
+                if (atoms.empty() || atoms.back().kind != Kind::STAR)
+                    atoms.push_back({Kind::STAR});
+            } else if (c == '?') {
+                atoms.push_back({Kind::ONE});
+            } else if (length > 0) {
+                std::array<bool, 256> set = ParseSet(std::string_view(part).substr(p, length));
+                auto it = std::find(m_Sets.begin(), m_Sets.end(), set);
+                if (it == m_Sets.end())
+                    it = m_Sets.insert(m_Sets.end(), set);
+                atoms.push_back({Kind::SET, 0, static_cast<uint32_t>(it - m_Sets.begin())});
+                p += length - 1;
+            } else {
+                atoms.push_back({Kind::CHAR, static_cast<unsigned char>(c)});
+            }
+        }
+        if (!last)
+            atoms.push_back({Kind::CHAR, '/'});
+    }
+    return atoms;
+}
+
+void PathMatcher::Include(const std::string &pattern)
+{
+    if (m_Compiled)
+        throw std::runtime_error("Globs can not be added to a compiled matcher");
+    if (pattern.empty())
+        throw std::invalid_argument("Glob can not be empty");
+
+    std::string root;
+    std::vector<Atom> atoms = Parse(pattern, &root);
+    // A directory
+    if (!HasWildcards(pattern))
+        atoms = Parse(pattern + "/**", nullptr);
+
+    Insert(pattern.starts_with("/") ? 0 : 1, atoms, true);
+    m_Roots.push_back(root);
+}
+
+void PathMatcher::Exclude(const std::string &pattern)
+{
+    if (m_Compiled)
+        throw std::runtime_error("Globs can not be added to a compiled matcher");
+    if (pattern.empty())
+        throw std::invalid_argument("Glob can not be empty");
+
+    // Relative excludes apply under absolute and relative roots alike
+    std::vector<std::string> globs {pattern};
+    if (!pattern.starts_with("/"))
+        globs = {"/**/" + pattern, "**/" + pattern};
+    for (uint32_t root = 0; root < globs.size(); root++) {
+        Insert(root, Parse(globs[root], nullptr), false);
+        // Directories it matches are excluded with all they hold
+        Insert(root, Parse(globs[root] + "/**", nullptr), false);
+    }
+}
+
+uint32_t PathMatcher::AddNode(const Atom &atom)
+{
+    uint32_t index = static_cast<uint32_t>(m_Nodes.size());
+    m_Nodes.emplace_back().atom = atom;
+    if (atom.kind == Kind::DEEP) {
+        m_Nodes.emplace_back().atom.kind = Kind::DEEP_INNER;
+        m_Nodes[index].partner = index + 1;
+        m_Nodes[index + 1].partner = index;
+    }
+    return index;
+}
+
+void PathMatcher::Insert(uint32_t root, const std::vector<Atom> &atoms, bool include)
+{
+    uint32_t node = root;
+    for (const Atom &atom : atoms) {
+        uint32_t next = 0;
+        for (uint32_t child : m_Nodes[node].children) {
+            if (m_Nodes[child].atom == atom) {
+                next = child;
+                break;
+            }
+        }
+        if (next == 0) {
+            next = AddNode(atom);
+            m_Nodes[node].children.push_back(next);
+        }
+        node = next;
+    }
+
+    if (include)
+        m_Nodes[node].include = true;
+    else
+        m_Nodes[node].exclude = true;
+}
+
+// Bytes no glob tells apart share a class, so the DFA has a column per class
+// instead of one per byte
+void PathMatcher::ComputeClasses()
+{
+    std::vector<std::array<bool, 256>> masks = m_Sets;
+    std::array<bool, 256> chars {};
+    chars['/'] = true;
+    for (const Node &node : m_Nodes) {
+        if (node.atom.kind == Kind::CHAR)
+            chars[node.atom.ch] = true;
+    }
+    for (unsigned c = 0; c < 256; c++) {
+        if (!chars[c])
+            continue;
+        std::array<bool, 256> mask {};
+        mask[c] = true;
+        masks.push_back(mask);
+    }
+
+    // Every mask splits the classes into the bytes in it and the rest
+    m_ClassOf.fill(0);
+    m_Classes = 1;
+    for (const std::array<bool, 256> &mask : masks) {
+        std::vector<int> split(m_Classes * 2, -1);
+        size_t count = 0;
+        for (unsigned c = 0; c < 256; c++) {
+            int &id = split[m_ClassOf[c] * 2 + mask[c]];
+            if (id < 0)
+                id = static_cast<int>(count++);
+            m_ClassOf[c] = static_cast<uint16_t>(id);
+        }
+        m_Classes = count;
+    }
+}
+
+// Adds the nodes entered without consuming a byte, the loops of * and **
+void PathMatcher::Closure(std::vector<uint32_t> &set) const
+{
+    for (size_t i = 0; i < set.size(); i++) {
+        for (uint32_t child : m_Nodes[set[i]].children) {
+            Kind kind = m_Nodes[child].atom.kind;
+            if (kind == Kind::STAR || kind == Kind::DEEP)
+                set.push_back(child);
+        }
+    }
+    std::sort(set.begin(), set.end());
+    set.erase(std::unique(set.begin(), set.end()), set.end());
+}
+
+namespace {
+
+struct SetHash {
+    size_t operator()(const std::vector<uint32_t> &set) const
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (uint32_t node : set)
+            hash = (hash ^ node) * 1099511628211ull;
+        return static_cast<size_t>(hash);
+    }
+};
+
+}
+
+void PathMatcher::Compile()
+{
+    if (m_Compiled)
+        return;
+    m_Compiled = true;
+
+    std::sort(m_Roots.begin(), m_Roots.end());
+    m_Roots.erase(std::unique(m_Roots.begin(), m_Roots.end()), m_Roots.end());
+
+    // Children come after their parent, a DEEP_INNER right after its DEEP
+    for (size_t i = m_Nodes.size(); i-- > 0;) {
+        Node &node = m_Nodes[i];
+        node.includeReachable = node.include;
+        node.excludeReachable = node.exclude;
+        node.excludesBelow = node.exclude && node.atom.kind == Kind::REST;
+        for (uint32_t child : node.children) {
+            const Node &next = m_Nodes[child];
+            node.includeReachable |= next.includeReachable;
+            node.excludeReachable |= next.excludeReachable;
+            // Paths are never empty after a / or at the start, so whatever
+            // follows is matched by the **
+            node.excludesBelow |= next.exclude && next.atom.kind == Kind::REST;
+        }
+    }
+    for (Node &node : m_Nodes) {
+        if (node.atom.kind == Kind::DEEP_INNER) {
+            node.includeReachable = m_Nodes[node.partner].includeReachable;
+            node.excludeReachable = m_Nodes[node.partner].excludeReachable;
+        }
+    }
+
+    ComputeClasses();
+    Build(m_Include, false);
+    Build(m_Exclude, true);
+}
+
+void PathMatcher::Build(Dfa &dfa, bool exclude) const
+{
+    std::vector<unsigned char> representative(m_Classes);
+    for (unsigned c = 256; c-- > 0;)
+        representative[m_ClassOf[c]] = static_cast<unsigned char>(c);
+
+    // State 0 is the sink, an include DFA reaches it with the empty set. The
+    // empty set of an exclude DFA is a state of its own, nothing is excluded
+    // from there on
+    std::vector<std::vector<uint32_t>> sets(1);
+    std::unordered_map<std::vector<uint32_t>, uint32_t, SetHash> ids;
+    dfa.match.assign(1, false);
+    auto intern = [&](std::vector<uint32_t> set) -> uint32_t {
+        Closure(set);
+        std::erase_if(set, [&](uint32_t node) {
+            return !(exclude ? m_Nodes[node].excludeReachable : m_Nodes[node].includeReachable);
+        });
+        if (!exclude && set.empty())
+            return 0;
+        if (exclude && std::any_of(set.begin(), set.end(), [&](uint32_t node) {return m_Nodes[node].excludesBelow;}))
+            return 0;
+
+        auto [it, added] = ids.try_emplace(set, static_cast<uint32_t>(sets.size()));
+        if (!added)
+            return it->second;
+        if (sets.size() >= MAX_STATES)
+            throw std::invalid_argument("Globs of files and exclude need more than " + std::to_string(MAX_STATES) +
+                    " states, simplify them");
+
+        dfa.match.push_back(std::any_of(set.begin(), set.end(), [&](uint32_t node) {
+            return exclude ? m_Nodes[node].exclude : m_Nodes[node].include;
+        }));
+        sets.push_back(std::move(set));
+        return it->second;
+    };
+
+    dfa.start[0] = intern({0});
+    dfa.start[1] = intern({1});
+    dfa.transitions.assign(m_Classes, 0);
+    std::vector<std::vector<uint32_t>> next(m_Classes);
+    for (size_t state = 1; state < sets.size(); state++) {
+        for (uint32_t index : sets[state]) {
+            const Node &node = m_Nodes[index];
+            for (size_t k = 0; k < m_Classes; k++) {
+                bool slash = representative[k] == '/';
+                switch (node.atom.kind) {
+                    case Kind::STAR:
+                        if (!slash)
+                            next[k].push_back(index);
+                        break;
+                    case Kind::DEEP:
+                        next[k].push_back(slash ? index : node.partner);
+                        break;
+                    case Kind::DEEP_INNER:
+                        next[k].push_back(slash ? node.partner : index);
+                        break;
+                    case Kind::REST:
+                        next[k].push_back(index);
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            for (uint32_t child : node.children) {
+                const Atom &atom = m_Nodes[child].atom;
+                if (atom.kind == Kind::CHAR) {
+                    next[m_ClassOf[atom.ch]].push_back(child);
+                    continue;
+                }
+                // STAR and DEEP are entered by Closure
+                for (size_t k = 0; k < m_Classes; k++) {
+                    bool slash = representative[k] == '/';
+                    if ((atom.kind == Kind::ONE && !slash) || atom.kind == Kind::REST
+                            || (atom.kind == Kind::SET && m_Sets[atom.set][representative[k]]))
+                        next[k].push_back(child);
+                }
+            }
+        }
+
+        for (size_t k = 0; k < m_Classes; k++) {
+            dfa.transitions.push_back(intern(std::move(next[k])));
+            next[k].clear();
+        }
+    }
+}
+
+PathMatcher::State PathMatcher::Start(bool absolute) const
+{
+    uint32_t include = m_Include.start[!absolute];
+    uint32_t exclude = m_Exclude.start[!absolute];
+    return include != 0 && exclude != 0 ? include | static_cast<State>(exclude) << 32 : DEAD;
+}
+
+PathMatcher::State PathMatcher::RootState(const std::string &root) const
+{
+    State state = Feed(Start(root.starts_with("/")), root);
+    if (!root.empty() && !root.ends_with("/"))
+        state = Descend(state);
+    return state;
+}
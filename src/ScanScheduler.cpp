@@ -0,0 +1,168 @@
+#include <ScanScheduler.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+ScanScheduler::ScanScheduler(std::vector<Class> classes, Class defaults) : m_Classes(std::move(classes))
+{
+    defaults.files.clear();
+    m_Classes.push_back(std::move(defaults));
+    if (m_Classes.size() > UINT16_MAX)
+        throw std::invalid_argument("Too many schedule classes");
+
+    for (Class &cls : m_Classes) {
+        if (cls.interval <= Clock::duration::zero())
+            throw std::invalid_argument("Interval of schedule " + cls.name + " must be greater than 0");
+        if (cls.maxInterval < cls.interval)
+            cls.maxInterval = cls.interval;
+
+        std::unique_ptr<PathMatcher> matcher;
+        std::unordered_set<std::string> paths;
+        for (const std::string &entry : cls.files) {
+            if (!PathMatcher::IsGlob(entry)) {
+                paths.insert(entry);
+                continue;
+            }
+            if (!matcher)
+                matcher = std::make_unique<PathMatcher>();
+            matcher->Include(entry);
+        }
+        if (matcher)
+            matcher->Compile();
+        m_Matchers.push_back(std::move(matcher));
+        m_Paths.push_back(std::move(paths));
+    }
+}
+
+ScanScheduler::Priority ScanScheduler::ParsePriority(const std::string &name)
+{
+    if (name == "high")
+        return Priority::HIGH;
+    if (name == "normal")
+        return Priority::NORMAL;
+    if (name == "low")
+        return Priority::LOW;
+    throw std::invalid_argument("Unsupported priority: " + name + ". Use high, normal or low");
+}
+
+const char *ScanScheduler::PriorityName(Priority priority)
+{
+    switch (priority) {
+        case Priority::HIGH: return "high";
+        case Priority::NORMAL: return "normal";
+        default: return "low";
+    }
+}
+
+uint16_t ScanScheduler::Classify(const std::string &path) const
+{
+    size_t last = m_Classes.size() - 1;
+    for (size_t i = 0; i < last; i++) {
+        if (m_Paths[i].contains(path) || (m_Matchers[i] && m_Matchers[i]->MatchesPath(path)))
+            return static_cast<uint16_t>(i);
+    }
+    return static_cast<uint16_t>(last);
+}
+
+void ScanScheduler::Push(size_t index)
+{
+    m_Heap.push_back({m_Files[index].deadline, index});
+    std::push_heap(m_Heap.begin(), m_Heap.end());
+}
+
+void ScanScheduler::SetFiles(const std::vector<std::string> &files, Clock::time_point now)
+{
+    bool same = files.size() == m_Files.size();
+    for (size_t i = 0; same && i < files.size(); i++)
+        same = files[i] == m_Files[i].path;
+
+    // Only the files taken by Due go back
+    if (same) {
+        for (size_t i = 0; i < m_Files.size(); i++) {
+            if (m_Files[i].queued) {
+                m_Files[i].queued = false;
+                Push(i);
+            }
+        }
+        return;
+    }
+
+    std::unordered_map<std::string_view, size_t> previous;
+    previous.reserve(m_Files.size());
+    for (size_t i = 0; i < m_Files.size(); i++)
+        previous.emplace(m_Files[i].path, i);
+
+    std::vector<File> updated(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        auto it = previous.find(files[i]);
+        if (it != previous.end()) {
+            updated[i] = std::move(m_Files[it->second]);
+            updated[i].queued = false;
+            continue;
+        }
+
+        File &file = updated[i];
+        file.path = files[i];
+        file.cls = Classify(file.path);
+        file.interval = m_Classes[file.cls].interval;
+        file.deadline = now;
+    }
+    m_Files = std::move(updated);
+
+    m_Heap.clear();
+    m_Heap.reserve(m_Files.size());
+    for (size_t i = 0; i < m_Files.size(); i++)
+        m_Heap.push_back({m_Files[i].deadline, i});
+    std::make_heap(m_Heap.begin(), m_Heap.end());
+}
+
+std::vector<size_t> ScanScheduler::Due(Clock::time_point now)
+{
+    std::vector<size_t> due;
+    while (!m_Heap.empty() && m_Heap.front().at <= now) {
+        std::pop_heap(m_Heap.begin(), m_Heap.end());
+        size_t index = m_Heap.back().index;
+        m_Heap.pop_back();
+        m_Files[index].queued = true;
+        due.push_back(index);
+    }
+    return due;
+}
+
+void ScanScheduler::Done(size_t index, const FileStat &stat, bool statOk, Clock::time_point now)
+{
+    File &file = m_Files[index];
+    const Class &cls = m_Classes[file.cls];
+
+    bool changed = file.checked && (statOk != file.statOk || !(stat == file.stat));
+    if (changed || !file.checked)
+        file.interval = cls.interval;
+    else
+        file.interval = std::min(file.interval * 2, cls.maxInterval);
+
+    file.stat = stat;
+    file.statOk = statOk;
+    file.checked = true;
+    file.queued = false;
+    file.deadline = now + file.interval;
+    Push(index);
+}
+
+ScanScheduler::Clock::time_point ScanScheduler::Next() const
+{
+    return m_Heap.empty() ? Clock::time_point::max() : m_Heap.front().at;
+}
+
+ScanScheduler::Clock::duration ScanScheduler::Lateness(size_t index, Clock::time_point now) const
+{
+    return std::max(now - m_Files[index].deadline, Clock::duration::zero());
+}
+
+std::vector<size_t> ScanScheduler::Counts() const
+{
+    std::vector<size_t> counts(m_Classes.size());
+    for (const File &file : m_Files)
+        counts[file.cls]++;
+    return counts;
+}
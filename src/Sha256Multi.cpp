@@ -0,0 +1,175 @@
+#include <Sha256Multi.hpp>
+#include <Sha256MultiImpl.hpp>
+
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#if defined(HAVE_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#endif
+
+using namespace sha256;
+
+enum class Kernel {NONE, AVX2, AVX512};
+
+static Kernel DetectKernel()
+{
+#if defined(HAVE_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl"))
+        return Kernel::AVX512;
+
+    // With the SHA extensions, OpenSSL hashes a single message faster than
+    // 8 lanes of AVX2 do
+    unsigned eax, ebx, ecx, edx;
+    bool shaExtensions = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1u << 29));
+    if (__builtin_cpu_supports("avx2") && !shaExtensions)
+        return Kernel::AVX2;
+#endif
+    return Kernel::NONE;
+}
+
+static Kernel ActiveKernel()
+{
+    static const Kernel kernel = DetectKernel();
+    return kernel;
+}
+
+size_t Sha256Multi::Lanes()
+{
+    switch (ActiveKernel()) {
+        case Kernel::AVX512: return 16;
+        case Kernel::AVX2:   return 8;
+        default:             return 0;
+    }
+}
+
+const char *Sha256Multi::Implementation()
+{
+    switch (ActiveKernel()) {
+        case Kernel::AVX512: return "avx512";
+        case Kernel::AVX2:   return "avx2";
+        default:             return "none";
+    }
+}
+
+// A message being hashed in one of the lanes. Its whole blocks are read
+// straight from the message, the rest and the padding from tail
+struct Lane {
+    size_t message;
+    const uint8_t *body;
+    size_t bodyBlocks;
+    uint8_t tail[128];
+    size_t tailBlocks;
+    size_t tailDone;
+};
+
+static void StartLane(Lane &lane, size_t message, std::string_view data, uint32_t state[8][16], size_t index)
+{
+    lane.message = message;
+    lane.body = reinterpret_cast<const uint8_t*>(data.data());
+    lane.bodyBlocks = data.size() / 64;
+
+    // Rest of the message, 0x80, zeros and the length in bits, big endian
+    size_t rest = data.size() % 64;
+    lane.tailBlocks = rest + 9 > 64 ? 2 : 1;
+    lane.tailDone = 0;
+    std::memset(lane.tail, 0, sizeof(lane.tail));
+    std::memcpy(lane.tail, data.data() + lane.bodyBlocks * 64, rest);
+    lane.tail[rest] = 0x80;
+    uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+    for (int i = 0; i < 8; i++)
+        lane.tail[lane.tailBlocks * 64 - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+
+    for (int w = 0; w < 8; w++)
+        state[w][index] = IV[w];
+}
+
+void Sha256Multi::Hash(const std::vector<std::string_view> &messages, std::vector<Digest> &digests)
+{
+    digests.resize(messages.size());
+
+    size_t lanes = Lanes();
+    if (lanes == 0) {
+        for (size_t i = 0; i < messages.size(); i++) {
+            if (EVP_Digest(messages[i].data(), messages[i].size(), digests[i].data(), nullptr, EVP_sha256(), nullptr) != 1)
+                throw std::runtime_error("Digest computation failed");
+        }
+        return;
+    }
+
+#ifdef HAVE_X86_SIMD
+    void (*compress)(uint32_t[8][16], const uint8_t *const[]) =
+        ActiveKernel() == Kernel::AVX512 ? CompressAvx512 : CompressAvx2;
+
+    // Longest first, so the lanes run out of messages at about the same time
+    std::vector<size_t> order(messages.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return messages[a].size() > messages[b].size(); });
+
+    // Lanes without a message hash this block, their state is thrown away
+    static const uint8_t idle[64] = {};
+    constexpr size_t NO_MESSAGE = SIZE_MAX;
+
+    alignas(64) uint32_t state[8][16];
+    Lane lane[16];
+    const uint8_t *blocks[16];
+    size_t next = 0;
+    size_t active = 0;
+
+    for (size_t i = 0; i < lanes; i++) {
+        if (next < order.size()) {
+            StartLane(lane[i], order[next], messages[order[next]], state, i);
+            next++;
+            active++;
+        } else {
+            lane[i].message = NO_MESSAGE;
+        }
+    }
+
+    while (active > 0) {
+        for (size_t i = 0; i < lanes; i++) {
+            if (lane[i].message == NO_MESSAGE)
+                blocks[i] = idle;
+            else if (lane[i].bodyBlocks > 0)
+                blocks[i] = lane[i].body;
+            else
+                blocks[i] = lane[i].tail + lane[i].tailDone * 64;
+        }
+
+        compress(state, blocks);
+
+        for (size_t i = 0; i < lanes; i++) {
+            Lane &l = lane[i];
+            if (l.message == NO_MESSAGE)
+                continue;
+
+            if (l.bodyBlocks > 0) {
+                l.bodyBlocks--;
+                l.body += 64;
+                continue;
+            }
+            if (++l.tailDone < l.tailBlocks)
+                continue;
+
+            // Message done, the lane takes the next one
+            for (int w = 0; w < 8; w++) {
+                for (int b = 0; b < 4; b++)
+                    digests[l.message][4 * w + b] = static_cast<uint8_t>(state[w][i] >> (24 - 8 * b));
+            }
+            if (next < order.size()) {
+                StartLane(l, order[next], messages[order[next]], state, i);
+                next++;
+            } else {
+                l.message = NO_MESSAGE;
+                active--;
+            }
+        }
+    }
+#endif
+}
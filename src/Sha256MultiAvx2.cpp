@@ -0,0 +1,14 @@
+// AVX2 kernel of Sha256Multi, compiled with -mavx2 (see CMakeLists.txt)
+#include <Sha256MultiImpl.hpp>
+#include <SimdLanes.hpp>
+
+#ifdef HAVE_X86_SIMD
+namespace sha256 {
+
+void CompressAvx2(uint32_t state[8][16], const uint8_t *const blocks[8])
+{
+    CompressSimd<Avx2Lanes>(state, blocks);
+}
+
+}
+#endif
@@ -0,0 +1,14 @@
+// AVX-512 kernel of Sha256Multi, compiled with -mavx512f -mavx512vl (see CMakeLists.txt)
+#include <Sha256MultiImpl.hpp>
+#include <SimdLanes.hpp>
+
+#ifdef HAVE_X86_SIMD
+namespace sha256 {
+
+void CompressAvx512(uint32_t state[8][16], const uint8_t *const blocks[16])
+{
+    CompressSimd<Avx512Lanes>(state, blocks);
+}
+
+}
+#endif
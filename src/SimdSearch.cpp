@@ -0,0 +1,121 @@
+#include <SimdSearch.hpp>
+#include <SimdSearchImpl.hpp>
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+size_t SimdSearch::Find(std::string_view haystack, std::string_view needle, size_t pos)
+{
+    size_t n = needle.size();
+    if (n == 0 || pos >= haystack.size())
+        return haystack.find(needle, pos);
+
+    const char *h = haystack.data();
+    if (n == 1) {
+        const void *match = std::memchr(h + pos, needle[0], haystack.size() - pos);
+        return match ? static_cast<const char*>(match) - h : std::string_view::npos;
+    }
+
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+
+    // The block of last bytes reads up to n - 1 bytes past the block of first
+    // bytes, the rest is left to find
+    for (; pos + n - 1 + 16 <= haystack.size(); pos += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + pos));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + pos + n - 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+
+        while (mask) {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (std::memcmp(h + pos + bit + 1, needle.data() + 1, n - 2) == 0)
+                return pos + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    return haystack.find(needle, pos);
+}
+
+static bool HasAvx2()
+{
+#if defined(HAVE_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+    static const bool avx2 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+uint64_t SimdSearch::SkipLines(std::string_view data, uint64_t count, size_t &end)
+{
+#ifdef HAVE_X86_SIMD
+    if (HasAvx2())
+        return simdsearch::SkipLinesAvx2(data.data(), data.size(), count, end);
+#endif
+
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    return simdsearch::SkipLinesBlocks(data.data(), data.size(), count, end, [&](const char *p) {
+        uint64_t mask = 0;
+        for (int i = 0; i < 4; i++) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+            mask |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline))) << (16 * i);
+        }
+        return mask;
+    });
+#else
+    end = 0;
+    return simdsearch::SkipLinesScalar(data.data(), data.size(), 0, 0, count, end);
+#endif
+}
+
+size_t SimdSearch::FindBlankNewlines(std::string_view data, size_t pos, bool spaces, size_t *found, size_t max)
+{
+    if (pos >= data.size() || max == 0)
+        return 0;
+
+#ifdef HAVE_X86_SIMD
+    if (HasAvx2())
+        return simdsearch::FindBlankNewlinesAvx2(data.data(), data.size(), pos, spaces, found, max);
+#endif
+
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i space = _mm_set1_epi8(spaces ? ' ' : '\r');
+    const __m128i tab = _mm_set1_epi8(spaces ? '\t' : '\r');
+    return simdsearch::FindBlankNewlinesBlocks(data.data(), data.size(), pos, spaces, found, max, [&](const char *p, uint64_t &newlines, uint64_t &blanks) {
+        newlines = 0;
+        blanks = 0;
+        for (int i = 0; i < 4; i++) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+            __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)));
+            newlines |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline))) << (16 * i);
+            blanks |= static_cast<uint64_t>(_mm_movemask_epi8(blank)) << (16 * i);
+        }
+    });
+#else
+    return simdsearch::FindBlankNewlinesScalar(data.data(), data.size(), pos, spaces, found, 0, max);
+#endif
+}
+
+const char *SimdSearch::Implementation()
+{
+    if (HasAvx2())
+        return "avx2";
+#ifdef __SSE2__
+    return "sse2";
+#else
+    return "none";
+#endif
+}
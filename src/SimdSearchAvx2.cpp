@@ -0,0 +1,41 @@
+// AVX2 kernel of SimdSearch, compiled with -mavx2 (see CMakeLists.txt)
+#include <SimdSearchImpl.hpp>
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+
+namespace simdsearch {
+
+uint64_t SkipLinesAvx2(const char *data, size_t size, uint64_t count, size_t &end)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    return SkipLinesBlocks(data, size, count, end, [&](const char *p) {
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+        return static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)))) |
+               static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)))) << 32;
+    });
+}
+
+size_t FindBlankNewlinesAvx2(const char *data, size_t size, size_t pos, bool spaces, size_t *found, size_t max)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    // Without spaces, both compare with CR once more
+    const __m256i space = _mm256_set1_epi8(spaces ? ' ' : '\r');
+    const __m256i tab = _mm256_set1_epi8(spaces ? '\t' : '\r');
+    return FindBlankNewlinesBlocks(data, size, pos, spaces, found, max, [&](const char *p, uint64_t &newlines, uint64_t &blanks) {
+        newlines = 0;
+        blanks = 0;
+        for (int i = 0; i < 2; i++) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32 * i));
+            __m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)));
+            newlines |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)))) << (32 * i);
+            blanks |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(blank))) << (32 * i);
+        }
+    });
+}
+
+}
+#endif
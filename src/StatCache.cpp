@@ -0,0 +1,174 @@
+#include <StatCache.hpp>
+#include <Log.hpp>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <chrono>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
+
+// Bumped when the format of the cache file changes
+static constexpr const char *CACHE_HEADER = "statcache 1";
+
+bool FileStat::Read(const std::string &path, FileStat &stat)
+{
+#if defined(_WIN32)
+    // No inode or ctime here, size and modification time have to do
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(path, ec);
+    if (ec)
+        return false;
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    if (ec)
+        return false;
+
+    stat = FileStat();
+    stat.size = size;
+    stat.mtimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+    return true;
+#elif defined(STATX_BASIC_STATS)
+    struct statx stx;
+    if (statx(AT_FDCWD, path.c_str(), 0, STATX_BASIC_STATS, &stx) != 0)
+        return false;
+
+    stat.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    stat.inode = stx.stx_ino;
+    stat.size = stx.stx_size;
+    stat.mtimeNs = stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec;
+    stat.ctimeNs = stx.stx_ctime.tv_sec * 1000000000LL + stx.stx_ctime.tv_nsec;
+    return true;
+#else
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+        return false;
+
+    stat.dev = st.st_dev;
+    stat.inode = st.st_ino;
+    stat.size = st.st_size;
+#ifdef __APPLE__
+    stat.mtimeNs = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+    stat.ctimeNs = st.st_ctimespec.tv_sec * 1000000000LL + st.st_ctimespec.tv_nsec;
+#else
+    stat.mtimeNs = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    stat.ctimeNs = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+#endif
+    return true;
+#endif
+}
+
+StatCache::StatCache(const std::string &path, const std::string &tag) :
+    m_Path(path),
+    m_Tag(tag)
+{}
+
+// File format:
+//   statcache 1
+//   <tag>
+//   <dev> <inode> <size> <mtime ns> <ctime ns> <path>
+//   ...
+// The path is last since it may contain spaces
+void StatCache::Load()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Entries.clear();
+    m_Dirty = false;
+
+    std::ifstream in(m_Path);
+    if (!in.is_open())
+        return;
+
+    std::string line;
+    if (!std::getline(in, line) || line != CACHE_HEADER)
+        return;
+    if (!std::getline(in, line) || line != m_Tag) {
+        logging::msg("[StatCache] Fingerprint settings changed, every file will be hashed again");
+        // Rewrite it with the current tag on the next Save
+        m_Dirty = true;
+        return;
+    }
+
+    while (std::getline(in, line)) {
+        std::istringstream iss(line);
+        FileStat stat;
+        std::string file;
+        if (!(iss >> stat.dev >> stat.inode >> stat.size >> stat.mtimeNs >> stat.ctimeNs)
+                || iss.get() != ' ' || !std::getline(iss, file) || file.empty()) {
+            logging::warn("[StatCache] Cache file " + m_Path + " is corrupted, every file will be hashed again");
+            m_Entries.clear();
+            m_Dirty = true;
+            return;
+        }
+        m_Entries[file] = stat;
+    }
+}
+
+void StatCache::Save()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_Dirty)
+        return;
+
+    // Written next to the cache and renamed over it, so a crash can not
+    // leave a half written cache behind
+    std::string tmpPath = m_Path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::trunc);
+        if (!out.is_open()) {
+            logging::err("[StatCache] Cannot open " + tmpPath);
+            return;
+        }
+
+        out << CACHE_HEADER << "\n" << m_Tag << "\n";
+        for (const auto &[file, stat] : m_Entries) {
+            out << stat.dev << " " << stat.inode << " " << stat.size << " "
+                << stat.mtimeNs << " " << stat.ctimeNs << " " << file << "\n";
+        }
+
+        if (!out.good()) {
+            logging::err("[StatCache] Failed to write " + tmpPath);
+            return;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, m_Path, ec);
+    if (ec) {
+        logging::err("[StatCache] Failed to replace " + m_Path + ": " + ec.message());
+        return;
+    }
+    m_Dirty = false;
+}
+
+bool StatCache::Get(const std::string &file, FileStat &stat) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto it = m_Entries.find(file);
+    if (it == m_Entries.end())
+        return false;
+    stat = it->second;
+    return true;
+}
+
+void StatCache::Set(const std::string &file, const FileStat &stat)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto [it, inserted] = m_Entries.try_emplace(file, stat);
+    if (!inserted && it->second == stat)
+        return;
+    it->second = stat;
+    m_Dirty = true;
+}
+
+void StatCache::Erase(const std::string &file)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Entries.erase(file) > 0)
+        m_Dirty = true;
+}
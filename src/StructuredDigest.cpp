@@ -0,0 +1,782 @@
+#include <StructuredDigest.hpp>
+#include <FileReader.hpp>
+#include <Log.hpp>
+
+#include <yaml-cpp/eventhandler.h>
+#include <yaml-cpp/exceptions.h>
+#include <yaml-cpp/parser.h>
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+
+// Written first when the input is not a valid document, followed by all of
+// it as it is. No canonical form has a zero byte
+static constexpr std::string_view INVALID_MARKER("\0invalid\n", 9);
+
+KeyPathTracker::KeyPathTracker(const FilterKeys &filter)
+    : m_Paths(filter.Paths())
+{
+    for (const FilterKeys::Path &path : m_Paths) {
+        for (const FilterKeys::Component &component : path)
+            m_MaxKeyLength = std::max(m_MaxKeyLength, component.key.size());
+    }
+}
+
+void KeyPathTracker::DocumentStarts()
+{
+    m_Frames.clear();
+    m_Alive.clear();
+    m_Child.clear();
+    for (uint32_t i = 0; i < m_Paths.size(); i++)
+        m_Child.push_back(i);
+}
+
+template <typename Match>
+bool KeyPathTracker::Select(Match &&match)
+{
+    m_Child.clear();
+    const size_t depth = m_Frames.size() - 1;
+    for (size_t i = m_Frames.back().alive; i < m_Alive.size(); i++) {
+        const FilterKeys::Path &path = m_Paths[m_Alive[i]];
+        if (!match(path[depth]))
+            continue;
+        if (path.size() == depth + 1)
+            return true;
+        m_Child.push_back(m_Alive[i]);
+    }
+    return false;
+}
+
+bool KeyPathTracker::MapValue(std::string_view key)
+{
+    return Select([key](const FilterKeys::Component &component) {
+        return component.any || component.key == key;
+    });
+}
+
+bool KeyPathTracker::SequenceValue()
+{
+    uint64_t index = m_Frames.back().index++;
+    return Select([index](const FilterKeys::Component &component) {
+        return component.any || (component.isIndex && component.index == index);
+    });
+}
+
+void KeyPathTracker::Unmatched()
+{
+    m_Child.clear();
+}
+
+void KeyPathTracker::Push()
+{
+    m_Frames.push_back({m_Alive.size(), 0});
+    m_Alive.insert(m_Alive.end(), m_Child.begin(), m_Child.end());
+    m_Child.clear();
+}
+
+void KeyPathTracker::Pop()
+{
+    m_Alive.resize(m_Frames.back().alive);
+    m_Frames.pop_back();
+}
+
+void CanonicalOutput::WriteString(std::string_view s)
+{
+    Write('"');
+    size_t start = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        Write(s.substr(start, i - start));
+        WriteStringByte(c);
+        start = i + 1;
+    }
+    Write(s.substr(start));
+    Write('"');
+}
+
+void CanonicalOutput::WriteStringByte(unsigned char c)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    if (c == '"' || c == '\\') {
+        Write('\\');
+        Write(static_cast<char>(c));
+    } else if (c < 0x20) {
+        const char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+        Write(std::string_view(escaped, sizeof(escaped)));
+    } else {
+        Write(static_cast<char>(c));
+    }
+}
+
+JsonDigest::JsonDigest(HashingAlgorithm::Context &ctx, const std::string &path, const FilterKeys &filter)
+    : m_Ctx(ctx), m_Path(path), m_Out(ctx), m_Paths(filter)
+{
+}
+
+static bool IsSpace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static bool IsNumber(char c)
+{
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+void JsonDigest::Update(std::string_view chunk)
+{
+    Parse(chunk);
+    m_Offset += chunk.size();
+}
+
+void JsonDigest::Parse(std::string_view chunk)
+{
+    size_t i = 0;
+    const size_t n = chunk.size();
+
+    while (i < n) {
+        switch (m_State) {
+            case State::VALUE:
+            case State::FIRST_VALUE:
+            case State::FIRST_KEY:
+            case State::KEY:
+            case State::COLON:
+            case State::AFTER_VALUE: {
+                while (i < n && IsSpace(chunk[i]))
+                    i++;
+                if (i == n)
+                    return;
+                char c = chunk[i];
+
+                if (m_State == State::VALUE) {
+                    StartValue(chunk, i);
+                } else if (m_State == State::FIRST_VALUE) {
+                    if (c == ']') {
+                        Close(c);
+                        i++;
+                    } else {
+                        m_State = State::VALUE;
+                    }
+                } else if (m_State == State::FIRST_KEY || m_State == State::KEY) {
+                    if (c == '"') {
+                        m_InKey = true;
+                        m_Key.clear();
+                        m_KeyTooLong = false;
+                        if (Emitting())
+                            m_Out.Write('"');
+                        m_State = State::STRING;
+                        i++;
+                    } else if (c == '}' && m_State == State::FIRST_KEY) {
+                        Close(c);
+                        i++;
+                    } else {
+                        Invalid(chunk);
+                        return;
+                    }
+                } else if (m_State == State::COLON) {
+                    if (c != ':') {
+                        Invalid(chunk);
+                        return;
+                    }
+                    if (Emitting())
+                        m_Out.Write(':');
+                    m_State = State::VALUE;
+                    i++;
+                } else if (m_Stack.empty()) {
+                    // Next document
+                    m_State = State::VALUE;
+                } else if (c == ',') {
+                    if (Emitting())
+                        m_Out.Write(',');
+                    m_State = m_Stack.back() == '{' ? State::KEY : State::VALUE;
+                    i++;
+                } else if (c == (m_Stack.back() == '{' ? '}' : ']')) {
+                    Close(c);
+                    i++;
+                } else {
+                    Invalid(chunk);
+                    return;
+                }
+                break;
+            }
+
+            case State::STRING: {
+                // Plain parts of strings are passed on as they are. Control
+                // characters have to be escaped in JSON, so the canonical
+                // form never has them raw
+                size_t end = i;
+                while (end < n) {
+                    unsigned char c = static_cast<unsigned char>(chunk[end]);
+                    if (c < 0x20 || c == '"' || c == '\\')
+                        break;
+                    end++;
+                }
+
+                if (end > i)
+                    StringPart(chunk.substr(i, end - i));
+                i = end;
+                if (i == n)
+                    return;
+
+                if (static_cast<unsigned char>(chunk[i]) < 0x20) {
+                    Invalid(chunk);
+                    return;
+                }
+                if (chunk[i] == '\\') {
+                    m_State = State::ESCAPE;
+                } else {
+                    FlushSurrogate();
+                    if (Emitting())
+                        m_Out.Write('"');
+                    if (m_InKey) {
+                        m_InKey = false;
+                        m_State = State::COLON;
+                    } else {
+                        EndValue();
+                    }
+                }
+                i++;
+                break;
+            }
+
+            case State::ESCAPE: {
+                char c = chunk[i++];
+                if (c == 'u') {
+                    m_Code = 0;
+                    m_HexDigits = 0;
+                    m_State = State::UNICODE;
+                    break;
+                }
+
+                FlushSurrogate();
+                switch (c) {
+                    case '"': StringByte('"'); break;
+                    case '\\': StringByte('\\'); break;
+                    case '/': StringByte('/'); break;
+                    case 'b': StringByte('\b'); break;
+                    case 'f': StringByte('\f'); break;
+                    case 'n': StringByte('\n'); break;
+                    case 'r': StringByte('\r'); break;
+                    case 't': StringByte('\t'); break;
+                    default:
+                        Invalid(chunk);
+                        return;
+                }
+                m_State = State::STRING;
+                break;
+            }
+
+            case State::UNICODE: {
+                char c = chunk[i];
+                uint32_t digit;
+                if (c >= '0' && c <= '9')
+                    digit = static_cast<uint32_t>(c - '0');
+                else if (c >= 'a' && c <= 'f')
+                    digit = static_cast<uint32_t>(c - 'a' + 10);
+                else if (c >= 'A' && c <= 'F')
+                    digit = static_cast<uint32_t>(c - 'A' + 10);
+                else {
+                    Invalid(chunk);
+                    return;
+                }
+                i++;
+
+                m_Code = m_Code * 16 + digit;
+                if (++m_HexDigits == 4) {
+                    CodePoint(m_Code);
+                    m_State = State::STRING;
+                }
+                break;
+            }
+
+            case State::NUMBER: {
+                size_t start = i;
+                while (i < n && IsNumber(chunk[i]))
+                    i++;
+                if (Emitting() && i > start)
+                    m_Out.Write(chunk.substr(start, i - start));
+                // The byte after the number belongs to what comes next
+                if (i < n)
+                    EndValue();
+                break;
+            }
+
+            case State::LITERAL: {
+                while (i < n && m_LiteralPos < m_Literal.size()) {
+                    if (chunk[i] != m_Literal[m_LiteralPos]) {
+                        Invalid(chunk);
+                        return;
+                    }
+                    i++;
+                    m_LiteralPos++;
+                }
+                if (m_LiteralPos == m_Literal.size()) {
+                    if (Emitting())
+                        m_Out.Write(m_Literal);
+                    EndValue();
+                }
+                break;
+            }
+
+            case State::INVALID:
+                m_Out.Write(chunk.substr(i));
+                return;
+        }
+    }
+}
+
+void JsonDigest::Finish()
+{
+    if (m_State == State::NUMBER)
+        EndValue();
+
+    // A document cut off in the middle
+    bool complete = m_Stack.empty() && (m_State == State::VALUE || m_State == State::AFTER_VALUE);
+    if (!complete && m_State != State::INVALID) {
+        logging::warn("[JsonDigest] " + m_Path + " ends in the middle of a JSON document, hashing it as it is");
+        Restart();
+    }
+    m_Out.Flush();
+}
+
+// Decides whether the value starting at chunk[i] is left out and starts it
+void JsonDigest::StartValue(std::string_view chunk, size_t &i)
+{
+    if (Emitting()) {
+        bool excluded;
+        if (m_Stack.empty()) {
+            m_Paths.DocumentStarts();
+            excluded = false;
+        } else if (m_Stack.back() == '{') {
+            // A key too long for any component still matches *, the empty
+            // key matches nothing else
+            excluded = m_Paths.MapValue(m_KeyTooLong ? std::string_view() : std::string_view(m_Key));
+        } else {
+            excluded = m_Paths.SequenceValue();
+        }
+
+        if (excluded) {
+            m_Out.Write('?');
+            m_SkipBase = m_Stack.size();
+        }
+    }
+
+    char c = chunk[i];
+    if (c == '{' || c == '[') {
+        Open(c);
+        i++;
+    } else if (c == '"') {
+        if (Emitting())
+            m_Out.Write('"');
+        m_State = State::STRING;
+        i++;
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+        m_State = State::NUMBER;
+    } else if (c == 't' || c == 'f' || c == 'n') {
+        m_Literal = c == 't' ? "true" : c == 'f' ? "false" : "null";
+        m_LiteralPos = 0;
+        m_State = State::LITERAL;
+    } else {
+        Invalid(chunk);
+        i = chunk.size();
+    }
+}
+
+void JsonDigest::Open(char c)
+{
+    if (Emitting()) {
+        m_Paths.Push();
+        m_Out.Write(c);
+    }
+    m_Stack.push_back(c);
+    m_State = c == '{' ? State::FIRST_KEY : State::FIRST_VALUE;
+}
+
+void JsonDigest::Close(char c)
+{
+    m_Stack.pop_back();
+    if (Emitting()) {
+        m_Paths.Pop();
+        m_Out.Write(c);
+    }
+    EndValue();
+}
+
+void JsonDigest::EndValue()
+{
+    if (!Emitting() && m_Stack.size() == m_SkipBase)
+        m_SkipBase = NOT_SKIPPING;
+    if (m_Stack.empty())
+        m_Out.Write('\n');
+    m_State = State::AFTER_VALUE;
+}
+
+void JsonDigest::StringPart(std::string_view part)
+{
+    FlushSurrogate();
+    if (Emitting())
+        m_Out.Write(part);
+    if (m_InKey && !m_KeyTooLong) {
+        if (m_Key.size() + part.size() > m_Paths.MaxKeyLength())
+            m_KeyTooLong = true;
+        else
+            m_Key.append(part);
+    }
+}
+
+// A byte of a string that was escaped in the document
+void JsonDigest::StringByte(unsigned char c)
+{
+    if (Emitting())
+        m_Out.WriteStringByte(c);
+    if (m_InKey && !m_KeyTooLong) {
+        if (m_Key.size() + 1 > m_Paths.MaxKeyLength())
+            m_KeyTooLong = true;
+        else
+            m_Key.push_back(static_cast<char>(c));
+    }
+}
+
+void JsonDigest::CodePoint(uint32_t code)
+{
+    if (m_HighSurrogate && code >= 0xdc00 && code <= 0xdfff) {
+        code = 0x10000 + ((m_HighSurrogate - 0xd800) << 10) + (code - 0xdc00);
+        m_HighSurrogate = 0;
+    } else {
+        FlushSurrogate();
+        if (code >= 0xd800 && code <= 0xdbff) {
+            m_HighSurrogate = code;
+            return;
+        }
+    }
+    Utf8(code);
+}
+
+// Lone surrogates are encoded like any other code point
+void JsonDigest::Utf8(uint32_t code)
+{
+    if (code < 0x80) {
+        StringByte(static_cast<unsigned char>(code));
+    } else if (code < 0x800) {
+        StringByte(static_cast<unsigned char>(0xc0 | (code >> 6)));
+        StringByte(static_cast<unsigned char>(0x80 | (code & 0x3f)));
+    } else if (code < 0x10000) {
+        StringByte(static_cast<unsigned char>(0xe0 | (code >> 12)));
+        StringByte(static_cast<unsigned char>(0x80 | ((code >> 6) & 0x3f)));
+        StringByte(static_cast<unsigned char>(0x80 | (code & 0x3f)));
+    } else {
+        StringByte(static_cast<unsigned char>(0xf0 | (code >> 18)));
+        StringByte(static_cast<unsigned char>(0x80 | ((code >> 12) & 0x3f)));
+        StringByte(static_cast<unsigned char>(0x80 | ((code >> 6) & 0x3f)));
+        StringByte(static_cast<unsigned char>(0x80 | (code & 0x3f)));
+    }
+}
+
+// A high surrogate not followed by a low one
+void JsonDigest::FlushSurrogate()
+{
+    if (!m_HighSurrogate)
+        return;
+    uint32_t code = m_HighSurrogate;
+    m_HighSurrogate = 0;
+    Utf8(code);
+}
+
+// chunk, which was being parsed, is not valid JSON. Everything read before
+// it may have been left out or only partly written, the digest starts over
+void JsonDigest::Invalid(std::string_view chunk)
+{
+    logging::warn("[JsonDigest] " + m_Path + " is not valid JSON, hashing it as it is");
+    // The chunk may be in the buffer the reader of Restart reuses
+    std::string current(chunk);
+    Restart();
+    m_Out.Write(current);
+    m_State = State::INVALID;
+}
+
+// Starts the digest over with the marker and the file up to the chunk being
+// parsed, read again
+void JsonDigest::Restart()
+{
+    m_Out.Discard();
+    m_Ctx.Init();
+    m_Out.Write(INVALID_MARKER);
+    if (m_Offset == 0)
+        return;
+
+    std::unique_ptr<FileReader> reader = FileReader::OpenRange(m_Path, 0, m_Offset);
+    std::string_view part;
+    while (reader->Next(part))
+        m_Out.Write(part);
+}
+
+// Plain YAML scalars resolved the way the core schema does: the JSON
+// literal for null and booleans, the scalar itself for numbers. Empty for
+// strings
+static std::string_view PlainLiteral(std::string_view value)
+{
+    if (value == "~" || value == "null" || value == "Null" || value == "NULL")
+        return "null";
+    if (value == "true" || value == "True" || value == "TRUE")
+        return "true";
+    if (value == "false" || value == "False" || value == "FALSE")
+        return "false";
+
+    auto digits = [&value](size_t pos, auto isDigit) {
+        size_t start = pos;
+        while (pos < value.size() && isDigit(static_cast<unsigned char>(value[pos])))
+            pos++;
+        return pos - start;
+    };
+    auto decimal = [](unsigned char c) { return c >= '0' && c <= '9'; };
+
+    if (value.size() > 2 && value[0] == '0' && (value[1] == 'o' || value[1] == 'x')) {
+        size_t n = value[1] == 'o' ? digits(2, [](unsigned char c) { return c >= '0' && c <= '7'; })
+                                   : digits(2, [](unsigned char c) { return std::isxdigit(c) != 0; });
+        return n == value.size() - 2 ? value : std::string_view();
+    }
+
+    size_t pos = 0;
+    if (pos < value.size() && (value[pos] == '-' || value[pos] == '+'))
+        pos++;
+    std::string_view rest = value.substr(pos);
+    if (rest == ".inf" || rest == ".Inf" || rest == ".INF")
+        return value;
+    if (pos == 0 && (rest == ".nan" || rest == ".NaN" || rest == ".NAN"))
+        return value;
+
+    size_t whole = digits(pos, decimal);
+    pos += whole;
+    size_t fraction = 0;
+    if (pos < value.size() && value[pos] == '.') {
+        fraction = digits(pos + 1, decimal);
+        pos += 1 + fraction;
+    }
+    if (whole == 0 && fraction == 0)
+        return std::string_view();
+    if (pos < value.size() && (value[pos] == 'e' || value[pos] == 'E')) {
+        pos++;
+        if (pos < value.size() && (value[pos] == '-' || value[pos] == '+'))
+            pos++;
+        size_t exponent = digits(pos, decimal);
+        if (exponent == 0)
+            return std::string_view();
+        pos += exponent;
+    }
+    return pos == value.size() ? value : std::string_view();
+}
+
+// Writes the canonical form of the events of the yaml-cpp parser, the same
+// JsonDigest writes for JSON. Plain scalars that resolve to null, a boolean
+// or a number are written bare, all other scalars as strings, so 1 and "1"
+// stay different while :x and ':x' do not. Explicit tags are kept
+class YamlHandler : public YAML::EventHandler {
+    public:
+        YamlHandler(CanonicalOutput &out, const FilterKeys &filter) : m_Out(out), m_Paths(filter) {}
+
+        void OnDocumentStart(const YAML::Mark &) override
+        {
+            m_Paths.DocumentStarts();
+            m_Frames.clear();
+            m_Skip = 0;
+        }
+
+        void OnDocumentEnd() override
+        {
+            m_Out.Write('\n');
+        }
+
+        void OnNull(const YAML::Mark &, YAML::anchor_t anchor) override
+        {
+            if (m_Skip > 0)
+                return;
+            if (Begin(anchor, nullptr))
+                m_Out.Write("null");
+            End();
+        }
+
+        void OnAlias(const YAML::Mark &, YAML::anchor_t anchor) override
+        {
+            if (m_Skip > 0)
+                return;
+            if (Begin(0, nullptr)) {
+                m_Out.Write('*');
+                m_Out.Write(std::to_string(anchor));
+            }
+            End();
+        }
+
+        void OnScalar(const YAML::Mark &, const std::string &tag, YAML::anchor_t anchor, const std::string &value) override
+        {
+            if (m_Skip > 0)
+                return;
+            if (Begin(anchor, &value)) {
+                std::string_view literal = tag == "?" ? PlainLiteral(value) : std::string_view();
+                if (!literal.empty()) {
+                    m_Out.Write(literal);
+                } else {
+                    Tag(tag);
+                    m_Out.WriteString(value);
+                }
+            }
+            End();
+        }
+
+        void OnSequenceStart(const YAML::Mark &, const std::string &tag, YAML::anchor_t anchor, YAML::EmitterStyle::value) override
+        {
+            Open(tag, anchor, false);
+        }
+
+        void OnSequenceEnd() override
+        {
+            Close(']');
+        }
+
+        void OnMapStart(const YAML::Mark &, const std::string &tag, YAML::anchor_t anchor, YAML::EmitterStyle::value) override
+        {
+            Open(tag, anchor, true);
+        }
+
+        void OnMapEnd() override
+        {
+            Close('}');
+        }
+
+    private:
+        struct Frame {
+            bool map;
+            // In maps, whether the next node is a key
+            bool key;
+            bool first;
+        };
+
+        // Starts a node, scalar is its value for scalars. Returns false
+        // when the node is left out
+        bool Begin(YAML::anchor_t anchor, const std::string *scalar)
+        {
+            if (!m_Frames.empty()) {
+                Frame &frame = m_Frames.back();
+                if (frame.map && !frame.key) {
+                    m_Out.Write(':');
+                    bool excluded = m_KeyValid && m_Paths.MapValue(m_Key);
+                    if (!m_KeyValid)
+                        m_Paths.Unmatched();
+                    if (excluded) {
+                        m_Out.Write('?');
+                        return false;
+                    }
+                } else {
+                    if (!frame.first)
+                        m_Out.Write(',');
+                    frame.first = false;
+
+                    if (frame.map) {
+                        // Only scalar keys can match a path
+                        m_KeyValid = scalar != nullptr;
+                        if (scalar)
+                            m_Key = *scalar;
+                        m_Paths.Unmatched();
+                    } else if (m_Paths.SequenceValue()) {
+                        m_Out.Write('?');
+                        return false;
+                    }
+                }
+            }
+
+            if (anchor) {
+                m_Out.Write('&');
+                m_Out.Write(std::to_string(anchor));
+            }
+            return true;
+        }
+
+        // A node ended, in maps a key is followed by a value and the other
+        // way around
+        void End()
+        {
+            if (!m_Frames.empty() && m_Frames.back().map)
+                m_Frames.back().key = !m_Frames.back().key;
+        }
+
+        void Open(const std::string &tag, YAML::anchor_t anchor, bool map)
+        {
+            if (m_Skip > 0) {
+                m_Skip++;
+                return;
+            }
+            if (!Begin(anchor, nullptr)) {
+                m_Skip = 1;
+                return;
+            }
+
+            Tag(tag);
+            m_Out.Write(map ? '{' : '[');
+            m_Paths.Push();
+            m_Frames.push_back({map, true, true});
+        }
+
+        void Close(char c)
+        {
+            if (m_Skip > 0) {
+                if (--m_Skip == 0)
+                    End();
+                return;
+            }
+
+            m_Frames.pop_back();
+            m_Paths.Pop();
+            m_Out.Write(c);
+            End();
+        }
+
+        void Tag(const std::string &tag)
+        {
+            // Plain and quoted scalars, untagged containers
+            if (tag.empty() || tag == "?" || tag == "!")
+                return;
+            m_Out.Write('!');
+            m_Out.WriteString(tag);
+        }
+
+        CanonicalOutput &m_Out;
+        KeyPathTracker m_Paths;
+        std::vector<Frame> m_Frames;
+        // Open containers in the node being left out
+        size_t m_Skip = 0;
+        // Key of the value that comes next, when it is a scalar
+        std::string m_Key;
+        bool m_KeyValid = false;
+};
+
+std::string YamlDigest(const std::string &path, HashingAlgorithm::Context &ctx, const FilterKeys &filter)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Failed to open file: " + path);
+
+    ctx.Init();
+    try {
+        CanonicalOutput out(ctx);
+        YAML::Parser parser(in);
+        YamlHandler handler(out, filter);
+        while (parser.HandleNextDocument(handler)) {}
+        out.Flush();
+    } catch (const YAML::Exception &e) {
+        logging::warn("[YamlDigest] " + path + " is not valid YAML (" + e.what() + "), hashing it as it is");
+        ctx.Init();
+        ctx.Update(INVALID_MARKER);
+        std::unique_ptr<FileReader> reader = FileReader::Open(path);
+        std::string_view chunk;
+        while (reader->Next(chunk))
+            ctx.Update(chunk);
+    }
+    if (in.bad())
+        throw std::runtime_error("Failed to read file: " + path);
+
+    return ctx.Final();
+}
@@ -0,0 +1,173 @@
+#include <ThreadPool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iterator>
+
+// Set for pool threads, and for a thread that is inside Run
+static thread_local int t_WorkerIndex = -1;
+
+struct ThreadPool::Batch {
+    std::atomic<size_t> remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+};
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+    if (threads == 0)
+        threads = 1;
+
+    for (unsigned i = 0; i < threads; i++)
+        m_Queues.push_back(std::make_unique<Queue>());
+
+    for (unsigned i = 1; i < threads; i++)
+        m_Threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_Wakeup.notify_all();
+
+    for (std::thread &t : m_Threads)
+        t.join();
+}
+
+unsigned ThreadPool::WorkerIndex()
+{
+    return t_WorkerIndex < 0 ? 0 : static_cast<unsigned>(t_WorkerIndex);
+}
+
+unsigned ThreadPool::HardwareThreads()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+void ThreadPool::Run(std::vector<Task> tasks)
+{
+    if (tasks.empty())
+        return;
+
+    auto batch = std::make_shared<Batch>();
+    batch->remaining = tasks.size();
+
+    for (size_t i = 0; i < tasks.size(); i++) {
+        Queue &q = *m_Queues[i % m_Queues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.jobs.push_back(Job{std::move(tasks[i]), batch});
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Queued += tasks.size();
+    }
+    m_Wakeup.notify_all();
+
+    // Help out until this batch is done, with its own tasks only. A task
+    // calling Run is in the middle of something, another task run on its
+    // thread would share its thread local state (contexts, read buffers,
+    // the io_uring scanner of the worker). Worker threads calling Run
+    // (nested batches) keep their own index.
+    bool outsider = t_WorkerIndex < 0;
+    if (outsider)
+        t_WorkerIndex = 0;
+    unsigned index = static_cast<unsigned>(t_WorkerIndex);
+
+    while (batch->remaining.load() > 0) {
+        if (TryRunOne(index, batch.get()))
+            continue;
+
+        // Nothing left to take, the rest of the batch is running elsewhere
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->done.wait(lock, [&] { return batch->remaining.load() == 0; });
+    }
+
+    if (outsider)
+        t_WorkerIndex = -1;
+
+    if (batch->error)
+        std::rethrow_exception(batch->error);
+}
+
+void ThreadPool::WorkerLoop(unsigned index)
+{
+    t_WorkerIndex = static_cast<int>(index);
+
+    while (true) {
+        if (TryRunOne(index))
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Wakeup.wait(lock, [&] { return m_Stop || m_Queued > 0; });
+        if (m_Stop)
+            return;
+    }
+}
+
+bool ThreadPool::TryRunOne(unsigned index, const Batch *only)
+{
+    Job job;
+    if (!Pop(index, job, only))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        --m_Queued;
+    }
+    Execute(job);
+    return true;
+}
+
+bool ThreadPool::Pop(unsigned index, Job &job, const Batch *only)
+{
+    auto matches = [only](const Job &candidate) { return !only || candidate.batch.get() == only; };
+
+    // Own queue first, from the front
+    {
+        Queue &q = *m_Queues[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        auto it = std::find_if(q.jobs.begin(), q.jobs.end(), matches);
+        if (it != q.jobs.end()) {
+            job = std::move(*it);
+            q.jobs.erase(it);
+            return true;
+        }
+    }
+
+    // Steal from the back of the others
+    for (size_t i = 1; i < m_Queues.size(); i++) {
+        Queue &q = *m_Queues[(index + i) % m_Queues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        auto it = std::find_if(q.jobs.rbegin(), q.jobs.rend(), matches);
+        if (it != q.jobs.rend()) {
+            job = std::move(*it);
+            q.jobs.erase(std::next(it).base());
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::Execute(Job &job)
+{
+    try {
+        job.task();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(job.batch->mutex);
+        if (!job.batch->error)
+            job.batch->error = std::current_exception();
+    }
+
+    if (job.batch->remaining.fetch_sub(1) == 1) {
+        // Lock so the waiter can not miss the notification
+        std::lock_guard<std::mutex> lock(job.batch->mutex);
+        job.batch->done.notify_all();
+    }
+}
@@ -0,0 +1,492 @@
+#include <Traversal.hpp>
+#include <Log.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+#ifdef __linux__
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Bumped when the format of the listing file changes
+static constexpr const char *LISTING_HEADER = "treelisting 1";
+
+// Bytes of directory entries read at once
+static constexpr size_t DIRENT_BUFFER = 64 * 1024;
+
+static std::string JoinPath(const std::string &directory, std::string_view name)
+{
+    std::string path;
+    path.reserve(directory.size() + 1 + name.size());
+    path += directory;
+    if (!path.empty() && path.back() != '/')
+        path += '/';
+    path += name;
+    return path;
+}
+
+namespace {
+
+// Entries of a directory that matter to the matcher, sorted the way their full
+// paths sort. A directory is ordered as its name followed by a /, so listing
+// the directories depth first gives every file in order without sorting the
+// full paths, which share long prefixes
+struct Listing {
+    struct Entry {
+        std::string path;
+        size_t name;                        // Offset of the name in path
+        PathMatcher::State state;           // Of the entries of a directory
+        std::unique_ptr<Listing> directory; // nullptr for files
+    };
+    std::vector<Entry> entries;
+
+    void Sort()
+    {
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+            std::string_view nameA = std::string_view(a.path).substr(a.name);
+            std::string_view nameB = std::string_view(b.path).substr(b.name);
+            size_t common = std::min(nameA.size(), nameB.size());
+            int cmp = nameA.substr(0, common).compare(nameB.substr(0, common));
+            if (cmp != 0)
+                return cmp < 0;
+            // One name starts with the other, the end of a file name comes
+            // before anything and the end of a directory name is a /
+            int nextA = nameA.size() > common ? static_cast<unsigned char>(nameA[common]) : a.directory ? '/' : -1;
+            int nextB = nameB.size() > common ? static_cast<unsigned char>(nameB[common]) : b.directory ? '/' : -1;
+            return nextA < nextB;
+        });
+    }
+
+    void Flatten(std::vector<std::string> &files, std::vector<std::string> *directories)
+    {
+        for (Entry &entry : entries) {
+            if (!entry.directory) {
+                files.push_back(std::move(entry.path));
+                continue;
+            }
+            if (directories)
+                directories->push_back(entry.path);
+            entry.directory->Flatten(files, directories);
+        }
+        entries.clear();
+    }
+};
+
+// What one Expand shares between its tasks
+struct Walk {
+    ThreadPool &pool;
+    const PathMatcher &matcher;
+    std::atomic<uint64_t> &directories;
+    std::atomic<uint64_t> &entries;
+    std::atomic<uint64_t> &errors;
+    std::mutex &mutex;
+    std::vector<std::string> &unreadable;
+    // Directories kept open while the ones under them are walked
+    std::atomic<uint64_t> &open;
+    uint64_t maxOpen;
+};
+
+// missing when the directory does not exist, so nothing is under it anymore
+void DirectoryError(Walk &walk, const std::string &path, const std::string &error, bool missing = false)
+{
+    walk.errors++;
+    logging::warn("[Traversal] Cannot read directory " + (path.empty() ? "." : path) + ": " + error);
+    if (!missing) {
+        std::lock_guard<std::mutex> lock(walk.mutex);
+        walk.unreadable.push_back(path);
+    }
+}
+
+void AddEntry(Listing &listing, const std::string &directory, std::string_view name, PathMatcher::State state, bool isDirectory)
+{
+    std::string path = JoinPath(directory, name);
+    size_t offset = path.size() - name.size();
+    listing.entries.push_back({std::move(path), offset, state, isDirectory ? std::make_unique<Listing>() : nullptr});
+}
+
+// Runs walkChild for every directory of the listing, on the pool when
+// there are several
+template <typename WalkChild>
+void WalkChildren(Walk &walk, Listing &listing, WalkChild &&walkChild)
+{
+    std::vector<Listing::Entry *> children;
+    for (Listing::Entry &entry : listing.entries) {
+        if (entry.directory)
+            children.push_back(&entry);
+    }
+
+    // A single directory is not worth a task
+    if (children.size() == 1) {
+        walkChild(*children[0]);
+    } else if (!children.empty()) {
+        std::vector<ThreadPool::Task> tasks;
+        tasks.reserve(children.size());
+        for (Listing::Entry *child : children)
+            tasks.push_back([&walkChild, child] { walkChild(*child); });
+        walk.pool.Run(std::move(tasks));
+    }
+}
+
+#ifdef __linux__
+
+// Layout of the entries getdents64 returns
+struct Dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Longest path from an open directory the ones under it are opened by. A
+// directory whose path from the closest one kept open is this long is kept
+// open as well, so no path gets near PATH_MAX however deep the tree
+static constexpr size_t MAX_RELATIVE_PATH = PATH_MAX / 2;
+
+// Reads the directory at path, open as fd, into listing, then the
+// directories under it that may have matches. Closes fd. base is the
+// closest directory above kept open, path from relative on is the path from
+// it. fd is kept open for the directories under it unless walk.maxOpen are
+// open already, then it is closed before them and they are opened from base
+void WalkDirectory(Walk &walk, int fd, int base, size_t relative, const std::string &path, PathMatcher::State state,
+        Listing &listing)
+{
+    // Parsed before any task for the children runs, so one buffer per
+    // thread is enough
+    thread_local std::vector<char> buffer(DIRENT_BUFFER);
+    uint64_t entries = 0;
+    while (true) {
+        long bytes = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        if (bytes < 0) {
+            DirectoryError(walk, path, std::strerror(errno));
+            break;
+        }
+        if (bytes == 0)
+            break;
+
+        for (long offset = 0; offset < bytes;) {
+            const Dirent64 *entry = reinterpret_cast<const Dirent64 *>(buffer.data() + offset);
+            offset += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+            entries++;
+
+            PathMatcher::State next = walk.matcher.Feed(state, name);
+            if (next == PathMatcher::DEAD)
+                continue;
+
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                    continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+            }
+            if (type == DT_LNK && walk.matcher.Matches(next)) {
+                struct stat st;
+                if (fstatat(fd, name, &st, 0) == 0 && S_ISREG(st.st_mode))
+                    type = DT_REG;
+            }
+
+            if (type == DT_REG && walk.matcher.Matches(next)) {
+                AddEntry(listing, path, name, next, false);
+            } else if (type == DT_DIR) {
+                // Excluded directories are not even opened
+                PathMatcher::State below = walk.matcher.Descend(next);
+                if (below != PathMatcher::DEAD)
+                    AddEntry(listing, path, name, below, true);
+            }
+        }
+    }
+    walk.directories++;
+    walk.entries += entries;
+    listing.Sort();
+
+    bool counted = ++walk.open <= walk.maxOpen;
+    if (!counted)
+        walk.open--;
+    bool keep = counted || path.size() - relative >= MAX_RELATIVE_PATH;
+    if (!keep)
+        close(fd);
+
+    int childBase = keep ? fd : base;
+    WalkChildren(walk, listing, [&walk, keep, childBase, relative](Listing::Entry &child) {
+        size_t from = keep ? child.name : relative;
+        int childFd = openat(childBase, child.path.c_str() + from, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (childFd < 0) {
+            // Deleted since it was listed
+            if (errno != ENOENT)
+                DirectoryError(walk, child.path, std::strerror(errno));
+            return;
+        }
+        WalkDirectory(walk, childFd, childBase, from, child.path, child.state, *child.directory);
+    });
+
+    if (keep) {
+        close(fd);
+        if (counted)
+            walk.open--;
+    }
+}
+
+void WalkRoot(Walk &walk, const std::string &root, Listing &listing)
+{
+    PathMatcher::State state = walk.matcher.RootState(root);
+    if (state == PathMatcher::DEAD)
+        return;
+
+    int fd = open(root.empty() ? "." : root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        int error = errno;
+        DirectoryError(walk, root, std::strerror(error), error == ENOENT);
+        return;
+    }
+    // The path of a root is its path from the working directory
+    WalkDirectory(walk, fd, AT_FDCWD, 0, root, state, listing);
+}
+
+uint64_t MaxOpenDirectories()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY)
+        return 1024;
+    return std::max<uint64_t>(limit.rlim_cur / 4, 1);
+}
+
+#else
+
+// Same as above, through std::filesystem with full paths
+void WalkDirectory(Walk &walk, const std::string &path, PathMatcher::State state, Listing &listing, bool root = false)
+{
+    namespace fs = std::filesystem;
+
+    std::error_code ec;
+    fs::directory_iterator it(path.empty() ? fs::path(".") : fs::path(path), ec);
+    if (ec) {
+        bool missing = ec == std::errc::no_such_file_or_directory;
+        if (!missing || root)
+            DirectoryError(walk, path, ec.message(), missing);
+        return;
+    }
+
+    uint64_t entries = 0;
+    for (; it != fs::directory_iterator(); it.increment(ec)) {
+        entries++;
+        std::string name = it->path().filename().string();
+        PathMatcher::State next = walk.matcher.Feed(state, name);
+        if (next == PathMatcher::DEAD)
+            continue;
+
+        fs::file_type type = it->symlink_status(ec).type();
+        if (type == fs::file_type::symlink && walk.matcher.Matches(next))
+            type = it->status(ec).type() == fs::file_type::regular ? fs::file_type::regular : type;
+
+        if (type == fs::file_type::regular && walk.matcher.Matches(next)) {
+            AddEntry(listing, path, name, next, false);
+        } else if (type == fs::file_type::directory) {
+            PathMatcher::State below = walk.matcher.Descend(next);
+            if (below != PathMatcher::DEAD)
+                AddEntry(listing, path, name, below, true);
+        }
+    }
+    if (ec)
+        DirectoryError(walk, path, ec.message());
+    // Closed before the directories under it are walked
+    it = fs::directory_iterator();
+    walk.directories++;
+    walk.entries += entries;
+    listing.Sort();
+
+    WalkChildren(walk, listing, [&walk](Listing::Entry &child) {
+        WalkDirectory(walk, child.path, child.state, *child.directory);
+    });
+}
+
+void WalkRoot(Walk &walk, const std::string &root, Listing &listing)
+{
+    PathMatcher::State state = walk.matcher.RootState(root);
+    if (state != PathMatcher::DEAD)
+        WalkDirectory(walk, root, state, listing, true);
+}
+
+// Only the iterator of the directory being read is open at a time
+uint64_t MaxOpenDirectories()
+{
+    return 0;
+}
+
+#endif
+
+}
+
+// Whether walking outer walks inner as well: inner is under it and none of
+// the directories on the way is a symbolic link the walk would not follow
+static bool WalkedUnder(const std::string &outer, const std::string &inner)
+{
+    std::string prefix = outer.empty() || outer.ends_with("/") ? outer : outer + "/";
+    if (outer.empty() ? inner.starts_with("/") : !inner.starts_with(prefix))
+        return false;
+
+    for (size_t pos = prefix.size(); pos < inner.size();) {
+        size_t slash = std::min(inner.find('/', pos), inner.size());
+        std::error_code ec;
+        if (std::filesystem::is_symlink(inner.substr(0, slash), ec))
+            return false;
+        pos = slash + 1;
+    }
+    return true;
+}
+
+std::vector<std::string> TreeWalker::Expand(const PathMatcher &matcher, Stats *stats,
+        std::vector<std::string> *walked)
+{
+    return WalkRoots(matcher, matcher.Roots(), stats, walked);
+}
+
+std::vector<std::string> TreeWalker::ExpandUnder(const PathMatcher &matcher, const std::string &directory,
+        Stats *stats, std::vector<std::string> *walked)
+{
+    // Roots under the directory are walked on their own when the way to
+    // them is a symbolic link
+    std::vector<std::string> roots{directory};
+    std::string prefix = directory.empty() || directory.ends_with("/") ? directory : directory + "/";
+    for (const std::string &root : matcher.Roots()) {
+        if (prefix.empty() ? !root.starts_with("/") : root.starts_with(prefix))
+            roots.push_back(root);
+    }
+    return WalkRoots(matcher, roots, stats, walked);
+}
+
+std::vector<std::string> TreeWalker::WalkRoots(const PathMatcher &matcher, const std::vector<std::string> &candidates,
+        Stats *stats, std::vector<std::string> *walked)
+{
+    // The matcher has every glob, a root under another one is walked with it
+    std::vector<std::string> roots;
+    for (const std::string &root : candidates) {
+        if (std::none_of(roots.begin(), roots.end(), [&root](const std::string &outer) { return WalkedUnder(outer, root); }))
+            roots.push_back(root);
+    }
+
+    std::vector<Listing> listings(roots.size());
+    std::atomic<uint64_t> directories = 0;
+    std::atomic<uint64_t> entries = 0;
+    std::atomic<uint64_t> errors = 0;
+    std::mutex mutex;
+    std::vector<std::string> unreadable;
+    std::atomic<uint64_t> open = 0;
+    uint64_t maxOpen = MaxOpenDirectories();
+
+    std::vector<ThreadPool::Task> tasks;
+    for (size_t i = 0; i < roots.size(); i++) {
+        tasks.push_back([&, i] {
+            Walk walk{m_Pool, matcher, directories, entries, errors, mutex, unreadable, open, maxOpen};
+            WalkRoot(walk, roots[i], listings[i]);
+        });
+    }
+    m_Pool.Run(std::move(tasks));
+
+    // Files of every root are in order already
+    std::vector<std::string> files;
+    if (walked)
+        walked->assign(roots.begin(), roots.end());
+    for (Listing &listing : listings) {
+        size_t middle = files.size();
+        listing.Flatten(files, walked);
+        if (middle > 0)
+            std::inplace_merge(files.begin(), files.begin() + middle, files.end());
+    }
+    if (roots.size() > 1)
+        files.erase(std::unique(files.begin(), files.end()), files.end());
+
+    if (stats) {
+        stats->directories = directories;
+        stats->entries = entries;
+        stats->errors = errors;
+        std::sort(unreadable.begin(), unreadable.end());
+        stats->unreadable = std::move(unreadable);
+    }
+    return files;
+}
+
+TreeListing::TreeListing(const std::string &path, const std::string &tag) :
+    m_Path(path),
+    m_Tag(tag)
+{}
+
+// File format:
+//   treelisting 1
+//   <tag>
+//   <path>
+//   ...
+void TreeListing::Load()
+{
+    m_Files.clear();
+    m_Known = false;
+
+    std::ifstream in(m_Path);
+    if (!in.is_open())
+        return;
+
+    std::string line;
+    if (!std::getline(in, line) || line != LISTING_HEADER)
+        return;
+    if (!std::getline(in, line) || line != m_Tag) {
+        logging::msg("[Traversal] Monitored globs changed, files they match are not compared with the last run");
+        return;
+    }
+
+    while (std::getline(in, line))
+        m_Files.push_back(line);
+    if (!std::is_sorted(m_Files.begin(), m_Files.end())) {
+        logging::warn("[Traversal] Listing " + m_Path + " is corrupted, files are not compared with the last run");
+        m_Files.clear();
+        return;
+    }
+    m_Known = true;
+}
+
+void TreeListing::Save(const std::vector<std::string> &files)
+{
+    if (m_Known && files == m_Files)
+        return;
+    m_Files = files;
+    m_Known = true;
+
+    // Written next to the listing and renamed over it, like the stat cache
+    std::string tmpPath = m_Path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::trunc);
+        if (!out.is_open()) {
+            logging::err("[Traversal] Cannot open " + tmpPath);
+            return;
+        }
+
+        out << LISTING_HEADER << "\n" << m_Tag << "\n";
+        for (const std::string &file : m_Files)
+            out << file << "\n";
+
+        if (!out.good()) {
+            logging::err("[Traversal] Failed to write " + tmpPath);
+            return;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, m_Path, ec);
+    if (ec)
+        logging::err("[Traversal] Failed to replace " + m_Path + ": " + ec.message());
+}
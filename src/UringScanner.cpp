@@ -0,0 +1,392 @@
+#include <UringScanner.hpp>
+#include <CryptoUtil.hpp>
+#include <Log.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#ifdef HAVE_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// liburing is not a dependency, the rings are set up with the raw syscalls
+
+static int uring_setup(unsigned entries, io_uring_params *p)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+static int uring_register(int fd, unsigned opcode, const void *arg, unsigned nrArgs)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+struct UringScanner::Ring {
+    int fd = -1;
+
+    void *sqMap = nullptr;
+    size_t sqMapSize = 0;
+    void *cqMap = nullptr;
+    size_t cqMapSize = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_cqe *cqes;
+
+    explicit Ring(unsigned entries)
+    {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+
+        fd = uring_setup(entries, &p);
+        if (fd < 0)
+            throw std::runtime_error("io_uring_setup failed: " + std::string(strerror(errno)));
+
+        sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            sqMapSize = cqMapSize = std::max(sqMapSize, cqMapSize);
+
+        sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqMap == MAP_FAILED) {
+            sqMap = nullptr;
+            Release();
+            throw std::runtime_error("Failed to map io_uring submission queue");
+        }
+
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            cqMap = sqMap;
+        } else {
+            cqMap = mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cqMap == MAP_FAILED) {
+                cqMap = nullptr;
+                Release();
+                throw std::runtime_error("Failed to map io_uring completion queue");
+            }
+        }
+
+        sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        void *s = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (s == MAP_FAILED) {
+            Release();
+            throw std::runtime_error("Failed to map io_uring submission entries");
+        }
+        sqes = static_cast<io_uring_sqe *>(s);
+
+        auto *sq = static_cast<char *>(sqMap);
+        sqHead  = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+        sqTail  = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        sqMask  = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+
+        auto *cq = static_cast<char *>(cqMap);
+        cqHead = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        cqes   = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+    }
+
+    ~Ring() { Release(); }
+
+    void Release()
+    {
+        if (sqes)
+            munmap(sqes, sqesSize);
+        if (cqMap && cqMap != sqMap)
+            munmap(cqMap, cqMapSize);
+        if (sqMap)
+            munmap(sqMap, sqMapSize);
+        if (fd >= 0)
+            close(fd);
+        sqes = nullptr;
+        sqMap = cqMap = nullptr;
+        fd = -1;
+    }
+
+    // Queues a read, the caller makes sure there is space in the queue
+    void PrepareRead(int fileFd, void *buf, unsigned len, uint64_t offset, int bufIndex, uint64_t userData)
+    {
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = bufIndex >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = fileFd;
+        sqe->addr = reinterpret_cast<uint64_t>(buf);
+        sqe->len = len;
+        sqe->off = offset;
+        sqe->buf_index = bufIndex >= 0 ? static_cast<uint16_t>(bufIndex) : 0;
+        sqe->user_data = userData;
+
+        sqArray[index] = index;
+        // Kernel must see the entry before the new tail
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+};
+
+bool UringScanner::Available()
+{
+    static const bool available = [] {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        int fd = uring_setup(1, &p);
+        if (fd < 0)
+            return false;
+        close(fd);
+        return true;
+    }();
+    return available;
+}
+
+UringScanner::UringScanner(unsigned queueDepth, size_t bufferSize)
+    : m_Ring(nullptr), m_QueueDepth(queueDepth), m_BufferSize(bufferSize),
+      m_Buffers(nullptr), m_Registered(false)
+{
+    if (queueDepth == 0)
+        throw std::invalid_argument("io_uring queue depth must be > 0");
+
+    m_Ring = new Ring(queueDepth);
+
+    void *mem = mmap(nullptr, m_BufferSize * m_QueueDepth, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        delete m_Ring;
+        throw std::runtime_error("Failed to allocate io_uring buffers");
+    }
+    m_Buffers = static_cast<unsigned char *>(mem);
+
+    std::vector<iovec> iovecs(m_QueueDepth);
+    for (unsigned i = 0; i < m_QueueDepth; i++) {
+        iovecs[i].iov_base = m_Buffers + i * m_BufferSize;
+        iovecs[i].iov_len = m_BufferSize;
+    }
+
+    // Registering pins the buffers, it can fail on RLIMIT_MEMLOCK. Plain reads still work
+    m_Registered = uring_register(m_Ring->fd, IORING_REGISTER_BUFFERS, iovecs.data(), m_QueueDepth) == 0;
+    if (!m_Registered)
+        logging::warn("[UringScanner] Failed to register io_uring buffers (" + std::string(strerror(errno)) +
+                "), using unregistered buffers");
+}
+
+UringScanner::~UringScanner()
+{
+    delete m_Ring;
+    if (m_Buffers)
+        munmap(m_Buffers, m_BufferSize * m_QueueDepth);
+}
+
+std::vector<UringScanner::Result> UringScanner::Run(const std::vector<std::string> &files,
+        const HashingAlgorithm &algorithm, const FilterMap &filters)
+{
+    std::vector<Result> results(files.size());
+
+    if (m_Contexts.empty() || m_ContextsAlgorithm != algorithm.Id()) {
+        m_Contexts.clear();
+        for (unsigned i = 0; i < m_QueueDepth; i++)
+            m_Contexts.push_back(algorithm.NewContext());
+        m_ContextsAlgorithm = algorithm.Id();
+    }
+
+    // Each slot owns one buffer and reads one file at a time
+    struct Slot {
+        size_t file;
+        int fd = -1;
+        uint64_t offset = 0;
+        // End of the part being read. Files with bytes filters are read
+        // in the parts they keep, others in one part up to their end
+        uint64_t end = UINT64_MAX;
+        std::vector<FilterBytes::Span> parts;
+        size_t nextPart = 0;
+        std::unique_ptr<FileDigest> digest;
+    };
+    std::vector<Slot> slots(m_QueueDepth);
+    std::vector<unsigned> freeSlots;
+    for (unsigned i = m_QueueDepth; i > 0; i--)
+        freeSlots.push_back(i - 1);
+
+    size_t nextFile = 0;
+    unsigned inFlight = 0;
+    unsigned toSubmit = 0;
+
+    auto finish = [&](unsigned s, const std::string &error) {
+        Slot &slot = slots[s];
+        if (error.empty()) {
+            try {
+                results[slot.file].hash = slot.digest->Final();
+            } catch (const std::exception &e) {
+                results[slot.file].error = e.what();
+            }
+        } else {
+            results[slot.file].error = error;
+        }
+        close(slot.fd);
+        slot.fd = -1;
+        slot.digest.reset();
+        freeSlots.push_back(s);
+    };
+
+    // Moves the slot on to the next part of its file, false when it has none
+    auto nextPart = [](Slot &slot) {
+        if (slot.nextPart >= slot.parts.size())
+            return false;
+        slot.offset = slot.parts[slot.nextPart].first;
+        slot.end = slot.parts[slot.nextPart].second;
+        slot.nextPart++;
+        return true;
+    };
+
+    auto submitRead = [&](unsigned s) {
+        Slot &slot = slots[s];
+        size_t length = static_cast<size_t>(std::min<uint64_t>(m_BufferSize, slot.end - slot.offset));
+        m_Ring->PrepareRead(slot.fd, m_Buffers + s * m_BufferSize, static_cast<unsigned>(length),
+                slot.offset, m_Registered ? static_cast<int>(s) : -1, s);
+        ++inFlight;
+        ++toSubmit;
+    };
+
+    while (nextFile < files.size() || inFlight > 0) {
+        // Start reading new files while there are free slots
+        while (!freeSlots.empty() && nextFile < files.size()) {
+            size_t f = nextFile++;
+
+            // The YAML parser reads the file itself
+            auto it = filters.find(files[f]);
+            if (it != filters.end() && it->second.Keys() && it->second.Keys()->DocumentFormat() == FilterKeys::Format::YAML) {
+                try {
+                    results[f].hash = SHAFileUtil::SHA_Agnostic(files[f], algorithm.ThreadContext(), filters);
+                } catch (const std::exception &e) {
+                    results[f].error = e.what();
+                }
+                continue;
+            }
+
+            int fd = open(files[f].c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                results[f].error = "Failed to open file: " + files[f];
+                continue;
+            }
+
+            unsigned s = freeSlots.back();
+            freeSlots.pop_back();
+            slots[s].file = f;
+            slots[s].fd = fd;
+            slots[s].offset = 0;
+            slots[s].parts.assign(1, {0, UINT64_MAX});
+            slots[s].nextPart = 0;
+            try {
+                slots[s].digest = std::make_unique<FileDigest>(*m_Contexts[s], files[f], filters);
+
+                // Only the kept parts of files with bytes filters are read
+                if (it != filters.end() && it->second.Bytes()) {
+                    struct stat st;
+                    if (fstat(fd, &st) != 0)
+                        throw std::runtime_error("Failed to stat file: " + files[f]);
+                    slots[s].parts = it->second.Bytes()->Kept(static_cast<uint64_t>(st.st_size));
+                }
+            } catch (const std::exception &e) {
+                slots[s].digest.reset();
+                results[f].error = e.what();
+                close(fd);
+                slots[s].fd = -1;
+                freeSlots.push_back(s);
+                continue;
+            }
+            if (!nextPart(slots[s])) {
+                finish(s, "");
+                continue;
+            }
+            submitRead(s);
+        }
+
+        if (inFlight == 0)
+            continue;
+
+        int ret = uring_enter(m_Ring->fd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("io_uring_enter failed: " + std::string(strerror(errno)));
+        }
+        toSubmit -= std::min(toSubmit, static_cast<unsigned>(ret));
+
+        // Drain the completion queue
+        unsigned head = *m_Ring->cqHead;
+        unsigned tail = __atomic_load_n(m_Ring->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe &cqe = m_Ring->cqes[head & *m_Ring->cqMask];
+            unsigned s = static_cast<unsigned>(cqe.user_data);
+            int res = cqe.res;
+            --inFlight;
+
+            if (res < 0) {
+                finish(s, "Failed to read file: " + files[slots[s].file] + ": " + strerror(-res));
+                continue;
+            }
+            if (res == 0) {
+                finish(s, "");
+                continue;
+            }
+
+            try {
+                slots[s].digest->Update(std::string_view(
+                        reinterpret_cast<const char *>(m_Buffers + s * m_BufferSize), static_cast<size_t>(res)));
+            } catch (const std::exception &e) {
+                finish(s, e.what());
+                continue;
+            }
+            slots[s].offset += static_cast<uint64_t>(res);
+            if (slots[s].offset >= slots[s].end && !nextPart(slots[s])) {
+                finish(s, "");
+                continue;
+            }
+            submitRead(s);
+        }
+        __atomic_store_n(m_Ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    return results;
+}
+
+#else
+
+// Built without io_uring support, Monitor falls back to the regular readers
+
+bool UringScanner::Available()
+{
+    return false;
+}
+
+UringScanner::UringScanner(unsigned queueDepth, size_t bufferSize)
+    : m_Ring(nullptr), m_QueueDepth(queueDepth), m_BufferSize(bufferSize),
+      m_Buffers(nullptr), m_Registered(false)
+{
+    throw std::runtime_error("Built without io_uring support");
+}
+
+UringScanner::~UringScanner()
+{
+}
+
+std::vector<UringScanner::Result> UringScanner::Run(const std::vector<std::string> &files,
+        const HashingAlgorithm &algorithm, const FilterMap &filters)
+{
+    (void)files; (void)algorithm; (void)filters;
+    throw std::runtime_error("Built without io_uring support");
+}
+
+#endif
@@ -11,6 +11,7 @@
 #include <ctime>
 #include <iomanip>
 #include <filesystem>
+#include <mutex>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -25,6 +26,8 @@ static std::string logDir = "";
 static logging::LogVerbosity verbosity = logging::LogVerbosity::normal;
 static bool secureLogs = false;
 static bool silentLogs = false;
+// Scan workers log concurrently
+static std::mutex logMutex;
 
 namespace logging
 {
@@ -93,6 +96,8 @@ namespace logging
     
     static bool _log(const std::string& pre, const std::string& msg, bool printToCerr)
     {
+        std::lock_guard<std::mutex> lock(logMutex);
+
         try {
             auto now = std::chrono::system_clock::now();
             std::time_t now_time = std::chrono::system_clock::to_time_t(now);
@@ -0,0 +1,94 @@
+// Checks that files the globs of files: expand to but that can not be read
+// do not fail the files hashed with them, see Monitor::ScanFiles:
+//
+//   scan_errors_test
+//
+// A tree with a file nobody may read and a file deleted after the tree was
+// walked is expanded with "<tree>/**" and every file is hashed in one batch
+// with TryRunBatch, with SHA-256, whose batches are hashed all at once, and
+// with BLAKE3. The readable files have to get the digests Run gives them and
+// the two others an error. io_uring, when available, has to report the same.
+// Running as root, the file nobody may read is read anyway and has to match.
+#include <HashingAlgorithm.hpp>
+#include <PathMatcher.hpp>
+#include <ThreadPool.hpp>
+#include <Traversal.hpp>
+#include <UringScanner.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static int s_Failures = 0;
+
+static void Expect(bool condition, const std::string &what)
+{
+    if (!condition) {
+        std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+        s_Failures++;
+    }
+}
+
+int main()
+{
+    namespace fs = std::filesystem;
+    fs::path root = fs::temp_directory_path() / ("scan_errors_test." + std::to_string(getpid()));
+    fs::create_directories(root / "sub");
+    std::string secret = (root / "sub" / "secret").string();
+    std::string gone = (root / "sub" / "gone").string();
+    for (const char *name : {"a", "b", "sub/c", "sub/secret", "sub/gone"})
+        std::ofstream(root / name, std::ios::binary) << "contents of " << name << "\n";
+    fs::permissions(secret, fs::perms::none);
+    bool rootUser = geteuid() == 0;
+
+    ThreadPool pool(2);
+    PathMatcher matcher;
+    matcher.Include(root.string() + "/**");
+    matcher.Compile();
+    std::vector<std::string> files = TreeWalker(pool).Expand(matcher);
+    Expect(files.size() == 5, "the tree expands to 5 files, got " + std::to_string(files.size()));
+    Expect(std::find(files.begin(), files.end(), secret) != files.end(), "the unreadable file is expanded");
+    fs::remove(gone);
+
+    auto failing = [&](const std::string &file) { return file == gone || (file == secret && !rootUser); };
+    FilterMap filters;
+    HashingAlgorithmSHA256 sha256;
+    HashingAlgorithmBLAKE3 blake3;
+    for (const HashingAlgorithm *algorithm : {static_cast<const HashingAlgorithm*>(&sha256),
+            static_cast<const HashingAlgorithm*>(&blake3)}) {
+        std::vector<std::string> errors;
+        std::vector<std::string> hashes = algorithm->TryRunBatch(files, filters, errors);
+        for (size_t i = 0; i < files.size(); i++) {
+            std::string what = algorithm->Name() + " " + files[i];
+            if (failing(files[i])) {
+                Expect(!errors[i].empty() && hashes[i].empty(), what + " reports an error");
+                continue;
+            }
+            Expect(errors[i].empty(), what + " is hashed, got " + errors[i]);
+            Expect(hashes[i] == algorithm->Run(files[i], filters), what + " has the digest of Run");
+        }
+
+        if (!UringScanner::Available())
+            continue;
+        UringScanner uring(8, 64 * 1024);
+        std::vector<UringScanner::Result> results = uring.Run(files, *algorithm, filters);
+        for (size_t i = 0; i < files.size(); i++) {
+            std::string what = algorithm->Name() + " io_uring " + files[i];
+            if (failing(files[i]))
+                Expect(!results[i].error.empty(), what + " reports an error");
+            else
+                Expect(results[i].error.empty() && results[i].hash == hashes[i], what + " has the digest of Run");
+        }
+    }
+
+    fs::permissions(secret, fs::perms::owner_all);
+    fs::remove_all(root);
+    if (rootUser)
+        std::printf("Running as root, the file nobody may read was read\n");
+    std::printf("%s\n", s_Failures ? "FAILED" : "OK");
+    return s_Failures ? 1 : 0;
+}